@@ -0,0 +1,51 @@
+/*
+Matrix buffer allocations per training step of the EMNIST CNN from main.cpp.
+One step is what the training loop in main.cpp does per batch: a predict for the loss and a fit of one epoch.
+*/
+#include "../include/core/matrix.h"
+#include "../include/core/utils.h"
+#include "../include/core/allocator.h"
+#include "../include/emnist.h"
+#include "../include/network.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+
+int main()
+{
+    const int batch_size=128,steps=10;
+
+    Network nn;
+    build_emnist(nn);
+
+    Matrix X=Matrix::random(batch_size,784,0.0,1.0);
+    Matrix Y=Matrix::zeros(batch_size,EMNIST_CLASSES);
+    for(int i=0;i<batch_size;i++) Y(i,std::rand()%EMNIST_CLASSES)=1.0;
+
+    //first step sizes the per-layer caches
+    nn.predict(X);
+    nn.fit(X,Y,1,0.001);
+
+    Matrix::reset_stats();
+    matrix_allocator().reset_stats();
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int i=0;i<steps;i++)
+    {
+        Matrix output=nn.predict(X);
+        nn.fit(X,Y,1,0.001);
+    }
+    std::chrono::duration<double> elapsed=std::chrono::high_resolution_clock::now()-start;
+    MatrixStats stats=Matrix::stats();
+    AllocatorStats pool=matrix_allocator().stats();
+
+    std::cout << "EMNIST CNN, batch " << batch_size << ", " << steps << " steps" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Allocations per step: " << (double)stats.allocations/steps << std::endl;
+    std::cout << "MB allocated per step: " << (double)stats.bytes/steps/(1024.0*1024.0) << std::endl;
+    std::cout << "Deep copies per step: " << (double)stats.copies/steps << std::endl;
+    std::cout << "System allocations per step: " << (double)pool.system_allocations/steps << std::endl;
+    std::cout << "Peak MB in use: " << (double)pool.peak_bytes/(1024.0*1024.0) << std::endl;
+    std::cout << "Time per step: " << elapsed.count()/steps*1000.0 << " ms" << std::endl;
+    return 0;
+}
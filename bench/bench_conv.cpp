@@ -0,0 +1,80 @@
+/*
+Time of every convolution algorithm of the CPU engine on the two Conv2D layers of the EMNIST CNN from main.cpp, for
+the forward pass, the input gradient and the weight gradient of a batch, and the algorithm the autotuner keeps.
+The last two shapes are the same layers as padded stride 2 convolutions, which downsample without the Pooling.
+*/
+#include "../include/core/matrix.h"
+#include "../include/core/conv_engine.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+namespace
+{
+    const int batch_size=128,repeats=10;
+
+    template<class F> double milliseconds(F pass)
+    {
+        pass();
+        auto start=std::chrono::steady_clock::now();
+        for(int i=0;i<repeats;i++) pass();
+        std::chrono::duration<double,std::milli> elapsed=std::chrono::steady_clock::now()-start;
+        return elapsed.count()/repeats;
+    }
+}
+
+int main()
+{
+    const ConvShape shapes[]={{batch_size,28,28,1,32,3},{batch_size,13,13,32,64,3},{batch_size,28,28,1,32,3,2,1},{batch_size,14,14,32,64,3,2,1}};
+    const ConvAlgorithm algorithms[]={ConvAlgorithm::Im2col,ConvAlgorithm::Direct,ConvAlgorithm::Winograd};
+    const ConvPass passes[]={ConvPass::Forward,ConvPass::BackwardData,ConvPass::BackwardFilter};
+    const char* names[]={"forward","input grad","weight grad"};
+
+    std::cout << "EMNIST Conv2D layers, " << sizeof(real)*8 << "-bit, batch " << batch_size << ", ms per batch" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for(const ConvShape& s:shapes)
+    {
+        Matrix input=Matrix::random(s.batch,s.d*s.h*s.w);
+        Matrix kernels=Matrix::random(s.f,s.d*s.k*s.k);
+        Matrix output=Matrix::zeros(s.batch,s.f*s.oh()*s.ow());
+        Matrix delta=Matrix::random(s.batch,s.f*s.oh()*s.ow());
+        Matrix prev=Matrix::zeros(s.batch,s.d*s.h*s.w);
+        Matrix dk=Matrix::zeros(s.f,s.d*s.k*s.k);
+        Matrix db=Matrix::zeros(1,s.f);
+
+        std::cout << "Conv2D(" << s.h << "," << s.w << "," << s.d << "," << s.f << "," << s.k;
+        if(s.stride!=1||s.pad!=0) std::cout << "," << s.stride << "," << s.pad;
+        std::cout << ")" << std::endl;
+        std::cout << "               im2col     direct   winograd   tuned" << std::endl;
+        for(int p=0;p<3;p++)
+        {
+            auto run=[&](const ConvAlgorithm* algorithm)
+            {
+                switch(passes[p])
+                {
+                    case ConvPass::Forward:
+                        if(algorithm) conv_forward(*algorithm,s,&input(0,0),&kernels(0,0),&output(0,0));
+                        else conv_forward(s,&input(0,0),&kernels(0,0),&output(0,0));
+                        break;
+                    case ConvPass::BackwardData:
+                        if(algorithm) conv_backward_data(*algorithm,s,&delta(0,0),&kernels(0,0),&prev(0,0));
+                        else conv_backward_data(s,&delta(0,0),&kernels(0,0),&prev(0,0));
+                        break;
+                    case ConvPass::BackwardFilter:
+                        if(algorithm) conv_backward_filter(*algorithm,s,&input(0,0),&delta(0,0),&dk(0,0),&db(0,0));
+                        else conv_backward_filter(s,&input(0,0),&delta(0,0),&dk(0,0),&db(0,0));
+                        break;
+                }
+            };
+            std::cout << std::left << std::setw(12) << names[p] << std::right;
+            for(const ConvAlgorithm& algorithm:algorithms)
+            {
+                if(conv_supports(algorithm,passes[p],s)) std::cout << std::setw(11) << milliseconds([&]{run(&algorithm);});
+                else std::cout << std::setw(11) << "-";
+            }
+            run(nullptr);
+            std::cout << "   " << conv_algorithm_name(conv_tuned(passes[p],s)) << std::endl;
+        }
+    }
+    return 0;
+}
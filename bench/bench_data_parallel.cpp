@@ -0,0 +1,59 @@
+/*
+Training throughput of the EMNIST CNN from main.cpp from one core up to all of them, with the threads inside the
+layers (FitOptions::workers=1) and with one data-parallel worker per thread. Efficiency is the speedup over the
+single-core run divided by the number of threads.
+*/
+#include "../include/core/matrix.h"
+#include "../include/core/utils.h"
+#include "../include/emnist.h"
+#include "../include/network.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <vector>
+#include <omp.h>
+
+namespace
+{
+    const int batch_size=128,batches=8;
+
+    double samples_per_sec(const Matrix& X,const Matrix& Y,int threads,int workers)
+    {
+        omp_set_num_threads(threads);
+        Network nn;
+        build_emnist(nn);
+        FitOptions options;
+        options.batch_size=batch_size;
+        options.workers=workers;
+        //warm up, sizes the per-layer caches and the allocator pool
+        nn.fit(X.view(0,batch_size),Y.view(0,batch_size),1,0.001,options);
+        return nn.fit(X,Y,1,0.001,options).samples_per_sec;
+    }
+}
+
+int main()
+{
+    int n=batch_size*batches;
+    Matrix X=Matrix::random(n,784,0.0,1.0);
+    Matrix Y=Matrix::zeros(n,EMNIST_CLASSES);
+    for(int i=0;i<n;i++) Y(i,std::rand()%EMNIST_CLASSES)=1.0;
+
+    int cores=omp_get_max_threads();
+    std::vector<int> counts;
+    for(int t=1;t<cores;t*=2) counts.push_back(t);
+    counts.push_back(cores);
+
+    std::cout << "EMNIST CNN, " << sizeof(real)*8 << "-bit, batch " << batch_size << ", " << cores << " cores" << std::endl;
+    std::cout << "threads   layer-parallel samples/s (eff)   data-parallel samples/s (eff)" << std::endl;
+    double single=0.0;
+    for(int t:counts)
+    {
+        double inside=samples_per_sec(X,Y,t,1);
+        if(t==1) single=inside;
+        double parallel=t>1?samples_per_sec(X,Y,t,t):inside;
+        std::cout << std::fixed << std::setw(7) << t;
+        std::cout << std::setprecision(1) << std::setw(20) << inside << " (" << std::setprecision(0) << std::setw(3) << 100.0*inside/(t*single) << "%)";
+        std::cout << std::setprecision(1) << std::setw(23) << parallel << " (" << std::setprecision(0) << std::setw(3) << 100.0*parallel/(t*single) << "%)" << std::endl;
+    }
+    return 0;
+}
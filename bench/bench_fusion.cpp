@@ -0,0 +1,59 @@
+/*
+Inference latency and throughput of the EMNIST CNN from main.cpp before and after Network::compile().
+Batch 1 is what server.cpp sees per request, batch 128 is what the accuracy evaluation in main.cpp runs.
+*/
+#include "../include/core/matrix.h"
+#include "../include/core/utils.h"
+#include "../include/emnist.h"
+#include "../include/network.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+void measure(Network& nn,const Matrix& X,const char* label)
+{
+    typedef std::chrono::steady_clock clock;
+    const int requests=300,batch_size=128,batches=4;
+    std::vector<double> latency;
+    for(int i=0;i<requests;i++)
+    {
+        auto start=clock::now();
+        nn.predict(X.view(i%X.rows,i%X.rows+1));
+        latency.push_back(std::chrono::duration<double,std::milli>(clock::now()-start).count());
+    }
+    std::sort(latency.begin(),latency.end());
+
+    auto start=clock::now();
+    for(int b=0;b<batches;b++) nn.predict(X.view(0,batch_size));
+    std::chrono::duration<double> elapsed=clock::now()-start;
+
+    std::cout << std::left << std::setw(10) << label << std::right << std::fixed << std::setprecision(3);
+    std::cout << "p50 " << std::setw(8) << latency[requests/2] << " ms  p99 " << std::setw(8) << latency[requests*99/100] << " ms";
+    std::cout << std::setprecision(1) << "  batch " << batch_size << ": " << batches*batch_size/elapsed.count() << " samples/s" << std::endl;
+}
+
+int main()
+{
+    Network nn;
+    build_emnist(nn);
+
+    Matrix X=Matrix::random(128,784,0.0,1.0);
+    Matrix Y=Matrix::zeros(128,EMNIST_CLASSES);
+    for(int i=0;i<128;i++) Y(i,i%EMNIST_CLASSES)=1.0;
+    //a few steps so the BatchNorm running statistics are not trivial
+    nn.fit(X,Y,2,0.001);
+
+    Matrix reference=nn.predict(X);
+    measure(nn,X,"layers");
+    nn.compile();
+    measure(nn,X,"compiled");
+
+    Matrix output=nn.predict(X);
+    double diff=0.0;
+    for(int i=0;i<output.rows;i++) for(int j=0;j<output.cols;j++) diff=std::max<double>(diff,std::fabs(output(i,j)-reference(i,j)));
+    std::cout << std::scientific << std::setprecision(2) << "Max difference: " << diff << std::endl;
+    return 0;
+}
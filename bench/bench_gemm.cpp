@@ -0,0 +1,172 @@
+/*
+GFLOP/s of the CPU gemm on the Dense layer shapes of the EMNIST model in main.cpp.
+Each layer is timed for its forward product and both backward products (batch 128),
+for every micro kernel the CPU supports and for the old ikj loop as a baseline.
+Before timing, every micro kernel is checked against a naive triple loop on those shapes and on small odd ones that
+leave partial tiles, with every transpose, alpha, beta and padded strides; any mismatch fails the run.
+*/
+#include "../include/core/gemm.h"
+#include <omp.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string>
+
+struct Shape
+{
+    std::string name;
+    bool trans_a,trans_b;
+    int m,n,k;
+};
+
+void ikj(const Shape& s,const real* A,const real* B,real* C)
+{
+    std::memset(C,0,(size_t)s.m*s.n*sizeof(real));
+    #pragma omp parallel for
+    for(int i=0;i<s.m;i++) for(int k=0;k<s.k;k++)
+    {
+        real a=s.trans_a?A[(size_t)k*s.m+i]:A[(size_t)i*s.k+k];
+        for(int j=0;j<s.n;j++) C[(size_t)i*s.n+j]+=a*(s.trans_b?B[(size_t)j*s.k+k]:B[(size_t)k*s.n+j]);
+    }
+}
+
+/*
+C = alpha*op(A)*op(B) + beta*C of the current micro kernel against a triple loop in double, with lda/ldb/ldc padded
+past the matrices. An element may be off by the rounding of a k-term sum of the magnitudes of its products.
+*/
+bool check(const Shape& s,real alpha,real beta,int pad)
+{
+    int lda=(s.trans_a?s.m:s.k)+pad,ldb=(s.trans_b?s.k:s.n)+pad,ldc=s.n+pad;
+    std::vector<real> A((size_t)(s.trans_a?s.k:s.m)*lda),B((size_t)(s.trans_b?s.n:s.k)*ldb),C((size_t)s.m*ldc);
+    for(auto& x:A) x=(double)std::rand()/RAND_MAX-0.5;
+    for(auto& x:B) x=(double)std::rand()/RAND_MAX-0.5;
+    for(auto& x:C) x=(double)std::rand()/RAND_MAX-0.5;
+    std::vector<real> before=C;
+    gemm(s.trans_a,s.trans_b,s.m,s.n,s.k,alpha,A.data(),lda,B.data(),ldb,beta,C.data(),ldc);
+
+    double eps=std::numeric_limits<real>::epsilon();
+    for(int i=0;i<s.m;i++)
+    {
+        for(int j=0;j<ldc;j++)
+        {
+            double got=C[(size_t)i*ldc+j],c0=before[(size_t)i*ldc+j];
+            //the padding past n is not part of C
+            if(j>=s.n)
+            {
+                if(got!=c0) {std::cout << "gemm wrote past column " << s.n << " of row " << i << std::endl; return false;}
+                continue;
+            }
+            double sum=0.0,magnitude=0.0;
+            for(int p=0;p<s.k;p++)
+            {
+                double a=s.trans_a?A[(size_t)p*lda+i]:A[(size_t)i*lda+p];
+                double b=s.trans_b?B[(size_t)j*ldb+p]:B[(size_t)p*ldb+j];
+                sum+=a*b;
+                magnitude+=std::fabs(a*b);
+            }
+            double want=alpha*sum+(beta!=0.0?beta*c0:0.0);
+            double tolerance=(s.k+2)*eps*(std::fabs(alpha)*magnitude+std::fabs(beta*c0))+eps;
+            if(!(std::fabs(got-want)<=tolerance))
+            {
+                std::cout << "C(" << i << "," << j << ") is " << got << ", the triple loop gives " << want << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+double time_gflops(const Shape& s,const std::vector<real>& A,const std::vector<real>& B,std::vector<real>& C,bool naive)
+{
+    int lda=s.trans_a?s.m:s.k,ldb=s.trans_b?s.k:s.n;
+    auto run=[&](){
+        if(naive) ikj(s,A.data(),B.data(),C.data());
+        else gemm(s.trans_a,s.trans_b,s.m,s.n,s.k,1.0,A.data(),lda,B.data(),ldb,0.0,C.data(),s.n);
+    };
+    run();
+    int reps=0;
+    auto start=std::chrono::high_resolution_clock::now();
+    double elapsed=0.0;
+    while(elapsed<0.5||reps<3)
+    {
+        run();
+        reps++;
+        elapsed=std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-start).count();
+    }
+    return 2.0*s.m*s.n*s.k*reps/elapsed*1e-9;
+}
+
+int main()
+{
+    const int batch=128;
+    int layers[][2]={{1600,512},{512,128},{128,47}};
+    std::vector<Shape> shapes;
+    for(auto& l:layers)
+    {
+        std::string name=std::to_string(l[0])+"x"+std::to_string(l[1]);
+        shapes.push_back({name,false,false,batch,l[1],l[0]});   //X*W
+        shapes.push_back({name,true,false,l[0],l[1],batch});    //X^T*delta
+        shapes.push_back({name,false,true,batch,l[0],l[1]});    //delta*W^T
+    }
+    const char* passes[]={"forward  X*W","backward X^T*dY","backward dY*W^T"};
+
+    std::vector<std::string> isas={"ikj"};
+    for(const char* isa:{"generic","avx2","avx512"}) if(gemm_set_isa(isa)) isas.push_back(isa);
+
+    //odd sizes below and across the micro tiles and cache blocks, so every kernel runs its edge paths
+    std::vector<Shape> checked=shapes;
+    const int odd[][3]={{1,1,1},{3,5,2},{7,13,5},{17,31,9},{33,65,300},{129,47,513}};
+    for(auto& o:odd) for(int t=0;t<4;t++) checked.push_back({"odd",t/2==1,t%2==1,o[0],o[1],o[2]});
+    const real scalars[][2]={{1.0,0.0},{-0.5,1.0},{2.0,-1.5}};
+    int failures=0;
+    for(size_t i=1;i<isas.size();i++)
+    {
+        gemm_set_isa(isas[i].c_str());
+        int checks=0;
+        for(size_t j=0;j<checked.size();j++)
+        {
+            const Shape& s=checked[j];
+            //the EMNIST shapes are large, once each is enough for them
+            int variants=s.name=="odd"?3:1;
+            for(int v=0;v<variants;v++,checks++)
+            {
+                if(check(s,scalars[v][0],scalars[v][1],v)) continue;
+                std::cout << "  " << isas[i] << " " << (s.trans_a?"A^T":"A") << "*" << (s.trans_b?"B^T":"B") << " m=" << s.m << " n=" << s.n << " k=" << s.k << " alpha=" << scalars[v][0] << " beta=" << scalars[v][1] << std::endl;
+                failures++;
+            }
+        }
+        std::cout << isas[i] << ": " << checks << " products checked against the triple loop" << std::endl;
+    }
+    if(failures)
+    {
+        std::cout << failures << " products do not match" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Threads: " << omp_get_max_threads() << std::endl;
+    std::cout << std::left << std::setw(12) << "layer" << std::setw(18) << "product";
+    for(auto& isa:isas) std::cout << std::right << std::setw(10) << isa;
+    std::cout << "   (GFLOP/s)" << std::endl;
+
+    for(size_t i=0;i<shapes.size();i++)
+    {
+        const Shape& s=shapes[i];
+        std::vector<real> A((size_t)s.m*s.k),B((size_t)s.k*s.n),C((size_t)s.m*s.n);
+        for(auto& x:A) x=(double)std::rand()/RAND_MAX-0.5;
+        for(auto& x:B) x=(double)std::rand()/RAND_MAX-0.5;
+        std::cout << std::left << std::setw(12) << s.name << std::setw(18) << passes[i%3];
+        for(auto& isa:isas)
+        {
+            bool naive=isa=="ikj";
+            if(!naive) gemm_set_isa(isa.c_str());
+            std::cout << std::right << std::setw(10) << std::fixed << std::setprecision(2) << time_gflops(s,A,B,C,naive);
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+Training throughput of the LSTM from train_asl.cpp (21 joints of x,y,z, 64 hidden units) by batch size.
+Batch 1 is the one-sample-at-a-time loop train_asl used to run, every step of a larger batch is one GEMM over all of it.
+The streaming part steps live streams one frame at a time through LSTM::step, all streams in one batch per frame.
+The long-sequence part trains on 1024 frames with every step cached and with checkpointing, reporting the memory
+held for backprop and the cost of recomputing the segments.
+Random sequences are used so the benchmark runs without the landmark CSV.
+*/
+#include "../include/core/matrix.h"
+#include "../include/layers/lstm.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+
+int main()
+{
+    const int steps=21,input_size=3,hidden_size=64,samples=4096;
+    const int batch_sizes[]={1,8,32,128};
+
+    for(int batch_size:batch_sizes)
+    {
+        LSTM lstm(input_size,hidden_size);
+        std::vector<Matrix> sequence(steps);
+        for(Matrix& x:sequence) x=Matrix::random(batch_size,input_size);
+        std::vector<Matrix> delta(steps);
+        delta.back()=Matrix::random(batch_size,hidden_size);
+
+        int batches=samples/batch_size;
+        auto start=std::chrono::steady_clock::now();
+        for(int b=0;b<batches;b++)
+        {
+            lstm.forward_pass(sequence);
+            lstm.backward_pass(delta);
+            lstm.update(0.001);
+        }
+        std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+        std::cout << "batch " << std::setw(4) << batch_size << ": " << std::fixed << std::setprecision(1) << std::setw(10) << batches*batch_size/elapsed.count() << " sequences/s" << std::endl;
+    }
+
+    const int stream_counts[]={1,16,64};
+    const int frames=2000;
+    LSTM lstm(input_size,hidden_size);
+    for(int streams:stream_counts)
+    {
+        LSTM::State state=lstm.start(streams);
+        Matrix x=Matrix::random(streams,input_size);
+        auto start=std::chrono::steady_clock::now();
+        for(int f=0;f<frames;f++) lstm.step(x,state);
+        std::chrono::duration<double,std::micro> elapsed=std::chrono::steady_clock::now()-start;
+        std::cout << "step " << std::setw(3) << streams << " streams: " << std::setprecision(1) << std::setw(8) << elapsed.count()/frames << " us per frame" << std::endl;
+    }
+
+    const int long_steps=1024,long_batch=32;
+    const int checkpoints[]={1,8,32};
+    std::vector<Matrix> sequence(long_steps);
+    for(Matrix& x:sequence) x=Matrix::random(long_batch,input_size);
+    std::vector<Matrix> delta(long_steps);
+    for(int s=0;s<long_steps;s+=16) delta[s]=Matrix::random(long_batch,hidden_size);
+    double baseline=0.0;
+    for(int every:checkpoints)
+    {
+        lstm.checkpoint_every=every;
+        auto start=std::chrono::steady_clock::now();
+        lstm.forward_pass(sequence);
+        size_t bytes=lstm.cache_bytes();
+        lstm.backward_pass(delta);
+        std::chrono::duration<double,std::milli> elapsed=std::chrono::steady_clock::now()-start;
+        if(every==1) baseline=elapsed.count();
+        std::cout << "checkpoint every " << std::setw(2) << every << ": " << std::setw(8) << bytes/1048576.0 << " MB cached, " << std::setw(8) << elapsed.count() << " ms";
+        std::cout << " (" << std::showpos << (elapsed.count()/baseline-1)*100 << std::noshowpos << "%)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+Time of one optimizer step over the parameters of the EMNIST CNN from main.cpp, split into tensors the way the layers
+used to hold them (a k x k matrix per Conv2D filter and channel), against the Adam the layers used to run themselves:
+a loop per tensor through Matrix::operator().
+Bandwidth counts the bytes Adam has to move, reading the parameter, gradient and both moments and writing back three.
+The last line steps the same values laid out as in the Network's arena, all parameters and all gradients contiguous.
+*/
+#include "../include/core/matrix.h"
+#include "../include/core/optimizer.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+int main()
+{
+    //rows x cols of every tensor: Conv2D kernels and biases, BatchNorm, Dense
+    std::vector<std::pair<int,int>> shapes;
+    for(int i=0;i<32*1;i++) shapes.push_back({3,3});
+    shapes.push_back({1,32});
+    shapes.push_back({1,26*26*32}); shapes.push_back({1,26*26*32});
+    for(int i=0;i<64*32;i++) shapes.push_back({3,3});
+    shapes.push_back({1,64});
+    shapes.push_back({1,11*11*64}); shapes.push_back({1,11*11*64});
+    shapes.push_back({1600,512}); shapes.push_back({1,512});
+    shapes.push_back({1,512}); shapes.push_back({1,512});
+    shapes.push_back({512,128}); shapes.push_back({1,128});
+    shapes.push_back({1,128}); shapes.push_back({1,128});
+    shapes.push_back({128,47}); shapes.push_back({1,47});
+
+    std::vector<Matrix> w,g,m,v;
+    std::vector<Parameter> tensors;
+    size_t total=0;
+    for(auto& shape:shapes)
+    {
+        w.push_back(Matrix::random(shape.first,shape.second));
+        g.push_back(Matrix::random(shape.first,shape.second));
+        m.push_back(Matrix::zeros(shape.first,shape.second));
+        v.push_back(Matrix::zeros(shape.first,shape.second));
+        total+=(size_t)shape.first*shape.second;
+    }
+    for(size_t i=0;i<shapes.size();i++) tensors.push_back({&w[i](0,0),&g[i](0,0),(size_t)w[i].rows*w[i].cols});
+
+    const int steps=50;
+    double bytes=7.0*sizeof(real)*total;
+    std::cout << "EMNIST CNN parameters: " << total << " in " << tensors.size() << " tensors" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    auto start=std::chrono::steady_clock::now();
+    double b1=0.9,b2=0.999,e=1e-8,lr=1e-6;
+    for(int t=1;t<=steps;t++)
+    {
+        double m_=1.0-std::pow(b1,t),v_=1.0-std::pow(b2,t);
+        for(size_t k=0;k<shapes.size();k++)
+        {
+            #pragma omp parallel for
+            for(int i=0;i<w[k].rows;i++)
+            {
+                for(int j=0;j<w[k].cols;j++)
+                {
+                    m[k](i,j)=b1*m[k](i,j)+(1-b1)*g[k](i,j);
+                    v[k](i,j)=b2*v[k](i,j)+(1-b2)*g[k](i,j)*g[k](i,j);
+                    w[k](i,j)-=lr*(m[k](i,j)/m_)/(std::sqrt(v[k](i,j)/v_)+e);
+                }
+            }
+        }
+    }
+    std::chrono::duration<double,std::milli> elapsed=std::chrono::steady_clock::now()-start;
+    std::cout << "per-layer Adam  " << std::setw(8) << elapsed.count()/steps << " ms/step " << std::setw(8) << bytes*steps/elapsed.count()/1e6 << " GB/s" << std::endl;
+
+    const Optimizer::Method methods[]={Optimizer::SGD,Optimizer::Momentum,Optimizer::Adam,Optimizer::AdamW};
+    const char* names[]={"SGD","Momentum","Adam","AdamW"};
+    for(int i=0;i<4;i++)
+    {
+        Optimizer optimizer(methods[i]);
+        optimizer.step(tensors,lr);
+        start=std::chrono::steady_clock::now();
+        for(int t=0;t<steps;t++) optimizer.step(tensors,lr);
+        elapsed=std::chrono::steady_clock::now()-start;
+        std::cout << "Optimizer " << std::left << std::setw(9) << names[i] << std::right << std::setw(8) << elapsed.count()/steps << " ms/step";
+        if(methods[i]==Optimizer::Adam||methods[i]==Optimizer::AdamW) std::cout << " " << std::setw(8) << bytes*steps/elapsed.count()/1e6 << " GB/s";
+        std::cout << std::endl;
+    }
+
+    //Network::fit steps its arena, where every parameter and every gradient is one contiguous run
+    Matrix arena=Matrix::zeros(2,total);
+    for(size_t i=0,at=0;i<tensors.size();at+=tensors[i].size,i++)
+    {
+        std::copy(tensors[i].value,tensors[i].value+tensors[i].size,&arena(0,0)+at);
+        std::copy(tensors[i].grad,tensors[i].grad+tensors[i].size,&arena(1,0)+at);
+    }
+    std::vector<Parameter> flat={{&arena(0,0),&arena(1,0),total}};
+    Optimizer optimizer;
+    optimizer.step(flat,lr);
+    start=std::chrono::steady_clock::now();
+    for(int t=0;t<steps;t++) optimizer.step(flat,lr);
+    elapsed=std::chrono::steady_clock::now()-start;
+    std::cout << "Adam on arena     " << std::setw(8) << elapsed.count()/steps << " ms/step " << std::setw(8) << bytes*steps/elapsed.count()/1e6 << " GB/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+Time of the two 2x2 stride 2 Pooling layers of the EMNIST CNN from main.cpp on a batch, against the max pooling the
+layer used to run: a std::vector of int indices per sample allocated every forward pass, and a backward pass that
+zeroes the whole input gradient before scattering into it.
+Bandwidth counts the bytes a pass has to move: forward reads the input and writes the output, backward reads the
+output gradient and writes the input gradient (indices not counted).
+*/
+#include "../include/core/matrix.h"
+#include "../include/layers/pooling.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    const int batch_size=128,repeats=20;
+
+    template<class F> double milliseconds(F pass)
+    {
+        pass();
+        auto start=std::chrono::steady_clock::now();
+        for(int i=0;i<repeats;i++) pass();
+        std::chrono::duration<double,std::milli> elapsed=std::chrono::steady_clock::now()-start;
+        return elapsed.count()/repeats;
+    }
+
+    struct OldPooling
+    {
+        int h,w,d,oh,ow;
+        std::vector<std::vector<int>> max_cache;
+
+        Matrix forward(const Matrix& input)
+        {
+            Matrix output(input.rows,oh*ow*d);
+            max_cache.assign(input.rows,std::vector<int>(oh*ow*d));
+            #pragma omp parallel for
+            for(int r=0;r<input.rows;r++)for(int depth=0;depth<d;depth++)for(int i=0;i<oh;i++)for(int j=0;j<ow;j++)
+            {
+                real max_=-std::numeric_limits<real>::max();
+                int index=-1;
+                for(int p_i=0;p_i<2;p_i++)for(int p_j=0;p_j<2;p_j++)
+                {
+                    int at=depth*h*w+(i*2+p_i)*w+j*2+p_j;
+                    if(input(r,at)>max_)
+                    {
+                        max_=input(r,at);
+                        index=at;
+                    }
+                }
+                output(r,depth*oh*ow+i*ow+j)=max_;
+                max_cache[r][depth*oh*ow+i*ow+j]=index;
+            }
+            return output;
+        }
+
+        Matrix backward(const Matrix& delta)
+        {
+            Matrix prev_delta=Matrix::zeros(delta.rows,d*h*w);
+            #pragma omp parallel for
+            for(int i=0;i<delta.rows;i++)for(int j=0;j<delta.cols;j++)prev_delta(i,max_cache[i][j])+=delta(i,j);
+            return prev_delta;
+        }
+    };
+
+    double gigabytes_per_second(size_t elements,double ms)
+    {
+        return elements*sizeof(real)/ms/1e6;
+    }
+}
+
+int main()
+{
+    const int layers[][3]={{26,26,32},{11,11,64}};
+    std::cout << "EMNIST Pooling layers, " << sizeof(real)*8 << "-bit, batch " << batch_size << ", ms per batch and GB/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for(auto& l:layers)
+    {
+        int h=l[0],w=l[1],d=l[2];
+        Pooling max_(h,w,d),average(h,w,d,2,2,0,1,PoolMode::Average);
+        int oh=h/2,ow=w/2;
+        OldPooling old{h,w,d,oh,ow};
+        Matrix input=Matrix::random(batch_size,d*h*w);
+        Matrix delta=Matrix::random(batch_size,d*oh*ow);
+        size_t moved=(size_t)batch_size*d*(h*w+oh*ow);
+        Scratch scratch;
+
+        std::cout << "Pooling(" << h << "," << w << "," << d << ")" << std::endl;
+        auto line=[&](const char* name,double ms)
+        {
+            std::cout << "  " << std::left << std::setw(20) << name << std::right << std::setw(9) << ms << " ms " << std::setw(8) << gigabytes_per_second(moved,ms) << " GB/s" << std::endl;
+        };
+        line("old max forward",milliseconds([&]{old.forward(input);}));
+        line("old max backward",milliseconds([&]{old.backward(delta);}));
+        line("max forward",milliseconds([&]{max_.forward_pass(input.view());}));
+        line("max backward",milliseconds([&]{max_.backward_pass(delta,0.0);}));
+        line("max infer",milliseconds([&]{max_.infer(input.view(),scratch);}));
+        line("average forward",milliseconds([&]{average.forward_pass(input.view());}));
+        line("average backward",milliseconds([&]{average.backward_pass(delta,0.0);}));
+    }
+    return 0;
+}
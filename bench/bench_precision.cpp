@@ -0,0 +1,51 @@
+/*
+Training and inference throughput of the EMNIST CNN from main.cpp in the precision of this build.
+make bench-precision builds and runs it as bench_precision (double) and bench_precision_f32 (float).
+The loss is printed to check float still trains.
+*/
+#include "../include/core/matrix.h"
+#include "../include/core/utils.h"
+#include "../include/emnist.h"
+#include "../include/network.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+
+int main()
+{
+    const int batch_size=128,batches=8,epochs=2;
+
+    Network nn;
+    build_emnist(nn);
+
+    int n=batch_size*batches;
+    Matrix X=Matrix::random(n,784,0.0,1.0);
+    Matrix Y=Matrix::zeros(n,EMNIST_CLASSES);
+    for(int i=0;i<n;i++) Y(i,std::rand()%EMNIST_CLASSES)=1.0;
+
+    //warm up, sizes the per-layer caches and the allocator pool
+    nn.fit(X.view(0,batch_size),Y.view(0,batch_size),1,0.001);
+
+    FitOptions options;
+    options.batch_size=batch_size;
+    auto start=std::chrono::high_resolution_clock::now();
+    nn.fit(X,Y,epochs,0.001,options);
+    std::chrono::duration<double> train=std::chrono::high_resolution_clock::now()-start;
+
+    double loss=0.0;
+    start=std::chrono::high_resolution_clock::now();
+    for(int b=0;b<batches;b++)
+    {
+        Matrix output=nn.predict(X.view(b*batch_size,(b+1)*batch_size));
+        loss+=cross_entropy_loss(Matrix(Y.view(b*batch_size,(b+1)*batch_size)),output);
+    }
+    std::chrono::duration<double> infer=std::chrono::high_resolution_clock::now()-start;
+
+    std::cout << "EMNIST CNN, " << sizeof(real)*8 << "-bit, batch " << batch_size << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Training: " << epochs*n/train.count() << " samples/s" << std::endl;
+    std::cout << "Inference: " << n/infer.count() << " samples/s" << std::endl;
+    std::cout << std::setprecision(4) << "Loss after training: " << loss/batches << std::endl;
+    return 0;
+}
@@ -4,15 +4,31 @@
 #include "./layers/layer.h"
 #include "./core/matrix.h"
 #include <functional>
+#include <vector>
 
-typedef double (*Activate)(double);
+typedef real (*Activate)(real);
+
+/*
+Functions an Activation layer can be saved with, a model file stores the index so entries are only ever appended.
+*/
+struct ActivationFunction
+{
+    const char* name;
+    Activate f;
+    Activate df;
+};
+const std::vector<ActivationFunction>& activation_functions();
 
 class Activation:public Layer
 {
+    friend class Network;
     public:
         Activation(Activate f, Activate df);
-        Matrix forward_pass(const Matrix& input) override;
+        Matrix forward_pass(const MatrixView& input) override;
         Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "Activation";}
+        std::vector<double> arguments() const override;
 
     private:
         Activate f;
@@ -0,0 +1,82 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct AllocatorStats
+{
+    long long allocations;          //requests served
+    long long system_allocations;   //requests that had to go to the system allocator
+    long long bytes_in_use;
+    long long peak_bytes;           //high water mark of bytes_in_use since the last reset_stats()
+};
+
+/*
+Source of Matrix buffers. Every block is 64-byte aligned and carries a small header naming the allocator that
+owns it, so a buffer is always returned to the right allocator even if the active one was swapped meanwhile.
+*/
+class Allocator
+{
+    public:
+        virtual ~Allocator()=default;
+        void* allocate(size_t bytes);
+        static void deallocate(void* ptr);
+        //Called by Network::fit at the end of every mini-batch
+        virtual void reset(){}
+        AllocatorStats stats();
+        void reset_stats();
+    protected:
+        static const size_t ALIGNMENT=64;
+        virtual void* acquire(size_t bytes,size_t& capacity)=0;
+        virtual void release(void* block,size_t capacity)=0;
+        //Callers hold lock
+        void* system_alloc(size_t bytes);
+        static void system_free(void* block);
+        std::mutex lock;
+    private:
+        long long allocations=0,system_allocations=0,bytes_in_use=0,peak_bytes=0;
+};
+
+//Straight to the system allocator, nothing is cached
+class SystemAllocator:public Allocator
+{
+    protected:
+        void* acquire(size_t bytes,size_t& capacity) override;
+        void release(void* block,size_t capacity) override;
+};
+
+/*
+Size-class pool. Freed blocks go on a free list for their class and are handed out again on the next request,
+so after the first mini-batch a training step allocates nothing from the system.
+reset() trims every class down to what the last mini-batch needed at its peak, so a one-off shape
+(last partial batch, evaluation batch) does not stay cached forever.
+*/
+class PoolAllocator:public Allocator
+{
+    public:
+        ~PoolAllocator();
+        void reset() override;
+    protected:
+        void* acquire(size_t bytes,size_t& capacity) override;
+        void release(void* block,size_t capacity) override;
+    private:
+        //Blocks above this size are not pooled
+        static const size_t MAX_POOLED=64<<20;
+        struct SizeClass
+        {
+            std::vector<void*> free;
+            int in_use=0;
+            int peak=0;
+        };
+        std::unordered_map<size_t,SizeClass> classes;
+        static size_t class_size(size_t bytes);
+};
+
+Allocator& matrix_allocator();
+//Allocator for Matrix buffers created from now on, nullptr restores the default pool; safe while other threads allocate
+void set_matrix_allocator(Allocator* allocator);
+
+#endif
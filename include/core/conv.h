@@ -0,0 +1,19 @@
+#ifndef CONV_H
+#define CONV_H
+
+#include "real.h"
+
+/*
+Lowering of a k x k convolution to GEMM, shared by the CPU backend and the fused inference layers. A sample is
+d x h x w, its column matrix has one row per (depth,ki,kj) and one column per output pixel, so
+out(f x oh*ow) = kernels(f x d*k*k) * col. Output pixel (i,j) reads input (i*stride-pad+ki*dilation,
+j*stride-pad+kj*dilation); positions in the padding read as zero and are never stored.
+*/
+//input sample into columns
+void im2col(const real* in,real* col,int h,int w,int d,int oh,int ow,int k,int stride=1,int pad=0,int dilation=1);
+//inverse of im2col, overlapping windows are summed into in and padding is dropped
+void col2im(const real* col,real* in,int h,int w,int d,int oh,int ow,int k,int stride=1,int pad=0,int dilation=1);
+//Output columns [lo,hi) of a row whose input column x0+j*stride falls inside 0..w-1
+void inside_columns(int x0,int stride,int w,int ow,int& lo,int& hi);
+
+#endif
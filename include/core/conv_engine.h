@@ -0,0 +1,54 @@
+#ifndef CONV_ENGINE_H
+#define CONV_ENGINE_H
+
+#include "real.h"
+
+/*
+CPU convolution engine behind Conv2D on the CPU backend (cpu_ops.cpp). A batch is stored sample after sample, each
+d x h x w, the kernels are f x d*k*k (a filter per row, its channels one k x k block after the other) and the output
+f x oh x ow per sample. Stride, zero padding and dilation follow conv.h; every algorithm reads the padding as zeros
+in its kernels, none builds a padded copy of the input.
+
+Three algorithms compute every pass:
+    Im2col      lowering to the blocked GEMM (conv.h), the general fallback
+    Direct      filters in blocks of CONV_BLOCK with the kernels in a channel-blocked (NCHWc) layout, so the innermost
+                loop updates a block of output channels at once for every input pixel
+    Winograd    F(2x2,3x3) for 3x3 kernels with stride and dilation 1: 2x2 output tiles from 4x4 input tiles with 16
+                multiplies instead of 36, the products done as 16 GEMMs over all channels and tiles
+The input gradient of Direct and Winograd is their forward pass over the output gradient, padded, with the kernels
+rotated and transposed, so it needs stride 1; the weight gradient of Winograd goes back through the tile transforms.
+*/
+enum class ConvAlgorithm {Im2col,Direct,Winograd};
+enum class ConvPass {Forward,BackwardData,BackwardFilter};
+
+struct ConvShape
+{
+    int batch,h,w,d,f,k;
+    int stride=1,pad=0,dilation=1;
+    int oh() const {return (h+2*pad-dilation*(k-1)-1)/stride+1;}
+    int ow() const {return (w+2*pad-dilation*(k-1)-1)/stride+1;}
+};
+
+//Output channels updated together by Direct, a 64-byte vector of them
+const int CONV_BLOCK=64/sizeof(real);
+
+//output = input * kernels
+void conv_forward(ConvAlgorithm algorithm,const ConvShape& shape,const real* input,const real* kernels,real* output);
+//prev_delta (the shape of input) from the output gradient delta
+void conv_backward_data(ConvAlgorithm algorithm,const ConvShape& shape,const real* delta,const real* kernels,real* prev_delta);
+//dk (the shape of kernels) and db (f values) from the input and the output gradient, both overwritten
+void conv_backward_filter(ConvAlgorithm algorithm,const ConvShape& shape,const real* input,const real* delta,real* dk,real* db);
+bool conv_supports(ConvAlgorithm algorithm,ConvPass pass,const ConvShape& shape);
+
+/*
+Autotuned forms: the first call for a pass and shape runs every algorithm that supports it on the arguments
+themselves, timing each, and caches the fastest for the shape; later calls run that one. Safe to call from any thread.
+*/
+void conv_forward(const ConvShape& shape,const real* input,const real* kernels,real* output);
+void conv_backward_data(const ConvShape& shape,const real* delta,const real* kernels,real* prev_delta);
+void conv_backward_filter(const ConvShape& shape,const real* input,const real* delta,real* dk,real* db);
+//Algorithm the autotuner picked for the pass and shape, Im2col until one has run
+ConvAlgorithm conv_tuned(ConvPass pass,const ConvShape& shape);
+const char* conv_algorithm_name(ConvAlgorithm algorithm);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "real.h"
+
+/*
+Row-major GEMM for the CPU backend: C = alpha*op(A)*op(B) + beta*C
+op(X) is X or X^T depending on the trans flag, lda/ldb/ldc are the row strides of the matrices as stored.
+Operands are packed into contiguous panels per cache block, so a transposed operand costs nothing extra.
+The register-tiled micro kernel (generic, avx2 or avx512) is picked from CPUID on first use.
+*/
+void gemm(bool trans_a,bool trans_b,int m,int n,int k,real alpha,const real* A,int lda,const real* B,int ldb,real beta,real* C,int ldc);
+
+//Name of the micro kernel in use
+const char* gemm_isa();
+//Force a micro kernel ("generic", "avx2", "avx512"), returns false if the CPU does not support it
+bool gemm_set_isa(const char* isa);
+
+#endif
@@ -8,12 +8,12 @@
 class GMatrix
 {
     public:
-        double* data;
+        real* data;
         int rows,cols;
         
         GMatrix(int rows,int cols):rows(rows),cols(cols)
         {
-            cudaError_t error = cudaMalloc(&data,(size_t)rows*(size_t)cols*sizeof(double));
+            cudaError_t error = cudaMalloc(&data,(size_t)rows*(size_t)cols*sizeof(real));
             if(error!=cudaSuccess) std::cerr << "CUDA Malloc Failed: " << cudaGetErrorString(error) << std::endl;
         }
 
@@ -24,17 +24,17 @@ class GMatrix
 
         void upload(const Matrix& host)
         {
-            cudaMemcpy(data,host.data,(size_t)rows*(size_t)cols*sizeof(double),cudaMemcpyHostToDevice);
+            cudaMemcpy(data,host.data,(size_t)rows*(size_t)cols*sizeof(real),cudaMemcpyHostToDevice);
         }
 
         void download(Matrix& host)
         {
-            cudaMemcpy(host.data,data,(size_t)rows*(size_t)cols*sizeof(double),cudaMemcpyDeviceToHost);
+            cudaMemcpy(host.data,data,(size_t)rows*(size_t)cols*sizeof(real),cudaMemcpyDeviceToHost);
         }
 
         void clear()
         {
-            cudaMemset(data,0,(size_t)rows*(size_t)cols*sizeof(double));
+            cudaMemset(data,0,(size_t)rows*(size_t)cols*sizeof(real));
         }
 
         GMatrix(const GMatrix&)=delete;
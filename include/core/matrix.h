@@ -4,22 +4,58 @@
 #include <functional>
 #include <fstream>
 #include <vector>
+#include "real.h"
 
 extern "C" 
 {
-    void launch_matmul(double* d_A, double* d_B, double* d_C, int m, int k, int n);
-    void launch_hadamard(double* dA, double* dB, double* dC, int size);
-    void gpu_alloc(double** ptr, size_t size);
-    void gpu_free(double* ptr);
-    void gpu_memcpy_h2d(double* dest, const double* src, size_t size);
-    void gpu_memcpy_d2h(double* dest, const double* src, size_t size);
-    void launch_conv2d_lean(const double* d_in, const double* d_k, double* d_out, int b, int h, int w, int d, int oh, int ow, int f, int k);
-    void launch_conv2d_backward_lean(const double* d_in, const double* d_del, const double* d_k, double* d_dk, double* d_db, double* d_prev, int b, int h, int w, int d, int oh, int ow, int f, int k);
+    void launch_gemm(const real* h_A, const real* h_B, real* h_C, int m, int k, int n, bool trans_a, bool trans_b, real alpha, real beta);
+    void launch_hadamard(real* dA, real* dB, real* dC, int size);
+    void gpu_alloc(real** ptr, size_t size);
+    void gpu_free(real* ptr);
+    void gpu_memcpy_h2d(real* dest, const real* src, size_t size);
+    void gpu_memcpy_d2h(real* dest, const real* src, size_t size);
+    void launch_conv2d_lean(const real* d_in, const real* d_k, real* d_out, int b, int h, int w, int d, int oh, int ow, int f, int k, int stride, int pad, int dilation);
+    void launch_conv2d_backward_lean(const real* d_in, const real* d_del, const real* d_k, real* d_dk, real* d_db, real* d_prev, int b, int h, int w, int d, int oh, int ow, int f, int k, int stride, int pad, int dilation);
 }
 
+//Heap traffic of Matrix buffers since the last Matrix::reset_stats()
+struct MatrixStats
+{
+    long long allocations;
+    long long bytes;
+    long long copies;
+};
+
+class Matrix;
+
+/*
+Non-owning, read-only window over a row-major buffer: rows x cols starting at data, rows are stride apart.
+A range of rows of a Matrix is a view with no copy, which is how mini-batches are fed to Network and how layers
+cache their input for backprop. The viewed buffer must outlive the view.
+*/
+class MatrixView
+{
+    public:
+        const real* data;
+        int rows;
+        int cols;
+        int stride;
+
+        MatrixView();
+        MatrixView(const real* data,int rows,int cols,int stride);
+        MatrixView(const Matrix& matrix);
+
+        real operator()(int r,int c) const {return data[(size_t)r*stride+c];}
+        const real* row(int r) const {return data+(size_t)r*stride;}
+        bool contiguous() const {return stride==cols||rows<=1;}
+        MatrixView slice(int start,int end) const;
+        MatrixView columns(int start,int end) const;
+};
+
 class Matrix
 {
     friend class Conv2D;
+    friend class MatrixView;
     public:
         int rows;
         int cols;
@@ -33,42 +69,92 @@ class Matrix
         allocate new memory and copy values over.
         */
         Matrix(const Matrix& matrix);
+        /*
+        Move constructor steals the buffer of a temporary instead of copying it,
+        so returning results and output=layer->forward_pass(output) cost no allocation.
+        */
+        Matrix(Matrix&& matrix) noexcept;
+        //Deep copy of whatever the view covers
+        explicit Matrix(const MatrixView& view);
         ~Matrix();
 
         //Operations
-        double& operator()(int r, int c);
-        double operator()(int r, int c) const;
+        real& operator()(int r, int c);
+        real operator()(int r, int c) const;
         Matrix& operator=(const Matrix& matrix);
+        Matrix& operator=(Matrix&& matrix) noexcept;
         bool operator==(const Matrix& matrix) const;
         bool operator!=(const Matrix& matrix) const;
-        Matrix operator+(const Matrix& matrix) const;
-        Matrix operator+(double scalar) const;
-        Matrix operator-(const Matrix& matrix) const;
-        Matrix operator-(double scalar) const;
         /*
-        Loop order ikj for better cache performance because it stays constant for the inner loop
+        Operators on a temporary (a+b+c, (W*x).apply(f)) reuse its buffer instead of allocating a new result.
+        */
+        Matrix operator+(const Matrix& matrix) const&;
+        Matrix operator+(const Matrix& matrix) &&;
+        Matrix operator+(real scalar) const;
+        Matrix operator-(const Matrix& matrix) const&;
+        Matrix operator-(const Matrix& matrix) &&;
+        Matrix operator-(real scalar) const;
+        /*
+        Large products go to launch_gemm (the GPU on CUDA builds), the rest to the blocked CPU gemm
         */
         Matrix operator*(const Matrix& matrix) const;
-        Matrix operator*(double scalar) const;
+        Matrix operator*(real scalar) const&;
+        Matrix operator*(real scalar) &&;
+        Matrix& operator+=(const MatrixView& matrix);
+        Matrix& operator-=(const MatrixView& matrix);
+        Matrix& operator*=(real scalar);
+        /*
+        op(A)*op(B) and this+=alpha*op(A)*op(B) where op transposes when the flag is set.
+        The transpose is folded into the GEMM packing, so backprop never materialises A^T or B^T.
+        */
+        static Matrix matmul(const MatrixView& A,const MatrixView& B,bool trans_a=false,bool trans_b=false);
+        Matrix& add_matmul(const MatrixView& A,const MatrixView& B,bool trans_a=false,bool trans_b=false,real alpha=1.0);
 
         //Utilities
         Matrix slice(int start,int end);
+        //Rows [start,end) without copying
+        MatrixView view(int start,int end) const;
+        MatrixView view() const;
         Matrix transpose() const;
         Matrix sum_rows() const;
-        Matrix Hadamard(const Matrix& matrix) const;
+        Matrix Hadamard(const Matrix& matrix) const&;
+        Matrix Hadamard(const Matrix& matrix) &&;
         static Matrix identity(int size);
         static Matrix zeros(int r, int c);
         static Matrix ones(int r, int c);
-        static Matrix random(int r, int c, double min=-1.0, double max=1.0);
-        Matrix apply(double (*function)(double)) const;
+        static Matrix random(int r, int c, real min=-1.0, real max=1.0);
+        //Contents are left unset, for results that are fully overwritten right away
+        static Matrix uninitialized(int r, int c);
+        /*
+        Matrix over memory it does not own (weights in a mapped model file), nothing is copied or freed.
+        The memory must outlive the matrix, assigning or loading into it switches to a buffer of its own.
+        */
+        static Matrix borrow(real* data, int r, int c);
+        Matrix apply(real (*function)(real)) const&;
+        Matrix apply(real (*function)(real)) &&;
+        Matrix& apply_inplace(real (*function)(real));
         void save(std::ofstream& file) const;
-        void load(std::ifstream& file);
+        /*
+        scalar_bytes is the width of the weights in the file (4 or 8), so a float32 build reads weights saved by a
+        double build and the other way round. Passed by every call, loads of different widths can run at once.
+        */
+        void load(std::ifstream& file, size_t scalar_bytes=sizeof(real));
+        static void read_scalars(std::ifstream& file, real* dst, size_t count, size_t scalar_bytes);
+
+        static MatrixStats stats();
+        static void reset_stats();
     private:
         /*
         1-D array used because only one pointer is needed which makes memory contiguous.
         2-D arrays has array of pointers which adds overhead and makes memory non-contiguous.
+        Buffers come from matrix_allocator() (allocator.h) and are 64-byte aligned.
         */
-        double* data;
+        real* data;
+        bool owned=true;    //false for borrow(), the buffer then goes back to nobody
+        struct Uninitialized {};
+        Matrix(int r, int c, Uninitialized);
+        static real* allocate(int size);
+        static void multiply(const MatrixView& A,const MatrixView& B,bool trans_a,bool trans_b,real alpha,real beta,Matrix& C);
 };
 
 #endif
\ No newline at end of file
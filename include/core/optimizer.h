@@ -0,0 +1,73 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "real.h"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+//A trainable tensor and its gradient, see Layer::parameters()
+struct Parameter
+{
+    real* value;
+    real* grad;
+    size_t size;
+};
+
+/*
+Update rule shared by every layer. A step is one pass over all the tensors handed to it, each element updated by a
+single fused SIMD loop, and the tensors are laid end to end and cut into fixed slices that threads take whole.
+The moments of all tensors live in one flat buffer in the same order, the optimizer's own or one handed to it.
+*/
+class Optimizer
+{
+    public:
+        enum Method {SGD,Momentum,Adam,AdamW};
+        Method method;
+        double b1=0.9;              //velocity decay of Momentum, first moment decay of Adam and AdamW
+        double b2=0.999,e=1e-8;     //Adam and AdamW
+        /*
+        Decoupled from the gradient, AdamW only. It shrinks every element stepped, biases and BatchNorm gamma/beta
+        included: Network hands the whole arena over as one tensor, so there is nothing to tell them apart by.
+        */
+        double weight_decay=0.01;
+
+        explicit Optimizer(Method method=Adam):method(method){}
+        /*
+        One update of tensors from their gradients. The moments carry over between calls as long as the tensors have
+        the same sizes in the same order, the pointers may change; any other layout starts again from zero.
+        */
+        void step(const std::vector<Parameter>& tensors,double learning_rate);
+        //Drops the moments, the next step starts from zero
+        void reset();
+        /*
+        First and second moments in memory of the caller (Network's arena), each with room for every element
+        stepped; they are zeroed when the layout changes. nullptr goes back to a buffer of the optimizer's own.
+        */
+        void use_state(real* m,real* v);
+        int steps() const {return t;}
+
+    private:
+        std::vector<size_t> offsets;
+        std::vector<real> own;
+        real* m=nullptr;
+        real* v=nullptr;
+        bool external=false;
+        int t=0;
+};
+
+//Where every tensor starts when they are laid end to end, followed by the total
+std::vector<size_t> tensor_offsets(const std::vector<Parameter>& tensors);
+
+//f(tensor,begin,end) for the elements of every tensor that fall in [lo,hi) of all of them laid end to end
+template<class F> void for_tensor_range(const std::vector<size_t>& offsets,size_t lo,size_t hi,F f)
+{
+    size_t i=std::upper_bound(offsets.begin(),offsets.end()-1,lo)-offsets.begin()-1;
+    for(;i+1<offsets.size()&&offsets[i]<hi;i++)
+    {
+        size_t begin=std::max(lo,offsets[i]),end=std::min(hi,offsets[i+1]);
+        if(begin<end) f(i,begin-offsets[i],end-offsets[i]);
+    }
+}
+
+#endif
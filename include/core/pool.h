@@ -0,0 +1,41 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "real.h"
+#include <cstdint>
+
+/*
+Pooling kernels behind the Pooling layer and the pooling epilogue of FusedConv2D, one h x w channel plane per call.
+Output pixel (i,j) pools the size x size taps at input (i*stride-pad+p_i*dilation,j*stride-pad+p_j*dilation);
+taps in the padding are skipped, so Average divides by the taps inside the input only.
+The 2x2 stride 2 window without padding or dilation has its own vectorized kernels, every other shape goes through
+a general one. These layers are bound by memory: a pass reads its input and writes its output once, with no
+full-size temporaries.
+*/
+enum class PoolMode {Max,Average};
+
+struct PoolShape
+{
+    int h,w,size;
+    int stride=2,pad=0,dilation=1;
+    PoolMode mode=PoolMode::Max;
+    int oh() const {return (h+2*pad-dilation*(size-1)-1)/stride+1;}
+    int ow() const {return (w+2*pad-dilation*(size-1)-1)/stride+1;}
+    //Window-local argmax p_i*size+p_j fits a byte up to 16 x 16 windows, uint16_t beyond
+    bool wide_index() const {return size*size>256;}
+};
+
+/*
+Pools one plane into oh x ow. For Max, argmax (oh*ow, may be null) receives the position of the maximum within
+its window; inference passes null and stores nothing.
+*/
+void pool_forward(const PoolShape& shape,const real* in,real* out,uint8_t* argmax);
+void pool_forward(const PoolShape& shape,const real* in,real* out,uint16_t* argmax);
+/*
+Gradient of one plane from the output gradient delta, every element of prev written (no need to zero it first).
+Max reads the argmax of the forward pass, Average ignores it.
+*/
+void pool_backward(const PoolShape& shape,const real* delta,const uint8_t* argmax,real* prev);
+void pool_backward(const PoolShape& shape,const real* delta,const uint16_t* argmax,real* prev);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef REAL_H
+#define REAL_H
+
+/*
+Element type of every Matrix, layer parameter and kernel.
+Double by default, build with -DML_FLOAT32 (make PRECISION=float) for float32 storage,
+which halves memory traffic and doubles the SIMD lanes per instruction.
+*/
+#ifdef ML_FLOAT32
+typedef float real;
+#else
+typedef double real;
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include "real.h"
+#include <cstddef>
+#include <vector>
+
+/*
+Working memory of Layer::infer. Every thread running inference owns one, so the layers keep no per-call state and
+one Network can serve many threads. The buffer only grows, after the first call of each shape nothing is allocated.
+*/
+class Scratch
+{
+    public:
+        //At least count elements, contents undefined and valid until the next get()
+        real* get(size_t count)
+        {
+            if(buffer.size()<count) buffer.resize(count);
+            return buffer.data();
+        }
+    private:
+        std::vector<real> buffer;
+};
+
+#endif
@@ -30,16 +30,17 @@ TrainTestSplit train_test_split(const Matrix& X, const Matrix& y, double test_si
 Normalization_with_mean_std normalize(const Matrix& X);
 Normalization_with_min_max min_max_scale(const Matrix& X);
 
-inline double sigmoid(double x) {return 1.0/(1.0+std::exp(-x));}
-inline double dsigmoid(double x) {return x*(1.0-x);} 
-inline double leaky_relu(double x) {return x>0?x:0.01*x;}
-inline double dleaky_relu(double x) {return x>0?1.0:0.01;}
-inline double tanh_(double x)
+inline real sigmoid(real x) {return 1.0/(1.0+std::exp(-x));}
+inline real dsigmoid(real x) {return x*(1.0-x);} 
+inline real leaky_relu(real x) {return x>0?x:0.01*x;}
+inline real dleaky_relu(real x) {return x>0?1.0:0.01;}
+inline real tanh_(real x)
 {
-    double a=std::exp(2*x);
+    //exp in double so float builds do not overflow to inf/inf for large x
+    double a=std::exp(2.0*x);
     return (a-1)/(a+1);
 }
-inline double dtanh(double x)
+inline real dtanh(real x)
 {return (1.0-x*x);}
 double mse(const Matrix& y_true, const Matrix& y_pred);
 Matrix dmse(const Matrix& y_true, const Matrix& y_pred);
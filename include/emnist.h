@@ -0,0 +1,15 @@
+#ifndef EMNIST_H
+#define EMNIST_H
+
+#include "network.h"
+
+/*
+The EMNIST CNN trained by main.cpp. Weights saved by Network::save do not describe the layers, so server.cpp and
+convert_model.cpp rebuild it before load() (which relies on the layer order), and the benchmarks time the same model
+on random inputs so they run without the dataset.
+*/
+const int EMNIST_CLASSES=47;     //EMNIST Balanced
+
+void build_emnist(Network& nn,int classes=EMNIST_CLASSES);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef BATCH_LOADER_H
+#define BATCH_LOADER_H
+
+#include "../core/matrix.h"
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+Rows of (X,y) stored some other way than as matrices in memory, e.g. a mapped IDX file kept in uint8 (io/data.h).
+Batches are converted as they are gathered, so a set larger than RAM can stream from the page cache.
+gather may run on the loader's background thread.
+*/
+class Dataset
+{
+    public:
+        virtual ~Dataset()=default;
+        virtual int rows() const=0;
+        virtual int x_cols() const=0;
+        virtual int y_cols() const=0;
+        //Rows indices[0..count) into X (count x x_cols) and y (count x y_cols), both row-major and packed
+        virtual void gather(const int* indices,int count,real* X,real* y) const=0;
+};
+
+/*
+Mini-batches of (X,y) for Network::fit.
+Shuffling permutes an index array, the data itself is never reordered. A background thread gathers the rows of the
+next batch into one of two buffers while the caller trains on the other (double buffering).
+Without shuffling a batch is a contiguous range of rows and is handed out as a view, with no thread and no copy.
+A Dataset always goes through the thread, in order when not shuffled. X and y or the dataset must outlive the loader.
+*/
+class BatchLoader
+{
+    public:
+        BatchLoader(const MatrixView& X,const MatrixView& y,int batch_size,bool shuffle,unsigned seed);
+        BatchLoader(const Dataset& data,int batch_size,bool shuffle,unsigned seed);
+        ~BatchLoader();
+        //Reshuffles and rewinds, call before the first next() of every epoch
+        void start_epoch();
+        //Views stay valid until the following next() call, returns false once the epoch is exhausted
+        bool next(MatrixView& X_batch,MatrixView& y_batch);
+        int batches() const {return num_batches;}
+
+        BatchLoader(const BatchLoader&)=delete;
+        BatchLoader& operator=(const BatchLoader&)=delete;
+    private:
+        MatrixView X,y;
+        const Dataset* data=nullptr;
+        int rows,batch_size,num_batches;
+        bool shuffle;
+        bool views=false;       //batches are slices of X and y, no thread
+        std::mt19937 rng;
+        std::vector<int> indices;
+
+        //Two slots, the worker fills one while the caller holds the other
+        Matrix X_buf[2],y_buf[2];
+        bool filled[2]={false,false};
+        int taken=-1;           //slot held by the caller, released on the next call
+        int next_take=0;        //next batch the caller receives
+        int next_fill=0;        //next batch the worker gathers
+        bool gathering=false;
+        bool stop=false;
+        std::mutex lock;
+        std::condition_variable changed;
+        std::thread worker;
+
+        void setup(int x_cols,int y_cols);
+        void gather(int batch,int slot);
+        void run();
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include "../core/matrix.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct BatcherOptions
+{
+    int max_batch=32;           //rows per predict call, a larger request runs on its own
+    int max_wait_us=2000;       //longest a request is held back waiting for others
+    /*
+    Latency target per request in microseconds, 0 for none. The wait is cut so that queueing plus the expected
+    predict time (a running average) stays under it, at low load requests then go out alone right away.
+    */
+    int latency_target_us=0;
+};
+
+struct BatcherStats
+{
+    long long requests=0,batches=0,rows=0;
+    std::vector<long long> batch_rows;      //[n]: batches that ran n rows, the last bucket also counts larger ones
+    std::vector<long long> queue_depth;     //[n]: requests that found n others waiting, same overflow rule
+    double wait_ms=0.0;                     //total time requests spent queued
+    double predict_ms=0.0;                  //total time in predict
+};
+
+/*
+Dynamic batching for the inference server: concurrent submit() calls are queued and a dispatcher thread runs them
+together through one predict call, then hands every caller its own rows of the output.
+A batch goes out when it is full or when its oldest request has waited as long as the options allow.
+*/
+class Batcher
+{
+    public:
+        typedef std::function<Matrix(const MatrixView&)> Predict;
+
+        Batcher(Predict predict,const BatcherOptions& options=BatcherOptions());
+        ~Batcher();
+        //Blocks until input is predicted, exceptions thrown by predict are rethrown here
+        Matrix submit(const MatrixView& input);
+        BatcherStats stats();
+
+        Batcher(const Batcher&)=delete;
+        Batcher& operator=(const Batcher&)=delete;
+    private:
+        typedef std::chrono::steady_clock clock;
+        struct Request;
+
+        Predict predict;
+        BatcherOptions options;
+        std::deque<Request*> queue;
+        int queued_rows=0;
+        double expected_us=0.0;     //running average of predict time
+        bool stop=false;
+        BatcherStats counters;
+        std::mutex lock;
+        std::condition_variable changed;
+        std::thread dispatcher;
+
+        void run();
+        void execute(std::vector<Request*>& batch);
+};
+
+#endif
@@ -2,14 +2,58 @@
 #define DATA_H
 
 #include "../core/matrix.h"
+#include "batch_loader.h"
+#include "mapped_file.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 
+/*
+IDX file (the MNIST/EMNIST format) mapped into memory: a big-endian header with the dimensions, then unsigned bytes.
+Items stay uint8 in the page cache and are converted only when asked for. Throws std::runtime_error for a missing
+file or another element type.
+*/
+class IdxFile
+{
+    public:
+        explicit IdxFile(const std::string& path);
+        //dims[0] is the number of items
+        const std::vector<int>& shape() const {return dims;}
+        int count() const {return dims[0];}
+        //Bytes per item, the product of the remaining dimensions
+        int item_size() const {return size;}
+        const uint8_t* item(int i) const {return data+(size_t)i*size;}
+    private:
+        MappedFile file;
+        std::vector<int> dims;
+        int size=1;
+        const uint8_t* data;
+};
+
+/*
+An IDX image file and its label file as a Dataset: pixels are scaled to [0,1] and labels one-hot encoded batch by
+batch as Network::fit gathers them, the whole set is never converted or held in memory.
+*/
+class IdxDataset:public Dataset
+{
+    public:
+        //classes=0 takes the largest label + 1, a label outside of classes throws std::out_of_range
+        IdxDataset(const std::string& images,const std::string& labels,int classes=0);
+        int rows() const override {return images.count();}
+        int x_cols() const override {return images.item_size();}
+        int y_cols() const override {return classes;}
+        void gather(const int* indices,int count,real* X,real* y) const override;
+    private:
+        IdxFile images,labels;
+        int classes;
+};
+
 class DataLoader
 {
     public:
         static Matrix load_images(const std::string& filepath);
-        static Matrix load_labels(const std::string& filepath);
+        //classes=0 takes the largest label + 1, a label outside of classes throws std::out_of_range
+        static Matrix load_labels(const std::string& filepath,int classes=0);
 };
 
-#endif
\ No newline at end of file
+#endif
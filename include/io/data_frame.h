@@ -2,29 +2,69 @@
 #define DATAFRAME_H
 
 #include "../core/matrix.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 
 class DataFrame
 {
     public:
+        //Storage of a column, narrowest first: a column gets the first type every one of its cells fits
+        enum class ColumnType {Int64,Float64,Categorical};
+        //Lines of the file handed to one thread by read_csv, begin is the start of a line
+        struct Chunk
+        {
+            const char* begin;
+            const char* end;
+            int first_row=0;
+            int rows=0;
+        };
+
         DataFrame();
+        /*
+        Maps the file and parses it in parallel chunks that start at line boundaries, straight into typed columns:
+        Int64 when every cell is an integer, Float64 when every cell is a number (empty cells count as 0 for both),
+        otherwise Categorical, dictionary-encoded in order of first appearance. Blank lines are skipped, surrounding
+        quotes and a trailing \r are dropped, quoted delimiters and newlines are not supported.
+        */
         void read_csv(const std::string& filename,bool has_header=true,char delimiter=',');
 
         void head(int n=5) const;
         void info() const;
 
+        //Categorical cells are projected as their text parsed as a number, 0 where it is not one
         Matrix select(const std::vector<std::string>& columns) const;
         Matrix select(int column_index,int end_column_index) const;
         Matrix get_column(const std::string& column_name) const;
+        //Float64 column as rows x 1 without a copy, valid until the next read_csv; throws std::invalid_argument for other types
+        MatrixView column_view(const std::string& column_name) const;
+        //Codes in order of first appearance, for a Categorical column the ones stored at parse time
         Matrix get_column_encode(const std::string& column_name) const;
         int get_column_index(const std::string& column_name) const;
-    
+        ColumnType column_type(const std::string& column_name) const;
+        //Categories of a Categorical column indexed by code, empty for numeric columns
+        const std::vector<std::string>& categories(const std::string& column_name) const;
+        int get_rows() const {return rows;}
+        int get_cols() const {return cols;}
+
     private:
+        struct Column
+        {
+            ColumnType type=ColumnType::Int64;
+            std::vector<real> values;               //Float64
+            std::vector<int64_t> integers;          //Int64
+            std::vector<int32_t> codes;             //Categorical, indices into categories
+            std::vector<std::string> categories;
+            std::vector<real> category_values;      //every category parsed as a number, 0 where it is not one
+        };
         std::vector<std::string> column_names;
-        std::vector<std::vector<std::string>> data;
+        std::vector<Column> data;
         int rows;
         int cols;
+        void encode_text(const std::vector<Chunk>& chunks,const std::vector<int>& text_columns,char delimiter);
+        //Rows [begin,end) of a column as real, written stride apart
+        void project(int column,int begin,int end,real* dst,int stride) const;
+        Matrix gather(const std::vector<int>& indices) const;
 };
 
-#endif
\ No newline at end of file
+#endif
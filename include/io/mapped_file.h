@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+/*
+Whole file mapped into memory, pages are read from the page cache on first touch instead of copied up front,
+and processes mapping the same file share them. The mapping is private copy-on-write: writing through data()
+changes this process's pages only, never the file. Failures throw std::runtime_error.
+*/
+class MappedFile
+{
+    public:
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+        MappedFile(const MappedFile&)=delete;
+        MappedFile& operator=(const MappedFile&)=delete;
+
+        char* data() const {return base;}
+        size_t size() const {return length;}
+    private:
+        char* base=nullptr;
+        size_t length=0;
+#ifdef _WIN32
+        void* mapping=nullptr;
+#endif
+};
+
+#endif
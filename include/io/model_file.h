@@ -0,0 +1,111 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include "../core/matrix.h"
+#include "mapped_file.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Layer;
+
+/*
+Self-describing model file of Network::save_model/load_model, every field in the native byte order of the host that
+wrote it, structs and tensors copied as they are in memory:
+    FileHeader                      64 bytes
+    LayerRecord[layer_count]        at layers_offset, type and constructor arguments of every layer in order
+    TensorRecord[tensor_count]      at tensors_offset, shape and position of every parameter tensor, in layer order
+    tensor data                     from data_offset, every tensor 64-byte aligned and scalar_bytes wide
+version doubles as the byte-order mark: a file from a host of the other byte order is rejected on load.
+The checksum covers everything after the header. A file with the scalar width of the build is used in place from a
+private mapping: no weight is read or copied at load time, and processes serving the same file share its pages.
+*/
+namespace model_file
+{
+    const char MAGIC[8]={'N','N','M','O','D','E','L','\0'};
+    const uint32_t VERSION=1;
+    const size_t ALIGNMENT=64;
+    const int MAX_ARGUMENTS=8;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t scalar_bytes;
+        uint32_t layer_count;
+        uint32_t tensor_count;
+        uint64_t layers_offset;
+        uint64_t tensors_offset;
+        uint64_t data_offset;
+        uint64_t file_size;
+        uint64_t checksum;
+    };
+
+    struct LayerRecord
+    {
+        char type[24];              //Layer::name(), NUL padded
+        uint32_t argument_count;
+        uint32_t tensor_count;      //tensors of this layer, right after those of the layers before it
+        double arguments[MAX_ARGUMENTS];
+    };
+
+    struct TensorRecord
+    {
+        int32_t rows;
+        int32_t cols;
+        uint64_t offset;
+    };
+
+    //FNV-1a over 64-bit words, size is a multiple of 8
+    uint64_t checksum(const char* data,size_t size);
+    //True if the file starts with MAGIC, to tell it from the headerless weights of Network::save
+    bool is_model_file(const std::string& path);
+    //Layer named type built from the arguments stored for it, throws std::runtime_error for unknown types
+    Layer* create_layer(const std::string& type,const std::vector<double>& arguments);
+
+    void save(const std::string& path,const std::vector<Layer*>& layers);
+    /*
+    Layers described by the file, owned by the caller. Their weights point into mapping, which must outlive them.
+    verify=false skips the checksum, which otherwise reads every page of the file once.
+    */
+    std::vector<Layer*> load(const std::string& path,std::unique_ptr<MappedFile>& mapping,bool verify=true);
+}
+
+//Collects the parameter tensors of one layer while a model file is written, the data must stay alive until then
+class ModelWriter
+{
+    public:
+        void write(const MatrixView& tensor);
+        //count values as one row
+        void write(const real* data,int count);
+        const std::vector<MatrixView>& tensors() const {return written;}
+    private:
+        std::vector<MatrixView> written;
+};
+
+//Hands one layer its tensors from a mapped model file, in the order the layer wrote them
+class ModelReader
+{
+    public:
+        ModelReader(char* base,size_t size,size_t scalar_bytes,const model_file::TensorRecord* tensors,uint32_t count);
+        /*
+        Next tensor into matrix, which already has the expected shape. With the scalar width of the build the matrix
+        borrows the mapped data, otherwise it gets a converted buffer of its own.
+        */
+        void read(Matrix& matrix);
+        //Next tensor, a single row of count values, copied into data
+        void read(real* data,int count);
+        //Next tensor, rows x cols, copied into data row after row
+        void read(real* data,int rows,int cols);
+        uint32_t remaining() const {return count-next;}
+    private:
+        char* base;
+        size_t size,scalar_bytes;
+        const model_file::TensorRecord* tensors;
+        uint32_t count,next=0;
+        char* take(int rows,int cols);
+        void convert(const char* src,real* dst,size_t n) const;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+
+/*
+Binary framing of the inference server (server.cpp --tcp/--unix). Every field is in the server's native byte order,
+copied as is with no conversion; the clients (app.py packs '<') assume that is little-endian, as on x86 and ARM.
+A connection carries any number of request/response pairs in order:
+    request:  RequestHeader, then count*features float32 inputs, row by row
+    response: ResponseHeader, then count Prediction
+A malformed request gets a response with a non-zero status and the connection is closed.
+*/
+namespace protocol
+{
+    const uint32_t MAGIC=0x4e4d4531;    //"1EMN" in memory, guards against a text client talking to the socket
+    const uint32_t MAX_COUNT=4096;      //samples per request
+
+    enum Status : uint32_t
+    {
+        OK=0,
+        BAD_MAGIC=1,
+        BAD_SHAPE=2,    //features does not match the model or count is 0 or above MAX_COUNT
+        SERVER_ERROR=3
+    };
+
+    struct RequestHeader
+    {
+        uint32_t magic;
+        uint32_t count;
+        uint32_t features;
+    };
+
+    struct ResponseHeader
+    {
+        uint32_t status;
+        uint32_t count;
+    };
+
+    struct Prediction
+    {
+        int32_t label;      //argmax class
+        float probability;  //its softmax output
+    };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+typedef uintptr_t socket_handle;
+#else
+typedef int socket_handle;
+#endif
+
+/*
+Blocking stream socket over Winsock or POSIX sockets, owns the handle and closes it on destruction.
+TCP is meant for localhost, Unix domain sockets are POSIX only. Setup failures throw std::runtime_error,
+reads and writes report a closed or broken connection by returning false.
+*/
+class Socket
+{
+    public:
+        Socket();
+        explicit Socket(socket_handle handle);
+        Socket(Socket&& other) noexcept;
+        Socket& operator=(Socket&& other) noexcept;
+        ~Socket();
+        Socket(const Socket&)=delete;
+        Socket& operator=(const Socket&)=delete;
+
+        static Socket listen_tcp(int port,const std::string& host="127.0.0.1",int backlog=64);
+        static Socket listen_unix(const std::string& path,int backlog=64);
+        static Socket connect_tcp(int port,const std::string& host="127.0.0.1");
+        static Socket connect_unix(const std::string& path);
+
+        /*
+        Blocks until a client connects. Errors of a single client (aborted connection, no descriptors left) are retried,
+        the result is invalid only once the listener is shut down or closed.
+        */
+        Socket accept() const;
+        //All of bytes or false, partial reads and EINTR are retried
+        bool read_exact(void* buffer,size_t bytes) const;
+        bool write_all(const void* buffer,size_t bytes) const;
+        bool valid() const;
+        //Wakes up threads blocked in accept/read on this socket
+        void shutdown() const;
+        void close();
+    private:
+        socket_handle handle;
+};
+
+#endif
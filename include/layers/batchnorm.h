@@ -7,18 +7,27 @@
 
 class BatchNorm:public Layer
 {
+    friend class FusedDense;
+    friend class FusedConv2D;
     public:
         BatchNorm(int features);
-        Matrix forward_pass(const Matrix& input) override;
+        Matrix forward_pass(const MatrixView& input) override;
         Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix gradient(const Matrix& delta) override;
+        std::vector<Parameter> parameters() override;
+        void bind(real*& values,real*& grads) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "BatchNorm";}
         void save(std::ofstream& file) override;
-        void load(std::ifstream& file) override;
+        void load(std::ifstream& file,size_t scalar_bytes) override;
+        std::vector<double> arguments() const override;
+        void write(ModelWriter& file) const override;
+        void read(ModelReader& file) override;
         Matrix g,b,mean,var;
     private:
         int features;
-        double e=1e-8,momentum=0.9,b1=0.9,b2=0.999,m,v;
-        Matrix mg,vg,mb,vb;
-        int t=0;
+        double e=1e-8,momentum=0.9;
+        Matrix dg,db;   //gradients of the last gradient()
         Matrix x_,std_inv;
 };
 
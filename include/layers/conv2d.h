@@ -6,34 +6,44 @@
 #include <vector>
 #include <cmath>
 
+/*
+f filters of k x k over a d x h x w input. Output pixel (i,j) reads input (i*stride-pad+ki*dilation,
+j*stride-pad+kj*dilation); the zero padding is implicit in the kernels, no padded copy is made.
+*/
 class Conv2D:public Layer
 {
+    friend class FusedConv2D;
     public:
-        Conv2D(int h,int w,int d,int f,int k);
+        Conv2D(int h,int w,int d,int f,int k,int stride=1,int pad=0,int dilation=1);
         ~Conv2D();
-        Matrix forward_pass(const Matrix& input) override;
+        Matrix forward_pass(const MatrixView& input) override;
         Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix gradient(const Matrix& delta) override;
+        std::vector<Parameter> parameters() override;
+        void bind(real*& values,real*& grads) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "Conv2D";}
         void save(std::ofstream& file) override;
-        void load(std::ifstream& file) override;
+        void load(std::ifstream& file,size_t scalar_bytes) override;
+        std::vector<double> arguments() const override;
+        void write(ModelWriter& file) const override;
+        void read(ModelReader& file) override;
         void init();
     private:
         int h,w,d,f,k; 
+        int stride,pad,dilation;
         int oh,ow;
-        std::vector<std::vector<Matrix>> kernels;
-        std::vector<double> b;
-        Matrix input;
-        std::vector<std::vector<Matrix>> mk,vk;
-        std::vector<double> mb,vb;
-        int t=0;
-        double b1=0.9,b2=0.999,e=1e-8,m,v;
+        Matrix kernels;     //f x d*k*k, a filter per row, its channels one k x k block after the other
+        Matrix b;           //1 x f
+        Matrix dk,db;       //gradients of the last gradient()
         int allocated_batch_size = 0;
-        double *d_kernels = nullptr;
-        double *d_input = nullptr;
-        double *d_output = nullptr;
-        double *d_delta = nullptr;
-        double *d_dk = nullptr;
-        double *d_db = nullptr;
-        double *d_prev_delta = nullptr;
+        real *d_kernels = nullptr;
+        real *d_input = nullptr;
+        real *d_output = nullptr;
+        real *d_delta = nullptr;
+        real *d_dk = nullptr;
+        real *d_db = nullptr;
+        real *d_prev_delta = nullptr;
         void allocate_gpu_memory(int batch_size);
 };
 
@@ -7,20 +7,25 @@
 class Dense:public Layer
 {
     public:
-        Dense(int input_size,int output_size);
-        Matrix forward_pass(const Matrix& input) override;
+        //randomize=false leaves w unset for weights that are loaded right after (model files)
+        Dense(int input_size,int output_size,bool randomize=true);
+        Matrix forward_pass(const MatrixView& input) override;
         Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix gradient(const Matrix& delta) override;
+        std::vector<Parameter> parameters() override;
+        void bind(real*& values,real*& grads) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "Dense";}
         void save(std::ofstream& file) override;
-        void load(std::ifstream& file) override;
+        void load(std::ifstream& file,size_t scalar_bytes) override;
+        std::vector<double> arguments() const override;
+        void write(ModelWriter& file) const override;
+        void read(ModelReader& file) override;
         Matrix w;
         Matrix b;
 
     private:
-        Matrix mw,vw;
-        Matrix mb,vb;
-        int t;
-        double b1=0.9,b2=0.999,e=1e-8,m,v;
-        void init();
+        Matrix dw,db;   //gradients of the last gradient()
 };
 
 #endif
\ No newline at end of file
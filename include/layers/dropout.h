@@ -11,11 +11,14 @@ public:
 
     Dropout(double x);
     
-    Matrix forward_pass(const Matrix& input) override;
+    Matrix forward_pass(const MatrixView& input) override;
     Matrix backward_pass(const Matrix& delta, double learning_rate) override;
+    Matrix infer(const MatrixView& input, Scratch& scratch) const override;
+    const char* name() const override {return "Dropout";}
+    std::vector<double> arguments() const override;
 
     void save(std::ofstream& file) override {}
-    void load(std::ifstream& file) override {}
+    void load(std::ifstream& file,size_t scalar_bytes) override {}
 };
 
 #endif
\ No newline at end of file
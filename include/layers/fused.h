@@ -0,0 +1,61 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include "layer.h"
+#include "../core/matrix.h"
+#include "../core/pool.h"
+#include "../activation.h"
+
+class Dense;
+class Conv2D;
+class BatchNorm;
+class Pooling;
+
+/*
+Inference-only layers built by Network::compile().
+A producer (Dense or Conv2D) absorbs the BatchNorm, Activation, Dropout and, for Conv2D, Pooling layers that follow it,
+so a whole block writes its output once instead of once per layer. backward_pass throws, training uses the source layers.
+*/
+
+//BatchNorm folded into the weights: w'=w*s, b'=(b-mean)*s+beta with s=g/sqrt(var+e), then act(x*w'+b')*scale
+class FusedDense:public Layer
+{
+    public:
+        //bn and act may be null, scale is the inference scaling of any Dropout after the block
+        FusedDense(const Dense& dense,const BatchNorm* bn,Activate act,double scale);
+        Matrix forward_pass(const MatrixView& input) override;
+        Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "FusedDense";}
+    private:
+        Matrix w,b;
+        Activate act;
+        real scale;
+};
+
+/*
+BatchNorm here normalizes every output element on its own, so it cannot go into the kernels.
+It becomes a per-element affine a*conv+c (conv bias included) applied in the epilogue together with the activation
+and the pooling (core/pool.h). The convolution runs on the CPU engine (core/conv_engine.h) for either backend.
+*/
+class FusedConv2D:public Layer
+{
+    public:
+        //bn, act and pool may be null
+        FusedConv2D(const Conv2D& conv,const BatchNorm* bn,Activate act,const Pooling* pool,double scale);
+        Matrix forward_pass(const MatrixView& input) override;
+        Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "FusedConv2D";}
+    private:
+        int h,w,d,f,k,stride,pad,dilation,oh,ow;
+        bool pooled=false;
+        PoolShape pool_shape;
+        int ph,pw;
+        Matrix kernels;     //f x d*k*k
+        Matrix a,c;         //1 x f*oh*ow
+        Activate act;
+        real scale;
+};
+
+#endif
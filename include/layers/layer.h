@@ -2,19 +2,62 @@
 #define LAYER_H
 
 #include "../core/matrix.h"
+#include "../core/scratch.h"
+#include "../core/optimizer.h"
 #include <fstream>
+#include <vector>
+
+class ModelWriter;
+class ModelReader;
 
 class Layer
 {
     public:
         bool is_training=true;
         virtual ~Layer() = default;
-        virtual Matrix forward_pass(const Matrix& input)=0;
+        virtual Matrix forward_pass(const MatrixView& input)=0;
         virtual Matrix backward_pass(const Matrix& output,double learning_rate)=0;
+        /*
+        backward_pass in two halves: gradient() leaves the gradients of the parameters in the layer without changing
+        them, update() steps the parameters with the layer's own optimizer. backward_pass(delta,lr) is gradient(delta)
+        then update(lr), layers without parameters only implement backward_pass. Network::fit calls gradient() and
+        steps all layers together with its own optimizer.
+        */
+        virtual Matrix gradient(const Matrix& delta) {return backward_pass(delta,0.0);}
+        void update(double learning_rate);
+        //Trainable tensors with their gradients in a fixed order, empty for layers without parameters
+        virtual std::vector<Parameter> parameters() {return {};}
+        /*
+        Moves the parameters to values and their gradients to grads, both in parameters() order, keeping the current
+        values, and advances the two pointers past them. Network keeps every layer's tensors in one arena this way.
+        */
+        virtual void bind(real*& values,real*& grads) {}
+        /*
+        Inference output for input, reading the parameters only: any number of threads may call it at once on one layer
+        as long as nothing trains or loads it meanwhile. Temporaries come from the caller's scratch.
+        */
+        virtual Matrix infer(const MatrixView& input,Scratch& scratch) const=0;
         virtual void save(std::ofstream& file){};
-        virtual void load(std::ifstream& file){};
+        //scalar_bytes is the width of the weights in the file (Network::load)
+        virtual void load(std::ifstream& file,size_t scalar_bytes){};
+        //Shown in the per-layer timings of Network::fit, and the type of the layer in a model file
+        virtual const char* name() const {return "Layer";}
+        /*
+        Model file support (io/model_file.h): the constructor arguments that rebuild the layer from name(),
+        and its parameter tensors, read back in the order they were written.
+        */
+        virtual std::vector<double> arguments() const {return {};}
+        virtual void write(ModelWriter& file) const {}
+        virtual void read(ModelReader& file) {}
     protected:
-        Matrix input;
+        /*
+        View of the last forward input, no copy is made.
+        The caller keeps that input alive until backward_pass (Network::fit holds every activation of the step).
+        */
+        MatrixView input;
+        Optimizer optimizer;
+        //tensor copied to at and turned into a view of it, at moves past it
+        static void place(Matrix& tensor,real*& at);
 };
 
 #endif
\ No newline at end of file
@@ -3,43 +3,85 @@
 
 #include <vector>
 #include "../core/matrix.h"
+#include "../core/optimizer.h"
 
+/*
+LSTM over a batch of sequences: step s of the input is batch x input_size, one sequence per row.
+The four gates share one weight matrix over [x,h], so a step of the whole batch is a single GEMM followed by one
+fused pass for the gate activations and the cell update.
+*/
 class LSTM
 {
     public:
         int input_size;
         int hidden_size;
 
-        Matrix Wfx,Wfa,bf;
-        Matrix Wux,Wua,bu;
-        Matrix Wcx,Wca,bc;
-        Matrix Wox,Woa,bo;
+        //(input_size+hidden_size) x 4*hidden_size, forget, update, candidate and output gate columns side by side
+        Matrix W,b;
+        Matrix dW,db;
+        Optimizer optimizer;
 
-        Matrix dWfx,dWfa,dbf;
-        Matrix dWux,dWua,dbu;
-        Matrix dWcx,dWca,dbc;
-        Matrix dWox,dWoa,dbo;
+        //Truncated BPTT: gradients do not flow back across multiples of this many steps, 0 goes through the whole sequence
+        int bptt_steps=0;
+        /*
+        Activation checkpointing: forward_pass keeps the state entering every k-th step and the inputs only, and
+        backward_pass recomputes one segment of k steps at a time from them. 1 caches every step.
+        */
+        int checkpoint_every=1;
 
-        Matrix mWfx, vWfx; Matrix mWfh, vWfh; Matrix mbf, vbf;
-        Matrix mWix, vWix; Matrix mWih, vWih; Matrix mbi, vbi;
-        Matrix mWcx, vWcx; Matrix mWch, vWch; Matrix mbc, vbc;
-        Matrix mWox, vWox; Matrix mWoh, vWoh; Matrix mbo, vbo;
-
-    int t;
-
-        struct Cache
+        //Hidden and cell state of one or more streams between calls to step(), one row per stream
+        class State
         {
-            Matrix f,u,c_,o;
-            Matrix c,a;
+            friend class LSTM;
+            public:
+                int streams() const {return h.rows;}
+            private:
+                Matrix h,c;
         };
-        std::vector<Cache> cache; 
-        std::vector<Matrix> x_cache;
 
         LSTM(int input_size,int hidden_size);
 
+        //Hidden state after every step, batch x hidden_size, starting from a zero state
         std::vector<Matrix> forward_pass(const std::vector<Matrix>& input);
+        /*
+        Same, starting from state, which is left holding the state after the last step. backward_pass treats the
+        starting state as a constant, so a long stream trained window by window is truncated BPTT with memory bounded
+        by the window.
+        */
+        std::vector<Matrix> forward_pass(const std::vector<Matrix>& input,State& state);
+        //delta[s] is the gradient for output s, an empty Matrix for a step without one. Returns the input gradients
         std::vector<Matrix> backward_pass(const std::vector<Matrix>& delta);
         void update(double learning_rate);
+        //W and b with their gradients from the last backward_pass
+        std::vector<Parameter> parameters();
+        //Bytes held for backward_pass by the last forward_pass
+        size_t cache_bytes() const;
+
+        /*
+        Streaming inference, one frame at a time: a zero state for the given number of streams, and the next frame of
+        every stream in it (streams x input_size), which advances the state and returns the new hidden state. Nothing is
+        cached for backprop and the layer is not modified, so any number of threads can step their own states.
+        The second form steps several states together as one batch, x holds their rows in order.
+        */
+        State start(int streams=1) const;
+        Matrix step(const MatrixView& x,State& state) const;
+        Matrix step(const MatrixView& x,const std::vector<State*>& states) const;
+
+    private:
+        struct Cache
+        {
+            Matrix xh;      //[x,h_prev], batch x (input_size+hidden_size)
+            Matrix gates;   //activated f,u,c_,o, batch x 4*hidden_size
+            Matrix c;       //cell state after the step
+        };
+        std::vector<Cache> cache;           //every step, or the steps of one segment when checkpointing
+        std::vector<Matrix> inputs;         //input of every step when checkpointing
+        std::vector<State> checkpoints;     //state entering every checkpoint_every-th step, [0] is the starting state
+        int cached_steps=0,cached_every=1;
+        Matrix zero_state;
+        void run_step(const MatrixView& x,const MatrixView& h_prev,const MatrixView& c_prev,Cache& step,Matrix& h) const;
+        //Caches of steps [begin,end) of a checkpointed forward pass, from the checkpoint at begin
+        void recompute(int begin,int end);
 };
 
-#endif
\ No newline at end of file
+#endif
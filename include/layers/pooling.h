@@ -3,19 +3,34 @@
 
 #include "layer.h"
 #include "../core/matrix.h"
+#include "../core/pool.h"
 #include <vector>
-#include <cfloat>
+#include <cstdint>
 
+/*
+Max or average pooling over pool_size x pool_size windows. Output pixel (i,j) looks at input (i*stride-pad+p_i*dilation,
+j*stride-pad+p_j*dilation); positions in the padding are skipped, never materialized. The kernels are in core/pool.h.
+Training keeps, for max pooling, the position of each maximum within its window (one byte up to 16 x 16 windows) in
+a single buffer reused from batch to batch; inference, and forward_pass outside training, store none.
+*/
 class Pooling:public Layer
 {
+    friend class FusedConv2D;
     public:
-        Pooling(int h,int w,int d,int pool_size=2,int stride=2);
-        Matrix forward_pass(const Matrix& input) override;
+        Pooling(int h,int w,int d,int pool_size=2,int stride=2,int pad=0,int dilation=1,PoolMode mode=PoolMode::Max);
+        Matrix forward_pass(const MatrixView& input) override;
         Matrix backward_pass(const Matrix& delta, double learning_rate) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "Pooling";}
+        std::vector<double> arguments() const override;
     
     private:
-        int h,w,d,pool_size,stride,oh,ow;
-        std::vector<std::vector<int>> max_cache;
+        int h,w,d,pool_size,stride,pad,dilation,oh,ow;
+        PoolShape shape;
+        std::vector<uint8_t> argmax;    //uint8_t or, for shape.wide_index(), uint16_t per output element
+        bool indexed=false;             //argmax holds the indices of the last forward_pass
+        //Pools every plane of input into output, argmax may be null
+        void pool(const MatrixView& input,Matrix& output,uint8_t* argmax) const;
 };
 
-#endif
\ No newline at end of file
+#endif
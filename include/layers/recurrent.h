@@ -3,6 +3,7 @@
 
 #include <vector>
 #include "../core/matrix.h"
+#include "../core/optimizer.h"
 #include <cmath>
 
 class Recurrent
@@ -13,17 +14,49 @@ class Recurrent
 
         Matrix Wax,Waa,ba;
         Matrix dWax,dWaa,dba;
-        Matrix mWax,vWax,mWaa,vWaa,mba,vba;
-        int t;
+        Optimizer optimizer;
 
-        std::vector<Matrix> a_cache; 
+        //Truncated BPTT and activation checkpointing, as in LSTM
+        int bptt_steps=0;
+        int checkpoint_every=1;
+
+        //Hidden state of one or more streams between calls to step(), one row per stream
+        class State
+        {
+            friend class Recurrent;
+            public:
+                int streams() const {return h.rows;}
+            private:
+                Matrix h;
+        };
+
+        std::vector<Matrix> a_cache;        //every step, or the steps of one segment when checkpointing
         std::vector<Matrix> x_cache;
 
         Recurrent(int input_size,int hidden_size);
         std::vector<Matrix> forward_pass(const std::vector<Matrix>& input);
+        //Starting from a state of one stream, which is left holding the state after the last step (see LSTM)
+        std::vector<Matrix> forward_pass(const std::vector<Matrix>& input,State& state);
         std::vector<Matrix> backward_pass(const std::vector<Matrix>& delta);
 
         void update(double learning_rate);
+        //Wax, Waa and ba with their gradients from the last backward_pass
+        std::vector<Parameter> parameters();
+        //Bytes held for backward_pass by the last forward_pass
+        size_t cache_bytes() const;
+
+        /*
+        Streaming inference like LSTM::step: frames are rows (streams x input_size) and the returned hidden state is
+        streams x hidden_size. Caches nothing and leaves the layer unchanged.
+        */
+        State start(int streams=1) const;
+        Matrix step(const MatrixView& x,State& state) const;
+        Matrix step(const MatrixView& x,const std::vector<State*>& states) const;
+
+    private:
+        std::vector<Matrix> checkpoints;    //hidden state entering every checkpoint_every-th step, [0] is the starting state
+        int cached_every=1;
+        Matrix cell(const Matrix& x,const Matrix& a_prev) const;
 };
 
 #endif
\ No newline at end of file
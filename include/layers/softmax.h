@@ -9,8 +9,10 @@ class Softmax:public Layer
 {
     public:
         Softmax();
-        Matrix forward_pass(const Matrix& input) override;
+        Matrix forward_pass(const MatrixView& input) override;
         Matrix backward_pass(const Matrix& delta,double learning_rate) override;
+        Matrix infer(const MatrixView& input,Scratch& scratch) const override;
+        const char* name() const override {return "Softmax";}
 };
 
 #endif
\ No newline at end of file
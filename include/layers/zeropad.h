@@ -7,8 +7,11 @@ class ZeroPad : public Layer
 {
 public:
     ZeroPad(int h, int w, int d, int pad);
-    Matrix forward_pass(const Matrix& input) override;
+    Matrix forward_pass(const MatrixView& input) override;
     Matrix backward_pass(const Matrix& delta, double learning_rate) override;
+    Matrix infer(const MatrixView& input, Scratch& scratch) const override;
+    const char* name() const override {return "ZeroPad";}
+    std::vector<double> arguments() const override;
 private:
     int h, w, d, pad;
     int oh, ow;
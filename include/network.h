@@ -2,21 +2,90 @@
 #define NETWORK_H
 
 #include <vector>
+#include <functional>
+#include <memory>
 #include "./layers/layer.h"
 #include "./core/matrix.h"
+#include "./core/optimizer.h"
+#include "./io/mapped_file.h"
+#include "./io/batch_loader.h"
+
+struct FitOptions
+{
+    int batch_size=0;       //rows per step, 0 trains on the whole set at once
+    bool shuffle=true;      //new random order every epoch, rows are gathered by a background thread
+    bool verbose=false;     //print samples/sec and time per layer after every epoch
+    /*
+    Data-parallel threads: every batch is split by rows over this many workers, each with its own copy of the layers
+    (built as a model file would rebuild them), their gradients are summed and the network takes one optimizer step.
+    1 trains on one copy with the layers threading inside, 0 uses a worker per core.
+    BatchNorm normalizes over the rows of each worker and updates its running statistics from the first worker's.
+    */
+    int workers=1;
+    //called after every step with the step index, steps per epoch and the running mean loss of the epoch
+    std::function<void(int,int,double)> on_batch;
+};
+
+//Figures of the last epoch fit() ran
+struct FitStats
+{
+    double loss=0.0;                    //mean cross entropy of the training batches, measured on the forward pass
+    double seconds=0.0;
+    double samples_per_sec=0.0;
+    std::vector<double> layer_seconds;  //forward+backward time of each layer
+};
 
 class Network
 {
     public:
+        //Steps the parameters of every layer at once during fit(), Adam unless set otherwise
+        Optimizer optimizer;
+
         ~Network();
         void add(Layer* layer);
-        Matrix predict(const Matrix& input);
-        void fit(const Matrix& X,const Matrix& y,int epochs,double learning_rate);
+        //Same as infer(input), kept for existing callers
+        Matrix predict(const MatrixView& input);
+        /*
+        Thread-safe inference: only reads the weights, so any number of threads may run one shared Network at once
+        as long as nothing fits, loads or compiles it meanwhile. scratch belongs to the calling thread,
+        the overload without it uses one kept per thread.
+        */
+        Matrix infer(const MatrixView& input,Scratch& scratch) const;
+        Matrix infer(const MatrixView& input) const;
+        FitStats fit(const MatrixView& X,const MatrixView& y,int epochs,double learning_rate,const FitOptions& options=FitOptions());
+        //Batches gathered from a Dataset (io/batch_loader.h), e.g. a mapped IDX file converted one batch at a time
+        FitStats fit(const Dataset& data,int epochs,double learning_rate,const FitOptions& options=FitOptions());
         void save(const std::string& filename);
-        void load(const std::string& filename);
+        //scalar_bytes is the width of the weights in the file, sizeof(double) reads a model saved by a double build into a float one
+        void load(const std::string& filename,size_t scalar_bytes=sizeof(real));
+        /*
+        Self-describing model file (io/model_file.h) with the layer types, their constructor arguments and the weights.
+        load_model replaces the layers with the ones in the file, so the architecture does not have to be rebuilt by hand,
+        and their weights stay in a private mapping of the file: nothing is read up front and a training step only
+        copies the pages it changes. Both throw std::runtime_error, verify=false skips the checksum.
+        */
+        void save_model(const std::string& filename) const;
+        void load_model(const std::string& filename,bool verify=true);
+        /*
+        Inference compilation: every Dense/Conv2D block (BatchNorm, Activation, Dropout, and Pooling after a Conv2D)
+        becomes one fused layer (layers/fused.h) that predict() uses from then on.
+        The trainable layers are untouched, add(), fit() and load() drop the compiled form.
+        */
+        void compile();
         
     private:
         std::vector<Layer*> layers;
+        std::unique_ptr<MappedFile> mapping;    //model file the layers borrow their weights from, outlives them
+        std::vector<Layer*> compiled;   //what predict runs when not empty, fused layers or shared pointers into layers
+        std::vector<Layer*> fused;      //the fused layers owned by compiled
+        /*
+        Every parameter of the layers end to end in row 0, their gradients at the same places in row 1 and the
+        optimizer's moments in rows 2 and 3, one allocation the layers keep views into (Layer::bind). fit() moves the
+        layers in whenever they are not there, e.g. after add() or load_model().
+        */
+        Matrix arena;
+        void clear_compiled();
+        FitStats fit(BatchLoader& loader,int epochs,double learning_rate,const FitOptions& options);
 };
 
 #endif
\ No newline at end of file
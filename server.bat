@@ -11,7 +11,7 @@ if not exist "obj\core\cuda_ops.obj" (
 )
 
 echo [2/2] Compiling Server...
-set CPP_FILES=src/server.cpp src/network.cpp src/core/matrix.cpp src/core/utils.cpp src/layers/dense.cpp src/layers/conv2d.cpp src/layers/batchnorm.cpp src/layers/pooling.cpp src/layers/softmax.cpp src/io/data.cpp src/activation.cpp src/layers/dropout.cpp
+set CPP_FILES=src/server.cpp src/network.cpp src/emnist.cpp src/core/matrix.cpp src/core/gemm.cpp src/core/conv.cpp src/core/conv_engine.cpp src/core/pool.cpp src/core/allocator.cpp src/core/optimizer.cpp src/core/utils.cpp src/layers/layer.cpp src/layers/dense.cpp src/layers/conv2d.cpp src/layers/batchnorm.cpp src/layers/pooling.cpp src/layers/softmax.cpp src/io/data.cpp src/io/batch_loader.cpp src/io/socket.cpp src/io/batcher.cpp src/io/mapped_file.cpp src/io/model_file.cpp src/activation.cpp src/layers/dropout.cpp src/layers/fused.cpp src/layers/zeropad.cpp
 
 nvcc -allow-unsupported-compiler %CPP_FILES% obj/core/cuda_ops.obj -o server.exe -O3 -I./include -lcublas -Xcompiler "/openmp" -arch=sm_86
 
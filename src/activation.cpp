@@ -1,17 +1,40 @@
 #include "../include/activation.h"
+#include "../include/core/utils.h"
 #include <iostream>
+#include <stdexcept>
+
+const std::vector<ActivationFunction>& activation_functions()
+{
+    static const std::vector<ActivationFunction> functions=
+    {
+        {"sigmoid",sigmoid,dsigmoid},
+        {"leaky_relu",leaky_relu,dleaky_relu},
+        {"tanh",tanh_,dtanh}
+    };
+    return functions;
+}
 
 Activation::Activation(Activate f, Activate df):f(f),df(df){}
 
-Matrix Activation::forward_pass(const Matrix& input) 
+Matrix Activation::forward_pass(const MatrixView& input) 
 {
     this->input=input;
-    Matrix output;
-    output=input.apply(f);
-    return input.apply(f);
+    return Matrix(input).apply(f);
+}
+
+Matrix Activation::infer(const MatrixView& input,Scratch& scratch) const
+{
+    return Matrix(input).apply(f);
+}
+
+std::vector<double> Activation::arguments() const
+{
+    const std::vector<ActivationFunction>& functions=activation_functions();
+    for(size_t i=0;i<functions.size();i++) if(functions[i].f==f&&functions[i].df==df) return {(double)i};
+    throw std::invalid_argument("Activation function is not in activation_functions(), it cannot be saved");
 }
 
 Matrix Activation::backward_pass(const Matrix& delta, double learning_rate) 
 {
-    return delta.Hadamard(input.apply(df));
+    return Matrix(input).apply(df).Hadamard(delta);
 }
@@ -1,15 +1,20 @@
 from flask import Flask, request, jsonify, render_template_string
 import subprocess
 import threading
+import socket
+import struct
 import time
 import numpy as np
 from PIL import Image
 
 app = Flask(__name__)
 
+SERVER_PORT = 5555
+MAGIC = 0x4e4d4531
+EMNIST_MAPPING = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabdefghnqrt"
+
 process = subprocess.Popen(
-    ['server.exe'], 
-    stdin=subprocess.PIPE, 
+    ['server.exe', '--tcp', str(SERVER_PORT)], 
     stdout=subprocess.PIPE, 
     stderr=subprocess.PIPE,
     text=True,
@@ -17,10 +22,7 @@ process = subprocess.Popen(
 )
 
 time.sleep(1) 
-if process.poll() is None:
-    startup_msg = process.stdout.readline()
-    print(f"Status: {startup_msg.strip()}")
-else:
+if process.poll() is not None:
     print("Error: Server failed to start.")
 
 def log_reader():
@@ -28,6 +30,34 @@ def log_reader():
         print(f"LOG: {line.strip()}")
 threading.Thread(target=log_reader, daemon=True).start()
 
+# one connection per Flask thread, see include/io/protocol.h for the framing
+connections = threading.local()
+
+def recv_exact(sock, n):
+    buf = b''
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        buf += chunk
+    return buf
+
+def classify(pixels):
+    if getattr(connections, 'sock', None) is None:
+        connections.sock = socket.create_connection(('127.0.0.1', SERVER_PORT))
+    sock = connections.sock
+    try:
+        sock.sendall(struct.pack('<III', MAGIC, 1, len(pixels)) + struct.pack(f'<{len(pixels)}f', *pixels))
+        status, count = struct.unpack('<II', recv_exact(sock, 8))
+        if status != 0:
+            raise ConnectionError(f"server returned status {status}")
+        label, probability = struct.unpack('<if', recv_exact(sock, 8))
+    except Exception:
+        sock.close()
+        connections.sock = None
+        raise
+    return EMNIST_MAPPING[label] if 0 <= label < len(EMNIST_MAPPING) else '?'
+
 def preprocess_image(raw_pixels):
     arr = np.array(raw_pixels).reshape(28, 28)
     
@@ -186,15 +216,11 @@ def predict():
         raw_pixels = data.get('pixels', [])
         
         processed_pixels = preprocess_image(raw_pixels)
-        pixel_string = " ".join([f"{x:.3f}" for x in processed_pixels])
         
         if process.poll() is not None:
              return jsonify({'result': 'Server Died'})
 
-        process.stdin.write(pixel_string + "\n")
-        process.stdin.flush()
-        
-        result = process.stdout.readline().strip()
+        result = classify(processed_pixels)
         return jsonify({'result': result})
     except Exception as e:
         print("Error:", e)
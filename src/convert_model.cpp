@@ -0,0 +1,56 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "../include/network.h"
+#include "../include/core/matrix.h"
+#include "../include/emnist.h"
+#include "../include/core/utils.h"
+#include "../include/io/model_file.h"
+
+/*
+Rewrites an EMNIST model file in the precision of this build.
+convert_model_f32 emnist_model.bin emnist_model_f32.bin turns the weights saved by main into float32 for server_f32,
+convert_model emnist_model_f32.bin emnist_model.bin 4 goes the other way.
+An output name ending in .nnm is written as a self-describing model file (io/model_file.h), which also works as input,
+its scalar width is in its header.
+*/
+int main(int argc, char** argv)
+{
+    if(argc<3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input model> <output model> [input scalar bytes, default 8]" << std::endl;
+        return 1;
+    }
+    size_t scalar_bytes=argc>3?std::atoi(argv[3]):sizeof(double);
+    if(scalar_bytes!=sizeof(float)&&scalar_bytes!=sizeof(double))
+    {
+        std::cerr << "Input scalar bytes must be 4 or 8" << std::endl;
+        return 1;
+    }
+
+    Network nn;
+    std::string output=argv[2];
+    try
+    {
+        if(model_file::is_model_file(argv[1]))
+        {
+            nn.load_model(argv[1]);
+            scalar_bytes=0;
+        }
+        else
+        {
+            build_emnist(nn);
+            nn.load(argv[1],scalar_bytes);
+        }
+        if(output.size()>4&&output.compare(output.size()-4,4,".nnm")==0) nn.save_model(output);
+        else nn.save(output);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if(scalar_bytes) std::cout << "Converted " << scalar_bytes*8 << "-bit weights to " << sizeof(real)*8 << "-bit" << std::endl;
+    return 0;
+}
+
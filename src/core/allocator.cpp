@@ -0,0 +1,183 @@
+#include "../../include/core/allocator.h"
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+    struct Header
+    {
+        Allocator* owner;
+        size_t capacity;
+        size_t bytes;
+    };
+
+    //Never destroyed, buffers of static Matrix objects may be returned during exit
+    PoolAllocator& default_pool()
+    {
+        static PoolAllocator* pool=new PoolAllocator();
+        return *pool;
+    }
+
+    //Read on every allocation from any thread, nullptr until set_matrix_allocator picks one
+    std::atomic<Allocator*> active{nullptr};
+}
+
+void* Allocator::system_alloc(size_t bytes)
+{
+    system_allocations++;
+    bytes=(bytes+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+#ifdef _WIN32
+    void* block=_aligned_malloc(bytes,ALIGNMENT);
+#else
+    void* block=std::aligned_alloc(ALIGNMENT,bytes);
+#endif
+    if(block==nullptr)
+    {
+        std::cerr << "Error: Could not allocate " << bytes << " bytes" << std::endl;
+        exit(1);
+    }
+    return block;
+}
+
+void Allocator::system_free(void* block)
+{
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    std::free(block);
+#endif
+}
+
+//Layout: [header padded to 64 bytes][payload], the payload pointer is what callers see
+void* Allocator::allocate(size_t bytes)
+{
+    size_t capacity=0;
+    char* block;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        block=(char*)acquire(bytes+ALIGNMENT,capacity);
+        allocations++;
+        bytes_in_use+=bytes;
+        peak_bytes=std::max(peak_bytes,bytes_in_use);
+    }
+    Header* header=(Header*)block;
+    header->owner=this;
+    header->capacity=capacity;
+    header->bytes=bytes;
+    return block+ALIGNMENT;
+}
+
+void Allocator::deallocate(void* ptr)
+{
+    if(ptr==nullptr) return;
+    char* block=(char*)ptr-ALIGNMENT;
+    Header* header=(Header*)block;
+    Allocator* owner=header->owner;
+    std::lock_guard<std::mutex> guard(owner->lock);
+    owner->bytes_in_use-=header->bytes;
+    owner->release(block,header->capacity);
+}
+
+AllocatorStats Allocator::stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return {allocations,system_allocations,bytes_in_use,peak_bytes};
+}
+
+void Allocator::reset_stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    allocations=0;
+    system_allocations=0;
+    peak_bytes=bytes_in_use;
+}
+
+void* SystemAllocator::acquire(size_t bytes,size_t& capacity)
+{
+    capacity=bytes;
+    return system_alloc(bytes);
+}
+
+void SystemAllocator::release(void* block,size_t capacity)
+{
+    system_free(block);
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    for(auto& entry:classes) for(void* block:entry.second.free) system_free(block);
+}
+
+//Four classes per power of two keeps the rounding waste under 25%
+size_t PoolAllocator::class_size(size_t bytes)
+{
+    if(bytes<=4*ALIGNMENT) return (bytes+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+    size_t top=1;
+    while(top<bytes) top<<=1;
+    size_t step=top/8;
+    return (bytes+step-1)/step*step;
+}
+
+void* PoolAllocator::acquire(size_t bytes,size_t& capacity)
+{
+    if(bytes>MAX_POOLED)
+    {
+        capacity=bytes;
+        return system_alloc(bytes);
+    }
+    capacity=class_size(bytes);
+    SizeClass& sc=classes[capacity];
+    sc.in_use++;
+    sc.peak=std::max(sc.peak,sc.in_use);
+    if(!sc.free.empty())
+    {
+        void* block=sc.free.back();
+        sc.free.pop_back();
+        return block;
+    }
+    return system_alloc(capacity);
+}
+
+void PoolAllocator::release(void* block,size_t capacity)
+{
+    if(capacity>MAX_POOLED)
+    {
+        system_free(block);
+        return;
+    }
+    SizeClass& sc=classes[capacity];
+    sc.in_use--;
+    sc.free.push_back(block);
+}
+
+void PoolAllocator::reset()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for(auto& entry:classes)
+    {
+        SizeClass& sc=entry.second;
+        size_t keep=std::max(0,sc.peak-sc.in_use);
+        while(sc.free.size()>keep)
+        {
+            system_free(sc.free.back());
+            sc.free.pop_back();
+        }
+        sc.peak=sc.in_use;
+    }
+}
+
+Allocator& matrix_allocator()
+{
+    Allocator* allocator=active.load(std::memory_order_acquire);
+    return allocator?*allocator:default_pool();
+}
+
+void set_matrix_allocator(Allocator* allocator)
+{
+    active.store(allocator?allocator:&default_pool(),std::memory_order_release);
+}
@@ -0,0 +1,69 @@
+#include "../../include/core/conv.h"
+#include <algorithm>
+#include <cstring>
+
+void inside_columns(int x0,int stride,int w,int ow,int& lo,int& hi)
+{
+    lo=x0<0?std::min(ow,(-x0+stride-1)/stride):0;
+    hi=x0>=w?0:std::min(ow,(w-1-x0)/stride+1);
+    hi=std::max(lo,hi);
+}
+
+void im2col(const real* in,real* col,int h,int w,int d,int oh,int ow,int k,int stride,int pad,int dilation)
+{
+    for(int depth=0;depth<d;depth++)
+    {
+        for(int ki=0;ki<k;ki++)
+        {
+            for(int kj=0;kj<k;kj++)
+            {
+                real* dst=col+(size_t)((depth*k+ki)*k+kj)*oh*ow;
+                int x0=kj*dilation-pad,lo,hi;
+                inside_columns(x0,stride,w,ow,lo,hi);
+                for(int i=0;i<oh;i++)
+                {
+                    real* out=dst+i*ow;
+                    int y=i*stride-pad+ki*dilation;
+                    if(y<0||y>=h)
+                    {
+                        std::fill(out,out+ow,0.0);
+                        continue;
+                    }
+                    const real* src=in+(size_t)depth*h*w+y*w;
+                    std::fill(out,out+lo,0.0);
+                    if(stride==1) std::memcpy(out+lo,src+x0+lo,(hi-lo)*sizeof(real));
+                    else for(int j=lo;j<hi;j++) out[j]=src[x0+j*stride];
+                    std::fill(out+hi,out+ow,0.0);
+                }
+            }
+        }
+    }
+}
+
+void col2im(const real* col,real* in,int h,int w,int d,int oh,int ow,int k,int stride,int pad,int dilation)
+{
+    for(int depth=0;depth<d;depth++)
+    {
+        for(int ki=0;ki<k;ki++)
+        {
+            for(int kj=0;kj<k;kj++)
+            {
+                const real* src=col+(size_t)((depth*k+ki)*k+kj)*oh*ow;
+                int x0=kj*dilation-pad,lo,hi;
+                inside_columns(x0,stride,w,ow,lo,hi);
+                for(int i=0;i<oh;i++)
+                {
+                    int y=i*stride-pad+ki*dilation;
+                    if(y<0||y>=h) continue;
+                    real* dst=in+(size_t)depth*h*w+y*w;
+                    if(stride==1)
+                    {
+                        #pragma omp simd
+                        for(int j=lo;j<hi;j++) dst[x0+j]+=src[i*ow+j];
+                    }
+                    else for(int j=lo;j<hi;j++) dst[x0+j*stride]+=src[i*ow+j];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,670 @@
+#include "../../include/core/conv_engine.h"
+#include "../../include/core/conv.h"
+#include "../../include/core/gemm.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+    const int V=CONV_BLOCK;
+
+    size_t input_size(const ConvShape& s){return (size_t)s.d*s.h*s.w;}
+    size_t pixels(const ConvShape& s){return (size_t)s.oh()*s.ow();}
+    int patch(const ConvShape& s){return s.d*s.k*s.k;}
+
+    //Per-thread weight gradients summed into dk and db once the thread is done with its samples
+    void reduce(const std::vector<real>& dk_,const std::vector<real>& db_,real* dk,real* db)
+    {
+        #pragma omp critical
+        {
+            for(size_t i=0;i<dk_.size();i++) dk[i]+=dk_[i];
+            for(size_t i=0;i<db_.size();i++) db[i]+=db_[i];
+        }
+    }
+
+    void bias_gradient(const ConvShape& s,const real* delta,std::vector<real>& db)
+    {
+        size_t n=pixels(s);
+        for(int f=0;f<s.f;f++)
+        {
+            real sum=0.0;
+            const real* row=delta+f*n;
+            #pragma omp simd reduction(+:sum)
+            for(size_t p=0;p<n;p++) sum+=row[p];
+            db[f]+=sum;
+        }
+    }
+
+    /*
+    Im2col: per sample out(f x oh*ow) = kernels(f x d*k*k) * im2col(input), dK += delta * col^T and
+    prev = col2im(K^T * delta). Samples are split across threads, each with its own column buffer.
+    */
+    void im2col_forward(const ConvShape& s,const real* input,const real* kernels,real* output)
+    {
+        int n=pixels(s),p=patch(s);
+        #pragma omp parallel
+        {
+            std::vector<real> col((size_t)p*n);
+            #pragma omp for
+            for(int b=0;b<s.batch;b++)
+            {
+                im2col(input+b*input_size(s),col.data(),s.h,s.w,s.d,s.oh(),s.ow(),s.k,s.stride,s.pad,s.dilation);
+                gemm(false,false,s.f,n,p,1.0,kernels,p,col.data(),n,0.0,output+(size_t)b*s.f*n,n);
+            }
+        }
+    }
+
+    void im2col_backward_data(const ConvShape& s,const real* delta,const real* kernels,real* prev)
+    {
+        int n=pixels(s),p=patch(s);
+        std::fill(prev,prev+s.batch*input_size(s),0.0);
+        #pragma omp parallel
+        {
+            std::vector<real> dcol((size_t)p*n);
+            #pragma omp for
+            for(int b=0;b<s.batch;b++)
+            {
+                gemm(true,false,p,n,s.f,1.0,kernels,p,delta+(size_t)b*s.f*n,n,0.0,dcol.data(),n);
+                col2im(dcol.data(),prev+b*input_size(s),s.h,s.w,s.d,s.oh(),s.ow(),s.k,s.stride,s.pad,s.dilation);
+            }
+        }
+    }
+
+    void im2col_backward_filter(const ConvShape& s,const real* input,const real* delta,real* dk,real* db)
+    {
+        int n=pixels(s),p=patch(s);
+        #pragma omp parallel
+        {
+            std::vector<real> col((size_t)p*n),dk_((size_t)s.f*p,0.0),db_(s.f,0.0);
+            #pragma omp for
+            for(int b=0;b<s.batch;b++)
+            {
+                const real* dy=delta+(size_t)b*s.f*n;
+                im2col(input+b*input_size(s),col.data(),s.h,s.w,s.d,s.oh(),s.ow(),s.k,s.stride,s.pad,s.dilation);
+                gemm(false,true,s.f,p,n,1.0,dy,n,col.data(),n,1.0,dk_.data(),p);
+                bias_gradient(s,dy,db_);
+            }
+            reduce(dk_,db_,dk,db);
+        }
+    }
+
+    /*
+    Direct: filters go in blocks of V and the kernels of a block are stored [channel][ki][kj][V], so every input pixel
+    is broadcast against V contiguous weights (NCHWc). W neighbouring output pixels of a row accumulate W x V values
+    in registers over all channels and kernel positions before they are written back filter by filter.
+    Filters past f in the last block have zero weights. Rows in the padding are skipped, and only pixels whose
+    window crosses the left or right edge check their columns.
+    */
+    std::vector<real> block_kernels(const real* kernels,int f,int p)
+    {
+        int blocks=(f+V-1)/V;
+        std::vector<real> blocked((size_t)blocks*p*V,0.0);
+        for(int i=0;i<f;i++) for(int j=0;j<p;j++) blocked[((size_t)(i/V)*p+j)*V+i%V]=kernels[(size_t)i*p+j];
+        return blocked;
+    }
+
+    //Output pixels ox..ox+W-1 of row oy for the filters of a block, Edge when some of their columns are padding
+    template<int W,bool Edge> void direct_pixels(const ConvShape& s,const real* x,const real* weights,real* y,int filters,int oy,int ox)
+    {
+        real acc[W][V]={};
+        int oh=s.oh(),ow=s.ow(),x0=ox*s.stride-s.pad;
+        for(int c=0;c<s.d;c++)
+        {
+            for(int ki=0;ki<s.k;ki++)
+            {
+                int iy=oy*s.stride-s.pad+ki*s.dilation;
+                if(iy<0||iy>=s.h)
+                {
+                    weights+=s.k*V;
+                    continue;
+                }
+                const real* row=x+((size_t)c*s.h+iy)*s.w;
+                for(int kj=0;kj<s.k;kj++,weights+=V)
+                {
+                    for(int t=0;t<W;t++)
+                    {
+                        int ix=x0+kj*s.dilation+t*s.stride;
+                        if(Edge&&(ix<0||ix>=s.w)) continue;
+                        real v=row[ix];
+                        #pragma omp simd
+                        for(int j=0;j<V;j++) acc[t][j]+=v*weights[j];
+                    }
+                }
+            }
+        }
+        for(int j=0;j<filters;j++) for(int t=0;t<W;t++) y[((size_t)j*oh+oy)*ow+ox+t]=acc[t][j];
+    }
+
+    void direct_forward(const ConvShape& s,const real* input,const real* kernels,real* output)
+    {
+        const int W=4;
+        int blocks=(s.f+V-1)/V,oh=s.oh(),ow=s.ow(),p=patch(s);
+        //pixels [lo,hi) have their whole window inside the columns of the input
+        int lo,hi;
+        inside_columns(-s.pad,s.stride,s.w-(s.k-1)*s.dilation,ow,lo,hi);
+        std::vector<real> blocked=block_kernels(kernels,s.f,p);
+        #pragma omp parallel for collapse(2) schedule(static)
+        for(int b=0;b<s.batch;b++)
+        {
+            for(int fb=0;fb<blocks;fb++)
+            {
+                const real* x=input+b*input_size(s);
+                const real* weights=&blocked[(size_t)fb*p*V];
+                real* y=output+((size_t)b*s.f+fb*V)*oh*ow;
+                int filters=std::min(V,s.f-fb*V);
+                for(int oy=0;oy<oh;oy++)
+                {
+                    int ox=0;
+                    for(;ox<lo;ox++) direct_pixels<1,true>(s,x,weights,y,filters,oy,ox);
+                    for(;ox+W<=hi;ox+=W) direct_pixels<W,false>(s,x,weights,y,filters,oy,ox);
+                    for(;ox<hi;ox++) direct_pixels<1,false>(s,x,weights,y,filters,oy,ox);
+                    for(;ox<ow;ox++) direct_pixels<1,true>(s,x,weights,y,filters,oy,ox);
+                }
+            }
+        }
+    }
+
+    //Gradient of the weights of a block at one channel and kernel position, W pixels at a time into separate sums
+    void direct_weight(const ConvShape& s,const real* x,const real* d,int ki,int kj,real* g)
+    {
+        const int W=4;
+        int oh=s.oh(),ow=s.ow(),x0=kj*s.dilation-s.pad,lo,hi;
+        inside_columns(x0,s.stride,s.w,ow,lo,hi);
+        real sum[W][V]={};
+        for(int oy=0;oy<oh;oy++)
+        {
+            int iy=oy*s.stride-s.pad+ki*s.dilation;
+            if(iy<0||iy>=s.h) continue;
+            const real* src=x+(size_t)iy*s.w+x0;
+            const real* dy=d+(size_t)oy*ow*V;
+            int ox=lo;
+            for(;ox+W<=hi;ox+=W)
+            {
+                for(int t=0;t<W;t++)
+                {
+                    real v=src[(ox+t)*s.stride];
+                    #pragma omp simd
+                    for(int j=0;j<V;j++) sum[t][j]+=v*dy[(size_t)(ox+t)*V+j];
+                }
+            }
+            for(;ox<hi;ox++)
+            {
+                real v=src[ox*s.stride];
+                #pragma omp simd
+                for(int j=0;j<V;j++) sum[0][j]+=v*dy[(size_t)ox*V+j];
+            }
+        }
+        for(int j=0;j<V;j++) g[j]+=sum[0][j]+sum[1][j]+sum[2][j]+sum[3][j];
+    }
+
+    void direct_backward_filter(const ConvShape& s,const real* input,const real* delta,real* dk,real* db)
+    {
+        int blocks=(s.f+V-1)/V,p=patch(s);
+        size_t n=pixels(s);
+        #pragma omp parallel
+        {
+            //delta of a sample as [block][oy][ox][V], the weight gradients as the blocked kernels
+            std::vector<real> blocked((size_t)blocks*n*V,0.0),dk_((size_t)blocks*p*V,0.0),db_(s.f,0.0);
+            #pragma omp for
+            for(int b=0;b<s.batch;b++)
+            {
+                const real* x=input+b*input_size(s);
+                const real* dy=delta+(size_t)b*s.f*n;
+                for(int i=0;i<s.f;i++) for(size_t q=0;q<n;q++) blocked[((size_t)(i/V)*n+q)*V+i%V]=dy[i*n+q];
+                bias_gradient(s,dy,db_);
+                for(int fb=0;fb<blocks;fb++)
+                {
+                    real* g=&dk_[(size_t)fb*p*V];
+                    for(int c=0;c<s.d;c++)
+                    {
+                        for(int ki=0;ki<s.k;ki++)
+                        {
+                            for(int kj=0;kj<s.k;kj++,g+=V) direct_weight(s,x+(size_t)c*s.h*s.w,&blocked[(size_t)fb*n*V],ki,kj,g);
+                        }
+                    }
+                }
+            }
+            std::vector<real> unblocked((size_t)s.f*p);
+            for(int i=0;i<s.f;i++) for(int j=0;j<p;j++) unblocked[(size_t)i*p+j]=dk_[((size_t)(i/V)*p+j)*V+i%V];
+            reduce(unblocked,db_,dk,db);
+        }
+    }
+
+    /*
+    Winograd F(2x2,3x3): a 2x2 output tile is A^T [(G g G^T) . (B^T d B)] A for its 4x4 input tile d and a 3x3
+    kernel g. The 16 elementwise products summed over channels are 16 GEMMs, U(f x d) * V(d x tiles) for each of
+    the 16 positions. Tiles past the edge of the output read zeros and are cropped.
+    Its weight gradient is G^T [sum over tiles (A dY A^T) . (B^T d B)] G, again 16 GEMMs.
+    The 16 values of a transformed kernel go to t[i*stride], i=0..15.
+    */
+    void transform_kernel(const real* g,real* t,size_t stride)
+    {
+        real r[4][3];
+        for(int j=0;j<3;j++)
+        {
+            r[0][j]=g[j];
+            r[1][j]=(g[j]+g[3+j]+g[6+j])*0.5;
+            r[2][j]=(g[j]-g[3+j]+g[6+j])*0.5;
+            r[3][j]=g[6+j];
+        }
+        for(int i=0;i<4;i++)
+        {
+            t[(i*4)*stride]=r[i][0];
+            t[(i*4+1)*stride]=(r[i][0]+r[i][1]+r[i][2])*0.5;
+            t[(i*4+2)*stride]=(r[i][0]-r[i][1]+r[i][2])*0.5;
+            t[(i*4+3)*stride]=r[i][2];
+        }
+    }
+
+    //G^T u G, the 3x3 kernel gradient from the 16 gathered at u[i*stride]
+    void untransform_kernel(const real* u,size_t stride,real* g)
+    {
+        real r[3][4];
+        for(int j=0;j<4;j++)
+        {
+            real u0=u[j*stride],u1=u[(4+j)*stride],u2=u[(8+j)*stride],u3=u[(12+j)*stride];
+            r[0][j]=u0+(u1+u2)*0.5;
+            r[1][j]=(u1-u2)*0.5;
+            r[2][j]=(u1+u2)*0.5+u3;
+        }
+        for(int i=0;i<3;i++)
+        {
+            g[i*3]=r[i][0]+(r[i][1]+r[i][2])*0.5;
+            g[i*3+1]=(r[i][1]-r[i][2])*0.5;
+            g[i*3+2]=(r[i][1]+r[i][2])*0.5+r[i][3];
+        }
+    }
+
+    //Tiles of the samples transformed together, so each of the 16 GEMMs covers enough columns to amortize its packing
+    const int WINOGRAD_TILES=512;
+    //With fewer filters or channels than this the 16 products are plain loops rather than GEMMs
+    const int WINOGRAD_GEMM_DEPTH=16;
+
+    /*
+    The tile transforms work on a whole row of tiles at once: the row combinations first over the full width, then
+    the column combinations of every tile, which are contiguous runs in each of the 16 outputs and vectorize.
+    */
+
+    //B^T d B of a sample's input tiles, 16 x d x cols from column 0 of v; the padding stays zero in the row buffer
+    void transform_inputs(const ConvShape& s,const real* x,real* v,int th,int tw,size_t cols)
+    {
+        size_t stride=s.d*cols;
+        int width=2*tw+2;
+        std::vector<real> d(4*width,0.0),r(4*width);
+        for(int c=0;c<s.d;c++)
+        {
+            const real* plane=x+(size_t)c*s.h*s.w;
+            for(int ty=0;ty<th;ty++)
+            {
+                for(int i=0;i<4;i++)
+                {
+                    int y=2*ty+i-s.pad;
+                    real* row=&d[i*width+s.pad];
+                    if(y>=0&&y<s.h) std::copy(plane+(size_t)y*s.w,plane+(size_t)(y+1)*s.w,row);
+                    else std::fill(row,row+s.w,0.0);
+                }
+                #pragma omp simd
+                for(int j=0;j<width;j++)
+                {
+                    r[j]=d[j]-d[2*width+j];
+                    r[width+j]=d[width+j]+d[2*width+j];
+                    r[2*width+j]=d[2*width+j]-d[width+j];
+                    r[3*width+j]=d[width+j]-d[3*width+j];
+                }
+                for(int i=0;i<4;i++)
+                {
+                    const real* q=&r[i*width];
+                    real* t=v+c*cols+(size_t)ty*tw+i*4*stride;
+                    #pragma omp simd
+                    for(int tx=0;tx<tw;tx++)
+                    {
+                        t[tx]=q[2*tx]-q[2*tx+2];
+                        t[stride+tx]=q[2*tx+1]+q[2*tx+2];
+                        t[2*stride+tx]=q[2*tx+2]-q[2*tx+1];
+                        t[3*stride+tx]=q[2*tx+1]-q[2*tx+3];
+                    }
+                }
+            }
+        }
+    }
+
+    //A^T m A back to a sample's f x oh x ow output, m holding its tiles from column 0 with stride between the 16
+    void transform_outputs(const ConvShape& s,const real* m,real* y,int th,int tw,size_t cols)
+    {
+        size_t stride=s.f*cols;
+        int oh=s.oh(),ow=s.ow();
+        std::vector<real> rows(4*tw);
+        real* top=rows.data();
+        real* bottom=top+2*tw;
+        for(int f=0;f<s.f;f++)
+        {
+            for(int ty=0;ty<th;ty++)
+            {
+                const real* t=m+f*cols+(size_t)ty*tw;
+                #pragma omp simd
+                for(int tx=0;tx<tw;tx++)
+                {
+                    real r0[4],r1[4];
+                    for(int j=0;j<4;j++)
+                    {
+                        real m0=t[j*stride+tx],m1=t[(4+j)*stride+tx],m2=t[(8+j)*stride+tx],m3=t[(12+j)*stride+tx];
+                        r0[j]=m0+m1+m2;
+                        r1[j]=m1-m2-m3;
+                    }
+                    top[2*tx]=r0[0]+r0[1]+r0[2];
+                    top[2*tx+1]=r0[1]-r0[2]-r0[3];
+                    bottom[2*tx]=r1[0]+r1[1]+r1[2];
+                    bottom[2*tx+1]=r1[1]-r1[2]-r1[3];
+                }
+                real* out=y+((size_t)f*oh+2*ty)*ow;
+                std::copy(top,top+ow,out);
+                if(2*ty+1<oh) std::copy(bottom,bottom+ow,out+ow);
+            }
+        }
+    }
+
+    //A dy A^T of a sample's f x oh x ow output gradient, 16 x f x cols from column 0 of g
+    void transform_gradients(const ConvShape& s,const real* dy,real* g,int th,int tw,size_t cols)
+    {
+        size_t stride=s.f*cols;
+        int oh=s.oh(),ow=s.ow(),width=2*tw;
+        std::vector<real> d(2*width,0.0),r(4*width);
+        for(int f=0;f<s.f;f++)
+        {
+            for(int ty=0;ty<th;ty++)
+            {
+                for(int i=0;i<2;i++)
+                {
+                    int y=2*ty+i;
+                    const real* src=dy+((size_t)f*oh+y)*ow;
+                    if(y<oh) std::copy(src,src+ow,&d[i*width]);
+                    else std::fill(&d[i*width],&d[i*width]+ow,0.0);
+                }
+                #pragma omp simd
+                for(int j=0;j<width;j++)
+                {
+                    r[j]=d[j];
+                    r[width+j]=d[j]+d[width+j];
+                    r[2*width+j]=d[j]-d[width+j];
+                    r[3*width+j]=-d[width+j];
+                }
+                for(int i=0;i<4;i++)
+                {
+                    const real* q=&r[i*width];
+                    real* t=g+f*cols+(size_t)ty*tw+i*4*stride;
+                    #pragma omp simd
+                    for(int tx=0;tx<tw;tx++)
+                    {
+                        t[tx]=q[2*tx];
+                        t[stride+tx]=q[2*tx]+q[2*tx+1];
+                        t[2*stride+tx]=q[2*tx]-q[2*tx+1];
+                        t[3*stride+tx]=-q[2*tx+1];
+                    }
+                }
+            }
+        }
+    }
+
+    //m(rows x n) = u(rows x depth) * v(depth x n), v and m with cols per row; few filters or channels do not pay for packing
+    void multiply(int rows,int n,int depth,const real* u,const real* v,real* m,size_t cols)
+    {
+        if(rows>=WINOGRAD_GEMM_DEPTH&&depth>=WINOGRAD_GEMM_DEPTH)
+        {
+            gemm(false,false,rows,n,depth,1.0,u,depth,v,cols,0.0,m,cols);
+            return;
+        }
+        #pragma omp parallel for if(rows*n>=65536)
+        for(int r=0;r<rows;r++)
+        {
+            real* out=m+r*cols;
+            std::fill(out,out+n,0.0);
+            for(int c=0;c<depth;c++)
+            {
+                real a=u[r*depth+c];
+                const real* in=v+c*cols;
+                #pragma omp simd
+                for(int t=0;t<n;t++) out[t]+=a*in[t];
+            }
+        }
+    }
+
+    //du(rows x depth) += g(rows x n) * v(depth x n)^T, g and v with cols per row
+    void multiply_transposed(int rows,int n,int depth,const real* g,const real* v,real* du,size_t cols)
+    {
+        if(rows>=WINOGRAD_GEMM_DEPTH&&depth>=WINOGRAD_GEMM_DEPTH)
+        {
+            gemm(false,true,rows,depth,n,1.0,g,cols,v,cols,1.0,du,depth);
+            return;
+        }
+        #pragma omp parallel for collapse(2) if((long long)rows*depth*n>=65536)
+        for(int r=0;r<rows;r++)
+        {
+            for(int c=0;c<depth;c++)
+            {
+                const real* a=g+r*cols;
+                const real* b=v+c*cols;
+                real sum=0.0;
+                #pragma omp simd reduction(+:sum)
+                for(int t=0;t<n;t++) sum+=a[t]*b[t];
+                du[r*depth+c]+=sum;
+            }
+        }
+    }
+
+    void winograd_forward(const ConvShape& s,const real* input,const real* kernels,real* output)
+    {
+        int oh=s.oh(),ow=s.ow(),th=(oh+1)/2,tw=(ow+1)/2,tiles=th*tw;
+        int group=std::max(1,std::min(s.batch,WINOGRAD_TILES/tiles));
+        size_t fd=(size_t)s.f*s.d,cols=(size_t)group*tiles;
+        std::vector<real> u(16*fd),v(16*s.d*cols),m(16*s.f*cols);
+        for(size_t i=0;i<fd;i++) transform_kernel(kernels+i*9,&u[i],fd);
+        for(int b0=0;b0<s.batch;b0+=group)
+        {
+            int samples=std::min(group,s.batch-b0);
+            #pragma omp parallel for if(samples>1)
+            for(int b=0;b<samples;b++) transform_inputs(s,input+(b0+b)*input_size(s),&v[(size_t)b*tiles],th,tw,cols);
+            for(int i=0;i<16;i++) multiply(s.f,samples*tiles,s.d,&u[i*fd],&v[i*s.d*cols],&m[i*s.f*cols],cols);
+            #pragma omp parallel for if(samples>1)
+            for(int b=0;b<samples;b++) transform_outputs(s,&m[(size_t)b*tiles],output+(size_t)(b0+b)*s.f*oh*ow,th,tw,cols);
+        }
+    }
+
+    void winograd_backward_filter(const ConvShape& s,const real* input,const real* delta,real* dk,real* db)
+    {
+        int oh=s.oh(),ow=s.ow(),th=(oh+1)/2,tw=(ow+1)/2,tiles=th*tw;
+        int group=std::max(1,std::min(s.batch,WINOGRAD_TILES/tiles));
+        size_t fd=(size_t)s.f*s.d,cols=(size_t)group*tiles,n=pixels(s);
+        std::vector<real> du(16*fd,0.0),v(16*s.d*cols),g(16*s.f*cols);
+        for(int b0=0;b0<s.batch;b0+=group)
+        {
+            int samples=std::min(group,s.batch-b0);
+            #pragma omp parallel for if(samples>1)
+            for(int b=0;b<samples;b++)
+            {
+                const real* dy=delta+(size_t)(b0+b)*s.f*n;
+                transform_inputs(s,input+(b0+b)*input_size(s),&v[(size_t)b*tiles],th,tw,cols);
+                transform_gradients(s,dy,&g[(size_t)b*tiles],th,tw,cols);
+            }
+            for(int i=0;i<16;i++) multiply_transposed(s.f,samples*tiles,s.d,&g[i*s.f*cols],&v[i*s.d*cols],&du[i*fd],cols);
+        }
+        std::vector<real> db_(s.f,0.0);
+        for(int b=0;b<s.batch;b++) bias_gradient(s,delta+(size_t)b*s.f*n,db_);
+        std::copy(db_.begin(),db_.end(),db);
+        for(size_t i=0;i<fd;i++) untransform_kernel(&du[i],fd,dk+i*9);
+    }
+
+    /*
+    With stride 1 the input gradient is a full correlation of delta with the kernels rotated by 180 degrees: a forward
+    pass over delta with f input channels and d filters, padded by dilation*(k-1)-pad, which the forward passes read
+    as zeros without a padded copy.
+    */
+    void rotated_forward(void (*forward)(const ConvShape&,const real*,const real*,real*),const ConvShape& s,const real* delta,const real* kernels,real* prev)
+    {
+        int kk=s.k*s.k;
+        ConvShape t={s.batch,s.oh(),s.ow(),s.f,s.d,s.k,1,s.dilation*(s.k-1)-s.pad,s.dilation};
+        std::vector<real> rotated((size_t)s.d*s.f*kk);
+        for(int f=0;f<s.f;f++) for(int c=0;c<s.d;c++) for(int i=0;i<kk;i++) rotated[((size_t)c*s.f+f)*kk+i]=kernels[((size_t)f*s.d+c)*kk+kk-1-i];
+        forward(t,delta,rotated.data(),prev);
+    }
+
+    void check(ConvAlgorithm algorithm,ConvPass pass,const ConvShape& shape)
+    {
+        if(!conv_supports(algorithm,pass,shape)) throw std::invalid_argument(std::string("conv: ")+conv_algorithm_name(algorithm)+" does not support this shape");
+    }
+
+    //pass and every field of the shape
+    typedef std::tuple<int,int,int,int,int,int,int,int,int,int> TunedKey;
+
+    std::map<TunedKey,ConvAlgorithm>& tuned_algorithms()
+    {
+        static std::map<TunedKey,ConvAlgorithm> tuned;
+        return tuned;
+    }
+
+    std::mutex& tuned_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    TunedKey key_of(ConvPass pass,const ConvShape& s)
+    {
+        return TunedKey((int)pass,s.batch,s.h,s.w,s.d,s.f,s.k,s.stride,s.pad,s.dilation);
+    }
+
+    /*
+    run(algorithm) computes the pass. The first time a shape comes through, every supported algorithm runs three times
+    on the caller's arguments, the faster of the last two counts, and the winner is cached; the passes overwrite their
+    outputs, so whatever ran last leaves a valid result, and the winner runs once more if it was not last.
+    */
+    template<class Run> void autotuned(ConvPass pass,const ConvShape& shape,Run run)
+    {
+        TunedKey key=key_of(pass,shape);
+        bool known;
+        ConvAlgorithm algorithm=ConvAlgorithm::Im2col;
+        {
+            std::lock_guard<std::mutex> lock(tuned_mutex());
+            auto found=tuned_algorithms().find(key);
+            known=found!=tuned_algorithms().end();
+            if(known) algorithm=found->second;
+        }
+        if(known)
+        {
+            run(algorithm);
+            return;
+        }
+        typedef std::chrono::steady_clock clock;
+        const ConvAlgorithm candidates[]={ConvAlgorithm::Im2col,ConvAlgorithm::Direct,ConvAlgorithm::Winograd};
+        ConvAlgorithm best=ConvAlgorithm::Im2col,last=best;
+        double fastest=std::numeric_limits<double>::infinity();
+        for(ConvAlgorithm candidate:candidates)
+        {
+            if(!conv_supports(candidate,pass,shape)) continue;
+            run(candidate);
+            for(int i=0;i<2;i++)
+            {
+                clock::time_point start=clock::now();
+                run(candidate);
+                double seconds=std::chrono::duration<double>(clock::now()-start).count();
+                if(seconds<fastest)
+                {
+                    fastest=seconds;
+                    best=candidate;
+                }
+            }
+            last=candidate;
+        }
+        if(best!=last) run(best);
+        std::lock_guard<std::mutex> lock(tuned_mutex());
+        tuned_algorithms()[key]=best;
+    }
+}
+
+void conv_forward(ConvAlgorithm algorithm,const ConvShape& shape,const real* input,const real* kernels,real* output)
+{
+    check(algorithm,ConvPass::Forward,shape);
+    switch(algorithm)
+    {
+        case ConvAlgorithm::Im2col: im2col_forward(shape,input,kernels,output); break;
+        case ConvAlgorithm::Direct: direct_forward(shape,input,kernels,output); break;
+        case ConvAlgorithm::Winograd: winograd_forward(shape,input,kernels,output); break;
+    }
+}
+
+void conv_backward_data(ConvAlgorithm algorithm,const ConvShape& shape,const real* delta,const real* kernels,real* prev_delta)
+{
+    check(algorithm,ConvPass::BackwardData,shape);
+    switch(algorithm)
+    {
+        case ConvAlgorithm::Im2col: im2col_backward_data(shape,delta,kernels,prev_delta); break;
+        case ConvAlgorithm::Direct: rotated_forward(direct_forward,shape,delta,kernels,prev_delta); break;
+        case ConvAlgorithm::Winograd: rotated_forward(winograd_forward,shape,delta,kernels,prev_delta); break;
+    }
+}
+
+void conv_backward_filter(ConvAlgorithm algorithm,const ConvShape& shape,const real* input,const real* delta,real* dk,real* db)
+{
+    check(algorithm,ConvPass::BackwardFilter,shape);
+    std::fill(dk,dk+(size_t)shape.f*patch(shape),0.0);
+    std::fill(db,db+shape.f,0.0);
+    switch(algorithm)
+    {
+        case ConvAlgorithm::Im2col: im2col_backward_filter(shape,input,delta,dk,db); break;
+        case ConvAlgorithm::Direct: direct_backward_filter(shape,input,delta,dk,db); break;
+        case ConvAlgorithm::Winograd: winograd_backward_filter(shape,input,delta,dk,db); break;
+    }
+}
+
+bool conv_supports(ConvAlgorithm algorithm,ConvPass pass,const ConvShape& shape)
+{
+    if(shape.k<1||shape.stride<1||shape.dilation<1||shape.pad<0||shape.oh()<1||shape.ow()<1) return false;
+    //the rotated forward pass needs stride 1 and no more padding than the dilated kernel covers
+    bool rotated=shape.stride==1&&shape.pad<=shape.dilation*(shape.k-1);
+    switch(algorithm)
+    {
+        case ConvAlgorithm::Im2col: return true;
+        case ConvAlgorithm::Direct: return pass!=ConvPass::BackwardData||rotated;
+        case ConvAlgorithm::Winograd: return shape.k==3&&shape.stride==1&&shape.dilation==1&&(pass!=ConvPass::BackwardData||rotated);
+    }
+    return false;
+}
+
+void conv_forward(const ConvShape& shape,const real* input,const real* kernels,real* output)
+{
+    autotuned(ConvPass::Forward,shape,[&](ConvAlgorithm algorithm){conv_forward(algorithm,shape,input,kernels,output);});
+}
+
+void conv_backward_data(const ConvShape& shape,const real* delta,const real* kernels,real* prev_delta)
+{
+    autotuned(ConvPass::BackwardData,shape,[&](ConvAlgorithm algorithm){conv_backward_data(algorithm,shape,delta,kernels,prev_delta);});
+}
+
+void conv_backward_filter(const ConvShape& shape,const real* input,const real* delta,real* dk,real* db)
+{
+    autotuned(ConvPass::BackwardFilter,shape,[&](ConvAlgorithm algorithm){conv_backward_filter(algorithm,shape,input,delta,dk,db);});
+}
+
+ConvAlgorithm conv_tuned(ConvPass pass,const ConvShape& shape)
+{
+    std::lock_guard<std::mutex> lock(tuned_mutex());
+    auto found=tuned_algorithms().find(key_of(pass,shape));
+    return found!=tuned_algorithms().end()?found->second:ConvAlgorithm::Im2col;
+}
+
+const char* conv_algorithm_name(ConvAlgorithm algorithm)
+{
+    switch(algorithm)
+    {
+        case ConvAlgorithm::Im2col: return "im2col";
+        case ConvAlgorithm::Direct: return "direct";
+        case ConvAlgorithm::Winograd: return "winograd";
+    }
+    return "unknown";
+}
@@ -0,0 +1,66 @@
+/*
+CPU implementation of the extern "C" kernels declared in matrix.h.
+Linked instead of cuda_ops.cu on hosts without a GPU (make BACKEND=cpu), so Matrix and Conv2D run unchanged.
+"Device" memory is plain 64-byte aligned host memory and the memcpy helpers are ordinary copies.
+*/
+#include "../../include/core/matrix.h"
+#include "../../include/core/gemm.h"
+#include "../../include/core/conv_engine.h"
+#include <omp.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+extern "C" void launch_gemm(const real* h_A, const real* h_B, real* h_C, int m, int k, int n, bool trans_a, bool trans_b, real alpha, real beta)
+{
+    gemm(trans_a,trans_b,m,n,k,alpha,h_A,trans_a?m:k,h_B,trans_b?k:n,beta,h_C,n);
+}
+
+extern "C" void launch_hadamard(real* h_A, real* h_B, real* h_C, int size)
+{
+    #pragma omp parallel for simd if(size>32768)
+    for(int i=0;i<size;i++) h_C[i]=h_A[i]*h_B[i];
+}
+
+//Convolutions go through the engine, which picks im2col, direct or Winograd for every shape the first time it runs
+extern "C" void launch_conv2d_lean(const real* d_input, const real* d_kernel, real* d_output, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size, int stride, int pad, int dilation)
+{
+    conv_forward({batch_size,in_h,in_w,in_d,num_filters,k_size,stride,pad,dilation},d_input,d_kernel,d_output);
+}
+
+extern "C" void launch_conv2d_backward_lean(const real* d_input, const real* d_delta, const real* d_kernel, real* d_dk, real* d_db, real* d_prev_delta, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size, int stride, int pad, int dilation)
+{
+    ConvShape shape={batch_size,in_h,in_w,in_d,num_filters,k_size,stride,pad,dilation};
+    conv_backward_filter(shape,d_input,d_delta,d_dk,d_db);
+    conv_backward_data(shape,d_delta,d_kernel,d_prev_delta);
+}
+
+extern "C" void gpu_alloc(real** ptr, size_t size)
+{
+    size_t bytes=(size+63)/64*64;
+#ifdef _WIN32
+    *ptr=(real*)_aligned_malloc(bytes,64);
+#else
+    *ptr=(real*)std::aligned_alloc(64,bytes);
+#endif
+    if(*ptr==nullptr)
+    {
+        std::cerr << "\n[CPU ERROR] gpu_alloc failed for " << size << " bytes" << std::endl;
+        exit(1);
+    }
+}
+
+extern "C" void gpu_free(real* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+extern "C" void gpu_memcpy_h2d(real* dest, const real* src, size_t size) { std::memcpy(dest,src,size); }
+extern "C" void gpu_memcpy_d2h(real* dest, const real* src, size_t size) { std::memcpy(dest,src,size); }
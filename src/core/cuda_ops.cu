@@ -3,6 +3,14 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstdio> 
+#include <mutex>
+#include "../../include/core/real.h"
+
+#ifdef ML_FLOAT32
+#define cublas_gemm cublasSgemm
+#else
+#define cublas_gemm cublasDgemm
+#endif
 
 void check_cuda(cudaError_t result, const char* msg) 
 {
@@ -24,10 +32,12 @@ void check_cublas(cublasStatus_t result, const char* msg)
 cublasHandle_t handle = nullptr;
 
 // --- STATIC BUFFERS (To avoid slow mallocs) ---
-static double *d_A_buf = nullptr, *d_B_buf = nullptr, *d_C_buf = nullptr;
+static real *d_A_buf = nullptr, *d_B_buf = nullptr, *d_C_buf = nullptr;
 static size_t A_cap = 0, B_cap = 0, C_cap = 0;
+//Held for a whole launch: the buffers and the handle are shared by every calling thread (data-parallel fit replicas)
+static std::mutex buffers_lock;
 
-void ensure_capacity(double** ptr, size_t* current_cap, size_t needed_bytes) {
+void ensure_capacity(real** ptr, size_t* current_cap, size_t needed_bytes) {
     if (*current_cap < needed_bytes) {
         if (*ptr) cudaFree(*ptr);
         check_cuda(cudaMalloc(ptr, needed_bytes), "Buffer Re-alloc");
@@ -35,13 +45,18 @@ void ensure_capacity(double** ptr, size_t* current_cap, size_t needed_bytes) {
     }
 }
 
-extern "C" void launch_matmul(double* h_A, double* h_B, double* h_C, int m, int k, int n) 
+/*
+Row-major C = alpha*op(A)*op(B) + beta*C through column-major cuBLAS: C^T = op(B)^T * op(A)^T.
+A row-major matrix read as column-major is its transpose, so each operand keeps its own flag.
+*/
+extern "C" void launch_gemm(const real* h_A, const real* h_B, real* h_C, int m, int k, int n, bool trans_a, bool trans_b, real alpha, real beta)
 {
+    std::lock_guard<std::mutex> guard(buffers_lock);
     if (handle == nullptr) check_cublas(cublasCreate(&handle), "cublasCreate Failed");
 
-    size_t size_A = m * k * sizeof(double);
-    size_t size_B = k * n * sizeof(double);
-    size_t size_C = m * n * sizeof(double);
+    size_t size_A = (size_t)m * k * sizeof(real);
+    size_t size_B = (size_t)k * n * sizeof(real);
+    size_t size_C = (size_t)m * n * sizeof(real);
 
     ensure_capacity(&d_A_buf, &A_cap, size_A);
     ensure_capacity(&d_B_buf, &B_cap, size_B);
@@ -49,23 +64,27 @@ extern "C" void launch_matmul(double* h_A, double* h_B, double* h_C, int m, int
 
     check_cuda(cudaMemcpy(d_A_buf, h_A, size_A, cudaMemcpyHostToDevice), "Memcpy A");
     check_cuda(cudaMemcpy(d_B_buf, h_B, size_B, cudaMemcpyHostToDevice), "Memcpy B");
+    if (beta != 0.0) check_cuda(cudaMemcpy(d_C_buf, h_C, size_C, cudaMemcpyHostToDevice), "Memcpy C");
 
-    const double alpha = 1.0;
-    const double beta = 0.0;
-    check_cublas(cublasDgemm(handle, CUBLAS_OP_N, CUBLAS_OP_N, n, m, k, &alpha, d_B_buf, n, d_A_buf, k, &beta, d_C_buf, n), "GEMM"); 
+    cublasOperation_t op_a = trans_a ? CUBLAS_OP_T : CUBLAS_OP_N;
+    cublasOperation_t op_b = trans_b ? CUBLAS_OP_T : CUBLAS_OP_N;
+    int lda = trans_a ? m : k;
+    int ldb = trans_b ? k : n;
+    check_cublas(cublas_gemm(handle, op_b, op_a, n, m, k, &alpha, d_B_buf, ldb, d_A_buf, lda, &beta, d_C_buf, n), "GEMM");
 
     check_cuda(cudaMemcpy(h_C, d_C_buf, size_C, cudaMemcpyDeviceToHost), "Memcpy C");
 }
 
-__global__ void hadamard_kernel(const double* A, const double* B, double* C, int size)
+__global__ void hadamard_kernel(const real* A, const real* B, real* C, int size)
 {
     int index = blockIdx.x * blockDim.x + threadIdx.x;
     if (index < size) C[index] = A[index] * B[index];
 }
 
-extern "C" void launch_hadamard(double* h_A, double* h_B, double* h_C, int size)
+extern "C" void launch_hadamard(real* h_A, real* h_B, real* h_C, int size)
 {
-    size_t bytes = size * sizeof(double);
+    std::lock_guard<std::mutex> guard(buffers_lock);
+    size_t bytes = (size_t)size * sizeof(real);
     ensure_capacity(&d_A_buf, &A_cap, bytes);
     ensure_capacity(&d_B_buf, &B_cap, bytes);
     ensure_capacity(&d_C_buf, &C_cap, bytes);
@@ -80,7 +99,7 @@ extern "C" void launch_hadamard(double* h_A, double* h_B, double* h_C, int size)
     check_cuda(cudaMemcpy(h_C, d_C_buf, bytes, cudaMemcpyDeviceToHost), "Hadamard Copy C");
 }
 
-__global__ void conv2dkernel(const double* input, const double* kernel, double* output, int batch_size, int h, int w, int d, int oh, int ow, int num_filters, int k_size)
+__global__ void conv2dkernel(const real* input, const real* kernel, real* output, int batch_size, int h, int w, int d, int oh, int ow, int num_filters, int k_size, int stride, int pad, int dilation)
 {
     int total=batch_size*num_filters*oh*ow;
     int idx=blockIdx.x*blockDim.x+threadIdx.x;
@@ -89,12 +108,13 @@ __global__ void conv2dkernel(const double* input, const double* kernel, double*
     int i=(idx/ow)%oh;
     int f=(idx/(ow*oh))%num_filters;
     int b=idx/(ow*oh*num_filters);
-    double sum=0.0;
+    real sum=0.0;
     for (int depth=0;depth<d;depth++) {
         for (int ki=0; ki < k_size; ki++) {
             for (int kj=0;kj<k_size;kj++) {
-                int row_in=i+ki;
-                int col_in=j+kj;
+                int row_in=i*stride-pad+ki*dilation;
+                int col_in=j*stride-pad+kj*dilation;
+                if(row_in<0||row_in>=h||col_in<0||col_in>=w) continue;
                 int input_idx=b*(d*h*w)+ depth*(h*w)+row_in*w+col_in;
                 int kernel_idx = f*(d*k_size*k_size)+depth*(k_size*k_size)+ki*k_size+kj;
                 sum+=input[input_idx]*kernel[kernel_idx];
@@ -104,15 +124,15 @@ __global__ void conv2dkernel(const double* input, const double* kernel, double*
     output[idx] = sum;
 }
 
-extern "C" void launch_conv2d_lean(const double* d_input, const double* d_kernel, double* d_output, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size)
+extern "C" void launch_conv2d_lean(const real* d_input, const real* d_kernel, real* d_output, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size, int stride, int pad, int dilation)
 {
     int output_size = batch_size * num_filters * out_h * out_w;
     int threads = 256;
     int blocks = (output_size + threads - 1) / threads;
-    conv2dkernel<<<blocks, threads>>>(d_input, d_kernel, d_output, batch_size, in_h, in_w, in_d, out_h, out_w, num_filters, k_size);
+    conv2dkernel<<<blocks, threads>>>(d_input, d_kernel, d_output, batch_size, in_h, in_w, in_d, out_h, out_w, num_filters, k_size, stride, pad, dilation);
 }
 
-__global__ void conv2d_backward_weights_kernel(const double* input, const double* delta, double* d_kernel, double* d_bias, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size)
+__global__ void conv2d_backward_weights_kernel(const real* input, const real* delta, real* d_kernel, real* d_bias, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size, int stride, int pad, int dilation)
 {
     int total_elements = batch_size * num_filters * out_h * out_w;
     int idx = blockIdx.x * blockDim.x + threadIdx.x;
@@ -121,13 +141,14 @@ __global__ void conv2d_backward_weights_kernel(const double* input, const double
     int i = (idx / out_w) % out_h;
     int f = (idx / (out_w * out_h)) % num_filters;
     int b = idx / (out_w * out_h * num_filters);
-    double d_val = delta[idx];
+    real d_val = delta[idx];
     atomicAdd(&d_bias[f], d_val);
     for (int d = 0; d < in_d; d++) {
         for (int ki = 0; ki < k_size; ki++) {
             for (int kj = 0; kj < k_size; kj++) {
-                int row_in = i + ki;
-                int col_in = j + kj;
+                int row_in = i * stride - pad + ki * dilation;
+                int col_in = j * stride - pad + kj * dilation;
+                if (row_in < 0 || row_in >= in_h || col_in < 0 || col_in >= in_w) continue;
                 int input_idx = b * (in_d * in_h * in_w) + d * (in_h * in_w) + row_in * in_w + col_in;
                 int kernel_idx = f * (in_d * k_size * k_size) + d * (k_size * k_size) + ki * k_size + kj;
                 atomicAdd(&d_kernel[kernel_idx], input[input_idx] * d_val);
@@ -136,7 +157,7 @@ __global__ void conv2d_backward_weights_kernel(const double* input, const double
     }
 }
 
-__global__ void conv2d_backward_input_kernel(const double* delta, const double* kernel, double* d_input, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size)
+__global__ void conv2d_backward_input_kernel(const real* delta, const real* kernel, real* d_input, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size, int stride, int pad, int dilation)
 {
     int total_elements = batch_size * num_filters * out_h * out_w;
     int idx = blockIdx.x * blockDim.x + threadIdx.x;
@@ -145,13 +166,14 @@ __global__ void conv2d_backward_input_kernel(const double* delta, const double*
     int i = (idx / out_w) % out_h;
     int f = (idx / (out_w * out_h)) % num_filters;
     int b = idx / (out_w * out_h * num_filters);
-    double d_val = delta[idx];
+    real d_val = delta[idx];
     for (int d = 0; d < in_d; d++) {
         for (int ki = 0; ki < k_size; ki++) {
             for (int kj = 0; kj < k_size; kj++) {
                 int kernel_idx = f * (in_d * k_size * k_size) + d * (k_size * k_size) + ki * k_size + kj;
-                int row_in = i + ki;
-                int col_in = j + kj;
+                int row_in = i * stride - pad + ki * dilation;
+                int col_in = j * stride - pad + kj * dilation;
+                if (row_in < 0 || row_in >= in_h || col_in < 0 || col_in >= in_w) continue;
                 int input_idx = b * (in_d * in_h * in_w) + d * (in_h * in_w) + row_in * in_w + col_in;
                 atomicAdd(&d_input[input_idx], d_val * kernel[kernel_idx]);
             }
@@ -159,21 +181,21 @@ __global__ void conv2d_backward_input_kernel(const double* delta, const double*
     }
 }
 
-extern "C" void launch_conv2d_backward_lean(const double* d_input, const double* d_delta, const double* d_kernel, double* d_dk, double* d_db, double* d_prev_delta, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size)
+extern "C" void launch_conv2d_backward_lean(const real* d_input, const real* d_delta, const real* d_kernel, real* d_dk, real* d_db, real* d_prev_delta, int batch_size, int in_h, int in_w, int in_d, int out_h, int out_w, int num_filters, int k_size, int stride, int pad, int dilation)
 {
     int delta_size = batch_size * num_filters * out_h * out_w;
     int kernel_size = num_filters * in_d * k_size * k_size;
     int input_size = batch_size * in_d * in_h * in_w;
-    cudaMemset(d_dk, 0, kernel_size * sizeof(double));
-    cudaMemset(d_db, 0, num_filters * sizeof(double));
-    cudaMemset(d_prev_delta, 0, input_size * sizeof(double));
+    cudaMemset(d_dk, 0, kernel_size * sizeof(real));
+    cudaMemset(d_db, 0, num_filters * sizeof(real));
+    cudaMemset(d_prev_delta, 0, input_size * sizeof(real));
     int threads = 256;
     int blocks = (delta_size + threads - 1) / threads;
-    conv2d_backward_weights_kernel<<<blocks, threads>>>(d_input, d_delta, d_dk, d_db, batch_size, in_h, in_w, in_d, out_h, out_w, num_filters, k_size);
-    conv2d_backward_input_kernel<<<blocks, threads>>>(d_delta, d_kernel, d_prev_delta, batch_size, in_h, in_w, in_d, out_h, out_w, num_filters, k_size);
+    conv2d_backward_weights_kernel<<<blocks, threads>>>(d_input, d_delta, d_dk, d_db, batch_size, in_h, in_w, in_d, out_h, out_w, num_filters, k_size, stride, pad, dilation);
+    conv2d_backward_input_kernel<<<blocks, threads>>>(d_delta, d_kernel, d_prev_delta, batch_size, in_h, in_w, in_d, out_h, out_w, num_filters, k_size, stride, pad, dilation);
 }
 
-extern "C" void gpu_alloc(double** ptr, size_t size) { check_cuda(cudaMalloc(ptr, size), "gpu_alloc"); }
-extern "C" void gpu_free(double* ptr) { cudaFree(ptr); }
-extern "C" void gpu_memcpy_h2d(double* dest, const double* src, size_t size) { check_cuda(cudaMemcpy(dest, src, size, cudaMemcpyHostToDevice), "gpu_memcpy_h2d"); }
-extern "C" void gpu_memcpy_d2h(double* dest, const double* src, size_t size) { check_cuda(cudaMemcpy(dest, src, size, cudaMemcpyDeviceToHost), "gpu_memcpy_d2h"); }
\ No newline at end of file
+extern "C" void gpu_alloc(real** ptr, size_t size) { check_cuda(cudaMalloc(ptr, size), "gpu_alloc"); }
+extern "C" void gpu_free(real* ptr) { cudaFree(ptr); }
+extern "C" void gpu_memcpy_h2d(real* dest, const real* src, size_t size) { check_cuda(cudaMemcpy(dest, src, size, cudaMemcpyHostToDevice), "gpu_memcpy_h2d"); }
+extern "C" void gpu_memcpy_d2h(real* dest, const real* src, size_t size) { check_cuda(cudaMemcpy(dest, src, size, cudaMemcpyDeviceToHost), "gpu_memcpy_d2h"); }
\ No newline at end of file
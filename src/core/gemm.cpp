@@ -0,0 +1,375 @@
+#include "../../include/core/gemm.h"
+#include <omp.h>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define GEMM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GEMM_TARGET(isa)
+#else
+#define GEMM_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace
+{
+    /*
+    MC x KC block of A stays in L2 and the KC x NC panel of B in L3.
+    The register tile MR x NR depends on the micro kernel picked at runtime, MC and NC are multiples of all of them.
+    Float builds (ML_FLOAT32) use kernels twice as wide, a vector register holds twice as many floats.
+    */
+    const int MC=96,KC=256,NC=2048;
+    const int MAX_MR=8,MAX_NR=32;
+
+    typedef void (*MicroKernel)(int kc,const real* a,const real* b,real alpha,real* C,int ldc);
+
+    struct Kernel
+    {
+        const char* name;
+        int mr,nr;
+        MicroKernel fn;
+    };
+
+    //Portable fallback, the compiler vectorizes the inner loop for whatever -march allows
+    void kernel_generic(int kc,const real* a,const real* b,real alpha,real* C,int ldc)
+    {
+        real acc[4][8]={};
+        for(int p=0;p<kc;p++)
+        {
+            for(int i=0;i<4;i++)
+            {
+                real a_ip=a[p*4+i];
+                #pragma omp simd
+                for(int j=0;j<8;j++) acc[i][j]+=a_ip*b[p*8+j];
+            }
+        }
+        for(int i=0;i<4;i++) for(int j=0;j<8;j++) C[(size_t)i*ldc+j]+=alpha*acc[i][j];
+    }
+
+#ifdef GEMM_X86
+#ifdef ML_FLOAT32
+    //6x16 tile: 12 ymm accumulators of 8 floats each
+    GEMM_TARGET("avx2,fma")
+    void kernel_avx2(int kc,const float* a,const float* b,float alpha,float* C,int ldc)
+    {
+        __m256 c00=_mm256_setzero_ps(),c01=_mm256_setzero_ps(),c10=_mm256_setzero_ps(),c11=_mm256_setzero_ps();
+        __m256 c20=_mm256_setzero_ps(),c21=_mm256_setzero_ps(),c30=_mm256_setzero_ps(),c31=_mm256_setzero_ps();
+        __m256 c40=_mm256_setzero_ps(),c41=_mm256_setzero_ps(),c50=_mm256_setzero_ps(),c51=_mm256_setzero_ps();
+        for(int p=0;p<kc;p++,a+=6,b+=16)
+        {
+            __m256 b0=_mm256_loadu_ps(b),b1=_mm256_loadu_ps(b+8),ai;
+            ai=_mm256_broadcast_ss(a+0); c00=_mm256_fmadd_ps(ai,b0,c00); c01=_mm256_fmadd_ps(ai,b1,c01);
+            ai=_mm256_broadcast_ss(a+1); c10=_mm256_fmadd_ps(ai,b0,c10); c11=_mm256_fmadd_ps(ai,b1,c11);
+            ai=_mm256_broadcast_ss(a+2); c20=_mm256_fmadd_ps(ai,b0,c20); c21=_mm256_fmadd_ps(ai,b1,c21);
+            ai=_mm256_broadcast_ss(a+3); c30=_mm256_fmadd_ps(ai,b0,c30); c31=_mm256_fmadd_ps(ai,b1,c31);
+            ai=_mm256_broadcast_ss(a+4); c40=_mm256_fmadd_ps(ai,b0,c40); c41=_mm256_fmadd_ps(ai,b1,c41);
+            ai=_mm256_broadcast_ss(a+5); c50=_mm256_fmadd_ps(ai,b0,c50); c51=_mm256_fmadd_ps(ai,b1,c51);
+        }
+        __m256 al=_mm256_set1_ps(alpha);
+        __m256 acc[6][2]={{c00,c01},{c10,c11},{c20,c21},{c30,c31},{c40,c41},{c50,c51}};
+        for(int i=0;i<6;i++)
+        {
+            float* row=C+(size_t)i*ldc;
+            _mm256_storeu_ps(row,_mm256_fmadd_ps(al,acc[i][0],_mm256_loadu_ps(row)));
+            _mm256_storeu_ps(row+8,_mm256_fmadd_ps(al,acc[i][1],_mm256_loadu_ps(row+8)));
+        }
+    }
+
+    //8x32 tile: 16 zmm accumulators of 16 floats each
+    GEMM_TARGET("avx512f")
+    void kernel_avx512(int kc,const float* a,const float* b,float alpha,float* C,int ldc)
+    {
+        __m512 acc[8][2];
+        for(int i=0;i<8;i++) acc[i][0]=acc[i][1]=_mm512_setzero_ps();
+        for(int p=0;p<kc;p++,a+=8,b+=32)
+        {
+            __m512 b0=_mm512_loadu_ps(b),b1=_mm512_loadu_ps(b+16);
+            for(int i=0;i<8;i++)
+            {
+                __m512 ai=_mm512_set1_ps(a[i]);
+                acc[i][0]=_mm512_fmadd_ps(ai,b0,acc[i][0]);
+                acc[i][1]=_mm512_fmadd_ps(ai,b1,acc[i][1]);
+            }
+        }
+        __m512 al=_mm512_set1_ps(alpha);
+        for(int i=0;i<8;i++)
+        {
+            float* row=C+(size_t)i*ldc;
+            _mm512_storeu_ps(row,_mm512_fmadd_ps(al,acc[i][0],_mm512_loadu_ps(row)));
+            _mm512_storeu_ps(row+16,_mm512_fmadd_ps(al,acc[i][1],_mm512_loadu_ps(row+16)));
+        }
+    }
+
+#else
+    //6x8 tile: 12 ymm accumulators, 2 for the B row and 1 broadcast of A
+    GEMM_TARGET("avx2,fma")
+    void kernel_avx2(int kc,const double* a,const double* b,double alpha,double* C,int ldc)
+    {
+        __m256d c00=_mm256_setzero_pd(),c01=_mm256_setzero_pd(),c10=_mm256_setzero_pd(),c11=_mm256_setzero_pd();
+        __m256d c20=_mm256_setzero_pd(),c21=_mm256_setzero_pd(),c30=_mm256_setzero_pd(),c31=_mm256_setzero_pd();
+        __m256d c40=_mm256_setzero_pd(),c41=_mm256_setzero_pd(),c50=_mm256_setzero_pd(),c51=_mm256_setzero_pd();
+        for(int p=0;p<kc;p++,a+=6,b+=8)
+        {
+            __m256d b0=_mm256_loadu_pd(b),b1=_mm256_loadu_pd(b+4),ai;
+            ai=_mm256_broadcast_sd(a+0); c00=_mm256_fmadd_pd(ai,b0,c00); c01=_mm256_fmadd_pd(ai,b1,c01);
+            ai=_mm256_broadcast_sd(a+1); c10=_mm256_fmadd_pd(ai,b0,c10); c11=_mm256_fmadd_pd(ai,b1,c11);
+            ai=_mm256_broadcast_sd(a+2); c20=_mm256_fmadd_pd(ai,b0,c20); c21=_mm256_fmadd_pd(ai,b1,c21);
+            ai=_mm256_broadcast_sd(a+3); c30=_mm256_fmadd_pd(ai,b0,c30); c31=_mm256_fmadd_pd(ai,b1,c31);
+            ai=_mm256_broadcast_sd(a+4); c40=_mm256_fmadd_pd(ai,b0,c40); c41=_mm256_fmadd_pd(ai,b1,c41);
+            ai=_mm256_broadcast_sd(a+5); c50=_mm256_fmadd_pd(ai,b0,c50); c51=_mm256_fmadd_pd(ai,b1,c51);
+        }
+        __m256d al=_mm256_set1_pd(alpha);
+        __m256d acc[6][2]={{c00,c01},{c10,c11},{c20,c21},{c30,c31},{c40,c41},{c50,c51}};
+        for(int i=0;i<6;i++)
+        {
+            double* row=C+(size_t)i*ldc;
+            _mm256_storeu_pd(row,_mm256_fmadd_pd(al,acc[i][0],_mm256_loadu_pd(row)));
+            _mm256_storeu_pd(row+4,_mm256_fmadd_pd(al,acc[i][1],_mm256_loadu_pd(row+4)));
+        }
+    }
+
+    //8x16 tile: 16 zmm accumulators
+    GEMM_TARGET("avx512f")
+    void kernel_avx512(int kc,const double* a,const double* b,double alpha,double* C,int ldc)
+    {
+        __m512d acc[8][2];
+        for(int i=0;i<8;i++) acc[i][0]=acc[i][1]=_mm512_setzero_pd();
+        for(int p=0;p<kc;p++,a+=8,b+=16)
+        {
+            __m512d b0=_mm512_loadu_pd(b),b1=_mm512_loadu_pd(b+8);
+            for(int i=0;i<8;i++)
+            {
+                __m512d ai=_mm512_set1_pd(a[i]);
+                acc[i][0]=_mm512_fmadd_pd(ai,b0,acc[i][0]);
+                acc[i][1]=_mm512_fmadd_pd(ai,b1,acc[i][1]);
+            }
+        }
+        __m512d al=_mm512_set1_pd(alpha);
+        for(int i=0;i<8;i++)
+        {
+            double* row=C+(size_t)i*ldc;
+            _mm512_storeu_pd(row,_mm512_fmadd_pd(al,acc[i][0],_mm512_loadu_pd(row)));
+            _mm512_storeu_pd(row+8,_mm512_fmadd_pd(al,acc[i][1],_mm512_loadu_pd(row+8)));
+        }
+    }
+
+#endif
+
+    bool cpu_has(const char* isa)
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info,0);
+        if(info[0]<7) return false;
+        __cpuid(info,1);
+        bool osxsave=(info[2]>>27)&1,fma=(info[2]>>12)&1;
+        if(!osxsave) return false;
+        unsigned long long xcr0=_xgetbv(0);
+        __cpuidex(info,7,0);
+        if(std::strcmp(isa,"avx2")==0) return fma&&((info[1]>>5)&1)&&((xcr0&0x6)==0x6);
+        if(std::strcmp(isa,"avx512")==0) return ((info[1]>>16)&1)&&((xcr0&0xe6)==0xe6);
+        return false;
+#else
+        __builtin_cpu_init();
+        if(std::strcmp(isa,"avx2")==0) return __builtin_cpu_supports("avx2")&&__builtin_cpu_supports("fma");
+        if(std::strcmp(isa,"avx512")==0) return __builtin_cpu_supports("avx512f");
+        return false;
+#endif
+    }
+#endif
+
+    const Kernel GENERIC={"generic",4,8,kernel_generic};
+#ifdef GEMM_X86
+#ifdef ML_FLOAT32
+    const Kernel AVX2={"avx2",6,16,kernel_avx2};
+    const Kernel AVX512={"avx512",8,32,kernel_avx512};
+#else
+    const Kernel AVX2={"avx2",6,8,kernel_avx2};
+    const Kernel AVX512={"avx512",8,16,kernel_avx512};
+#endif
+#endif
+
+    bool supported(const char* isa)
+    {
+        if(std::strcmp(isa,"generic")==0) return true;
+#ifdef GEMM_X86
+        return cpu_has(isa);
+#else
+        return false;
+#endif
+    }
+
+    const Kernel* lookup(const char* isa)
+    {
+        if(!supported(isa)) return nullptr;
+#ifdef GEMM_X86
+        if(std::strcmp(isa,"avx512")==0) return &AVX512;
+        if(std::strcmp(isa,"avx2")==0) return &AVX2;
+#endif
+        return &GENERIC;
+    }
+
+    //Widest kernel the CPU supports, GEMM_ISA=generic|avx2|avx512 in the environment overrides it
+    const Kernel* detect()
+    {
+        const char* env=std::getenv("GEMM_ISA");
+        if(env)
+        {
+            const Kernel* forced=lookup(env);
+            if(forced) return forced;
+        }
+        const char* order[]={"avx512","avx2"};
+        for(const char* isa:order)
+        {
+            const Kernel* k=lookup(isa);
+            if(k) return k;
+        }
+        return &GENERIC;
+    }
+
+    //Set by gemm_set_isa, read by every gemm call and by gemm_isa() (which pool.cpp asks whether AVX2 is available)
+    std::atomic<const Kernel*> forced{nullptr};
+
+    const Kernel& kernel()
+    {
+        const Kernel* k=forced.load(std::memory_order_acquire);
+        if(k) return *k;
+        //detected once, the first caller does it and the rest wait for it
+        static const Kernel* detected=detect();
+        return *detected;
+    }
+
+    //A block (mc x kc) stored as mr-row slivers, each sliver column by column, zero padded to mr
+    void pack_a(bool trans,const real* A,int lda,int row0,int col0,int mc,int kc,int mr,real* buf)
+    {
+        for(int i=0;i<mc;i+=mr)
+        {
+            int rows=std::min(mr,mc-i);
+            for(int p=0;p<kc;p++)
+            {
+                for(int r=0;r<rows;r++)
+                {
+                    size_t row=row0+i+r,col=col0+p;
+                    *buf++=trans?A[col*lda+row]:A[row*lda+col];
+                }
+                for(int r=rows;r<mr;r++) *buf++=0.0;
+            }
+        }
+    }
+
+    //One nr-column sliver of the B panel (kc x nr), row by row, zero padded to nr
+    void pack_b(bool trans,const real* B,int ldb,int row0,int col0,int kc,int cols,int nr,real* buf)
+    {
+        for(int p=0;p<kc;p++)
+        {
+            size_t row=row0+p;
+            if(!trans) std::memcpy(buf,B+row*ldb+col0,cols*sizeof(real));
+            else for(int c=0;c<cols;c++) buf[c]=B[(size_t)(col0+c)*ldb+row];
+            for(int c=cols;c<nr;c++) buf[c]=0.0;
+            buf+=nr;
+        }
+    }
+
+    //Full tiles go straight to C, edge tiles through a scratch tile
+    void run_tile(const Kernel& kr,int kc,const real* a,const real* b,real alpha,real* C,int ldc,int rows,int cols)
+    {
+        if(rows==kr.mr&&cols==kr.nr)
+        {
+            kr.fn(kc,a,b,alpha,C,ldc);
+            return;
+        }
+        real tile[MAX_MR*MAX_NR]={};
+        kr.fn(kc,a,b,alpha,tile,kr.nr);
+        for(int i=0;i<rows;i++) for(int j=0;j<cols;j++) C[(size_t)i*ldc+j]+=tile[i*kr.nr+j];
+    }
+}
+
+const char* gemm_isa()
+{
+    return kernel().name;
+}
+
+bool gemm_set_isa(const char* isa)
+{
+    const Kernel* k=lookup(isa);
+    if(!k) return false;
+    forced.store(k,std::memory_order_release);
+    return true;
+}
+
+void gemm(bool trans_a,bool trans_b,int m,int n,int k,real alpha,const real* A,int lda,const real* B,int ldb,real beta,real* C,int ldc)
+{
+    if(m<=0||n<=0) return;
+    if(beta!=1.0)
+    {
+        for(int i=0;i<m;i++)
+        {
+            real* row=C+(size_t)i*ldc;
+            if(beta==0.0) std::fill(row,row+n,0.0);
+            else for(int j=0;j<n;j++) row[j]*=beta;
+        }
+    }
+    if(k<=0||alpha==0.0) return;
+
+    const Kernel& kr=kernel();
+    int mr=kr.mr,nr=kr.nr;
+    std::vector<real> b_buf((size_t)KC*(std::min(NC,n)+nr));
+    bool threaded=(long long)m*n*k>=32*32*32&&omp_get_max_threads()>1&&!omp_in_parallel();
+    int threads=threaded?omp_get_max_threads():1;
+
+    #pragma omp parallel if(threaded)
+    {
+        std::vector<real> a_buf((size_t)(MC+mr)*KC);
+        for(int jc=0;jc<n;jc+=NC)
+        {
+            int nc=std::min(NC,n-jc);
+            int slivers=(nc+nr-1)/nr;
+            int m_blocks=(m+MC-1)/MC;
+            /*
+            Work is split over M blocks and over column chunks of the B panel so that shapes with few rows
+            (a batch of 128 against a wide weight matrix) still give every thread a tile.
+            */
+            int n_chunks=std::max(1,std::min(slivers,(2*threads+m_blocks-1)/m_blocks));
+            int chunk=(slivers+n_chunks-1)/n_chunks;
+            n_chunks=(slivers+chunk-1)/chunk;
+
+            for(int pc=0;pc<k;pc+=KC)
+            {
+                int kc=std::min(KC,k-pc);
+
+                #pragma omp for schedule(static)
+                for(int s=0;s<slivers;s++)
+                {
+                    int jr=s*nr;
+                    pack_b(trans_b,B,ldb,pc,jc+jr,kc,std::min(nr,nc-jr),nr,b_buf.data()+(size_t)jr*kc);
+                }
+
+                #pragma omp for schedule(dynamic)
+                for(int task=0;task<m_blocks*n_chunks;task++)
+                {
+                    int ic=(task/n_chunks)*MC;
+                    int mc=std::min(MC,m-ic);
+                    int s_begin=(task%n_chunks)*chunk;
+                    int s_end=std::min(slivers,s_begin+chunk);
+                    pack_a(trans_a,A,lda,ic,pc,mc,kc,mr,a_buf.data());
+                    for(int s=s_begin;s<s_end;s++)
+                    {
+                        int jr=s*nr;
+                        int cols=std::min(nr,nc-jr);
+                        for(int ir=0;ir<mc;ir+=mr)
+                        {
+                            int rows=std::min(mr,mc-ir);
+                            run_tile(kr,kc,a_buf.data()+(size_t)ir*kc,b_buf.data()+(size_t)jr*kc,alpha,C+(size_t)(ic+ir)*ldc+jc+jr,ldc,rows,cols);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
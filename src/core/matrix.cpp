@@ -1,43 +1,119 @@
 #include "../include/core/matrix.h"
+#include "../include/core/gemm.h"
+#include "../include/core/allocator.h"
 #include <omp.h>
 #include <stdexcept>
 #include <functional>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+static std::atomic<long long> alloc_count(0),alloc_bytes(0),copy_count(0);
+
+real* Matrix::allocate(int size)
+{
+    if(size<=0) return nullptr;
+    alloc_count++;
+    alloc_bytes+=(long long)size*sizeof(real);
+    return (real*)matrix_allocator().allocate((size_t)size*sizeof(real));
+}
+
+MatrixStats Matrix::stats()
+{
+    return {alloc_count.load(),alloc_bytes.load(),copy_count.load()};
+}
+
+void Matrix::reset_stats()
+{
+    alloc_count=0;
+    alloc_bytes=0;
+    copy_count=0;
+}
 
 Matrix::Matrix() : rows(0), cols(0), data(nullptr) {}
 
 Matrix::Matrix(int r,int c) : rows(r), cols(c)
 {
-    data = new double[rows*cols];
-    for (int i=0; i<rows*cols; ++i) data[i] = 0.0;
+    data = allocate(rows*cols);
+    std::fill(data, data+rows*cols, 0.0);
+}
+
+Matrix::Matrix(int r,int c,Uninitialized) : rows(r), cols(c)
+{
+    data = allocate(rows*cols);
 }
 
 Matrix::Matrix(const Matrix& matrix) : rows(matrix.rows), cols(matrix.cols)
 {
-    data = new double[rows*cols];
-    for (int i=0; i<rows*cols; ++i) data[i] = matrix.data[i];
+    data = allocate(rows*cols);
+    copy_count++;
+    std::copy(matrix.data, matrix.data+rows*cols, data);
+}
+
+Matrix::Matrix(Matrix&& matrix) noexcept : rows(matrix.rows), cols(matrix.cols), data(matrix.data), owned(matrix.owned)
+{
+    matrix.rows=0;
+    matrix.cols=0;
+    matrix.data=nullptr;
+    matrix.owned=true;
+}
+
+Matrix::Matrix(const MatrixView& view) : rows(view.rows), cols(view.cols)
+{
+    data = allocate(rows*cols);
+    copy_count++;
+    for(int i=0;i<rows;i++) std::copy(view.row(i), view.row(i)+cols, data+(size_t)i*cols);
+}
+
+MatrixView::MatrixView() : data(nullptr), rows(0), cols(0), stride(0) {}
+
+MatrixView::MatrixView(const real* data,int rows,int cols,int stride) : data(data), rows(rows), cols(cols), stride(stride) {}
+
+MatrixView::MatrixView(const Matrix& matrix) : data(matrix.data), rows(matrix.rows), cols(matrix.cols), stride(matrix.cols) {}
+
+MatrixView MatrixView::slice(int start,int end) const
+{
+    if(start<0||end>rows||start>end) throw std::out_of_range("Slice indices out of range");
+    return MatrixView(row(start),end-start,cols,stride);
+}
+
+MatrixView MatrixView::columns(int start,int end) const
+{
+    if(start<0||end>cols||start>end) throw std::out_of_range("Column indices out of range");
+    return MatrixView(data+start,rows,end-start,stride);
 }
 
 Matrix::~Matrix()
 {
-    delete[] data;
+    if(owned) Allocator::deallocate(data);
+}
+
+Matrix Matrix::borrow(real* data, int r, int c)
+{
+    Matrix matrix;
+    matrix.rows=r;
+    matrix.cols=c;
+    matrix.data=data;
+    matrix.owned=false;
+    return matrix;
 }
 
 Matrix Matrix::transpose() const
 {
-    Matrix ans(cols, rows);
+    Matrix ans(cols, rows, Uninitialized());
     for(int i=0;i<rows;i++) for(int j= 0; j<cols;j++)ans.data[j*rows+i] = data[i*cols+j]; 
     return ans;
 }
 
-double& Matrix::operator()(int r, int c)
+real& Matrix::operator()(int r, int c)
 {
     if(r<0||r>=rows||c<0||c>=cols) throw std::out_of_range("Matrix indices out of range");
     return data[r*cols+c];
 }
 
-double Matrix::operator()(int r, int c) const
+real Matrix::operator()(int r, int c) const
 {
     if(r<0||r>=rows||c<0||c>=cols) throw std::out_of_range("Matrix indices out of range");
     return data[r*cols+c];
@@ -47,11 +123,34 @@ Matrix& Matrix::operator=(const Matrix& matrix)
 {
     if(this!=&matrix)
     {
-        delete[] data;
+        //keep the buffer when the size matches, a cached layer input is overwritten every batch
+        if(!owned||rows*cols!=matrix.rows*matrix.cols)
+        {
+            if(owned) Allocator::deallocate(data);
+            data=allocate(matrix.rows*matrix.cols);
+            owned=true;
+        }
         rows=matrix.rows;
         cols=matrix.cols;
-        data=new double[rows*cols];
-        for(int i=0;i<rows*cols;++i)data[i]=matrix.data[i];
+        copy_count++;
+        std::copy(matrix.data,matrix.data+rows*cols,data);
+    }
+    return *this;
+}
+
+Matrix& Matrix::operator=(Matrix&& matrix) noexcept
+{
+    if(this!=&matrix)
+    {
+        if(owned) Allocator::deallocate(data);
+        rows=matrix.rows;
+        cols=matrix.cols;
+        data=matrix.data;
+        owned=matrix.owned;
+        matrix.rows=0;
+        matrix.cols=0;
+        matrix.data=nullptr;
+        matrix.owned=true;
     }
     return *this;
 }
@@ -68,58 +167,127 @@ bool Matrix::operator!=(const Matrix& matrix) const
     return !(*this==matrix);
 }
 
-Matrix Matrix::operator+(const Matrix& matrix) const
+Matrix Matrix::operator+(const Matrix& matrix) const&
 {
     if(rows!=matrix.rows||cols!=matrix.cols) throw std::invalid_argument("Dimension mismatch");;
-    Matrix ans(rows,cols);
+    Matrix ans(rows,cols,Uninitialized());
     for(int i=0;i<rows*cols;++i)ans.data[i]=data[i]+matrix.data[i];
     return ans;
 }
 
-Matrix Matrix::operator+(double scalar) const 
+Matrix Matrix::operator+(const Matrix& matrix) &&
+{
+    *this+=matrix;
+    return std::move(*this);
+}
+
+Matrix Matrix::operator+(real scalar) const 
 {
-    Matrix ans(rows, cols);
+    Matrix ans(rows, cols, Uninitialized());
     for(int i = 0; i < rows * cols; ++i)ans.data[i] = data[i] + scalar;
     return ans;
 }
 
-Matrix Matrix::operator-(double scalar) const 
+Matrix Matrix::operator-(real scalar) const 
 {
-    Matrix ans(rows, cols);
+    Matrix ans(rows, cols, Uninitialized());
     for(int i = 0; i < rows * cols; ++i)ans.data[i] = data[i] - scalar;
     return ans;
 }
 
-Matrix Matrix::operator-(const Matrix& matrix) const
+Matrix Matrix::operator-(const Matrix& matrix) const&
 {
     if(rows!=matrix.rows||cols!=matrix.cols) throw std::invalid_argument("Dimension mismatch");;
-    Matrix ans(rows,cols);
+    Matrix ans(rows,cols,Uninitialized());
     for(int i=0;i<rows*cols;++i)ans.data[i]=data[i]-matrix.data[i];
     return ans;
 }
 
-Matrix Matrix::operator*(const Matrix& matrix) const
+Matrix Matrix::operator-(const Matrix& matrix) &&
 {
-    if(cols!=matrix.rows) throw std::invalid_argument("Dimension mismatch");;
-    Matrix ans(rows,matrix.cols);
-    long long vol=(long long)rows*(long long)cols*(long long)matrix.cols;
-    if(vol>100000)launch_matmul(this->data,matrix.data,ans.data,rows,cols,matrix.cols);
-    else
+    *this-=matrix;
+    return std::move(*this);
+}
+
+Matrix& Matrix::operator+=(const MatrixView& matrix)
+{
+    if(rows!=matrix.rows||cols!=matrix.cols) throw std::invalid_argument("Dimension mismatch");
+    for(int i=0;i<rows;++i)
     {
-        #pragma omp parallel for
-        for(int i=0;i<rows;i++) for(int k=0;k<cols;k++) for(int j=0;j<matrix.cols;j++)ans.data[i*matrix.cols+j]+=data[i*cols+k]*matrix.data[k*matrix.cols+j];
-        //ikj loop order for better cache performance because it stays constant for the inner loop
+        const real* src=matrix.row(i);
+        real* dst=data+(size_t)i*cols;
+        for(int j=0;j<cols;++j)dst[j]+=src[j];
     }
+    return *this;
+}
+
+Matrix& Matrix::operator-=(const MatrixView& matrix)
+{
+    if(rows!=matrix.rows||cols!=matrix.cols) throw std::invalid_argument("Dimension mismatch");
+    for(int i=0;i<rows;++i)
+    {
+        const real* src=matrix.row(i);
+        real* dst=data+(size_t)i*cols;
+        for(int j=0;j<cols;++j)dst[j]-=src[j];
+    }
+    return *this;
+}
+
+Matrix& Matrix::operator*=(real scalar)
+{
+    for(int i=0;i<rows*cols;++i)data[i]*=scalar;
+    return *this;
+}
+
+Matrix Matrix::operator*(const Matrix& matrix) const
+{
+    if(cols!=matrix.rows) throw std::invalid_argument("Dimension mismatch");;
+    Matrix ans(rows,matrix.cols,Uninitialized());
+    multiply(*this,matrix,false,false,1.0,0.0,ans);
     return ans;
 }
 
-Matrix Matrix::operator*(double scalar) const
+void Matrix::multiply(const MatrixView& A,const MatrixView& B,bool trans_a,bool trans_b,real alpha,real beta,Matrix& C)
 {
-    Matrix ans(rows,cols);
+    int k=trans_a?A.rows:A.cols;
+    long long vol=(long long)C.rows*(long long)k*(long long)C.cols;
+    //launch_gemm takes dense operands, strided views stay on the CPU gemm
+    if(vol>100000&&A.contiguous()&&B.contiguous())launch_gemm(A.data,B.data,C.data,C.rows,k,C.cols,trans_a,trans_b,alpha,beta);
+    else gemm(trans_a,trans_b,C.rows,C.cols,k,alpha,A.data,A.stride,B.data,B.stride,beta,C.data,C.cols);
+}
+
+Matrix Matrix::matmul(const MatrixView& A,const MatrixView& B,bool trans_a,bool trans_b)
+{
+    int m=trans_a?A.cols:A.rows,k=trans_a?A.rows:A.cols;
+    int n=trans_b?B.rows:B.cols;
+    if(k!=(trans_b?B.cols:B.rows)) throw std::invalid_argument("Dimension mismatch");
+    Matrix ans(m,n,Uninitialized());
+    multiply(A,B,trans_a,trans_b,1.0,0.0,ans);
+    return ans;
+}
+
+Matrix& Matrix::add_matmul(const MatrixView& A,const MatrixView& B,bool trans_a,bool trans_b,real alpha)
+{
+    int m=trans_a?A.cols:A.rows,k=trans_a?A.rows:A.cols;
+    int n=trans_b?B.rows:B.cols;
+    if(k!=(trans_b?B.cols:B.rows)||rows!=m||cols!=n) throw std::invalid_argument("Dimension mismatch");
+    multiply(A,B,trans_a,trans_b,alpha,1.0,*this);
+    return *this;
+}
+
+Matrix Matrix::operator*(real scalar) const&
+{
+    Matrix ans(rows,cols,Uninitialized());
     for(int i=0;i<rows*cols;++i)ans.data[i]=data[i]*scalar;
     return ans;
 }
 
+Matrix Matrix::operator*(real scalar) &&
+{
+    *this*=scalar;
+    return std::move(*this);
+}
+
 Matrix Matrix::identity(int size)
 {
     Matrix id(size,size);
@@ -132,16 +300,21 @@ Matrix Matrix::zeros(int r, int c)
     return Matrix(r,c);
 }
 
+Matrix Matrix::uninitialized(int r, int c)
+{
+    return Matrix(r,c,Uninitialized());
+}
+
 Matrix Matrix::ones(int r, int c)
 {
-    Matrix one(r,c);
+    Matrix one(r,c,Uninitialized());
     for(int i=0;i<r*c;++i)one.data[i]=1.0;
     return one;
 }
 
-Matrix Matrix::random(int r, int c, double min, double max)
+Matrix Matrix::random(int r, int c, real min, real max)
 {
-    Matrix matrix(r,c);
+    Matrix matrix(r,c,Uninitialized());
     for(int i=0;i<r*c;++i)
     {
         double f = (double)rand() / RAND_MAX;
@@ -150,16 +323,28 @@ Matrix Matrix::random(int r, int c, double min, double max)
     return matrix;
 }
 
-Matrix Matrix::apply(double (*function)(double)) const
+Matrix Matrix::apply(real (*function)(real)) const&
 {
-    Matrix result(rows,cols);
+    Matrix result(rows,cols,Uninitialized());
     for(int i=0;i<rows*cols;++i)result.data[i]=function(data[i]);
     return result;
 }
 
+Matrix Matrix::apply(real (*function)(real)) &&
+{
+    apply_inplace(function);
+    return std::move(*this);
+}
+
+Matrix& Matrix::apply_inplace(real (*function)(real))
+{
+    for(int i=0;i<rows*cols;++i)data[i]=function(data[i]);
+    return *this;
+}
+
 Matrix Matrix::sum_rows() const
 {
-    Matrix result(1,cols);
+    Matrix result(1,cols,Uninitialized());
     for(int j=0;j<cols;++j)
     {
         double sum=0.0;
@@ -169,10 +354,10 @@ Matrix Matrix::sum_rows() const
     return result;
 }
 
-Matrix Matrix::Hadamard(const Matrix& matrix) const
+Matrix Matrix::Hadamard(const Matrix& matrix) const&
 {
     if(rows!=matrix.rows||cols!=matrix.cols) throw std::invalid_argument("Dimension mismatch");
-    Matrix ans(rows,cols);
+    Matrix ans(rows,cols,Uninitialized());
     if(rows*cols>50000) launch_hadamard(this->data,matrix.data,ans.data,rows*cols);
     else
     {
@@ -182,22 +367,44 @@ Matrix Matrix::Hadamard(const Matrix& matrix) const
     return ans;
 }
 
+Matrix Matrix::Hadamard(const Matrix& matrix) &&
+{
+    if(rows!=matrix.rows||cols!=matrix.cols) throw std::invalid_argument("Dimension mismatch");
+    if(rows*cols>50000) launch_hadamard(this->data,matrix.data,this->data,rows*cols);
+    else
+    {
+        #pragma omp parallel for
+        for(int i=0;i<rows*cols;++i) data[i]*=matrix.data[i];
+    }
+    return std::move(*this);
+}
+
 Matrix Matrix::slice(int start,int end)
 {
     if(start<0||end>rows||start>=end) throw std::out_of_range("Slice indices out of range");
-    Matrix result(end-start,cols);
-    for(int i=start;i<end;++i) for(int j=0;j<cols;++j) result.data[(i-start)*cols+j]=data[i*cols+j];
+    Matrix result(end-start,cols,Uninitialized());
+    std::copy(data+(size_t)start*cols,data+(size_t)end*cols,result.data);
     return result;
 }
 
+MatrixView Matrix::view(int start,int end) const
+{
+    return MatrixView(*this).slice(start,end);
+}
+
+MatrixView Matrix::view() const
+{
+    return MatrixView(*this);
+}
+
 void Matrix::save(std::ofstream& file) const 
 {
     file.write((char*)&rows,sizeof(int));
     file.write((char*)&cols,sizeof(int));
-    file.write((char*)data,rows*cols*sizeof(double));
+    file.write((char*)data,rows*cols*sizeof(real));
 }
 
-void Matrix::load(std::ifstream& file) 
+void Matrix::load(std::ifstream& file, size_t scalar_bytes) 
 {
     int new_rows, new_cols;
     file.read((char*)&new_rows,sizeof(int));
@@ -206,13 +413,36 @@ void Matrix::load(std::ifstream& file)
     int new_size = new_rows*new_cols;
     int old_size = rows*cols;
 
-    if (new_size != old_size) 
+    if (!owned || new_size != old_size) 
     {
-        if (data != nullptr) delete[] data; 
-        data = new double[new_size]; 
+        if (owned) Allocator::deallocate(data);
+        data = allocate(new_size); 
+        owned = true;
     }
 
     rows = new_rows;
     cols = new_cols;
-    file.read((char*)data, new_size*sizeof(double));
+    read_scalars(file, data, new_size, scalar_bytes);
+}
+
+template<typename T>
+static void read_converted(std::ifstream& file, real* dst, size_t count)
+{
+    T buffer[1024];
+    while(count>0)
+    {
+        size_t n=std::min(count,(size_t)1024);
+        file.read((char*)buffer, n*sizeof(T));
+        for(size_t i=0;i<n;i++) dst[i]=(real)buffer[i];
+        dst+=n;
+        count-=n;
+    }
+}
+
+void Matrix::read_scalars(std::ifstream& file, real* dst, size_t count, size_t scalar_bytes)
+{
+    if(scalar_bytes!=sizeof(float)&&scalar_bytes!=sizeof(double)) throw std::invalid_argument("Scalar size must be 4 or 8 bytes");
+    if(scalar_bytes==sizeof(real)) file.read((char*)dst, count*sizeof(real));
+    else if(scalar_bytes==sizeof(double)) read_converted<double>(file, dst, count);
+    else read_converted<float>(file, dst, count);
 }
\ No newline at end of file
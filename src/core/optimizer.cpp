@@ -0,0 +1,106 @@
+#include "../../include/core/optimizer.h"
+#include <cmath>
+
+namespace
+{
+    //Elements stepped by one thread at a time
+    const size_t SLICE=16384;
+
+    void sgd(real* w,const real* g,size_t n,real lr)
+    {
+        #pragma omp simd
+        for(size_t i=0;i<n;i++) w[i]-=lr*g[i];
+    }
+
+    void momentum(real* w,const real* g,real* m,size_t n,real lr,real b1)
+    {
+        #pragma omp simd
+        for(size_t i=0;i<n;i++)
+        {
+            m[i]=b1*m[i]+g[i];
+            w[i]-=lr*m[i];
+        }
+    }
+
+    //c1 and c2 undo the bias of the moments towards zero, decay is lr*weight_decay for AdamW and 0 for Adam
+    void adam(real* w,const real* g,real* m,real* v,size_t n,real lr,real b1,real b2,real e,real c1,real c2,real decay)
+    {
+        #pragma omp simd
+        for(size_t i=0;i<n;i++)
+        {
+            m[i]=b1*m[i]+(1-b1)*g[i];
+            v[i]=b2*v[i]+(1-b2)*g[i]*g[i];
+            w[i]-=lr*(m[i]*c1)/(std::sqrt(v[i]*c2)+e)+decay*w[i];
+        }
+    }
+}
+
+std::vector<size_t> tensor_offsets(const std::vector<Parameter>& tensors)
+{
+    std::vector<size_t> offsets(1,0);
+    for(const Parameter& tensor:tensors) offsets.push_back(offsets.back()+tensor.size);
+    return offsets;
+}
+
+void Optimizer::step(const std::vector<Parameter>& tensors,double learning_rate)
+{
+    bool same=offsets.size()==tensors.size()+1;
+    for(size_t i=0;same&&i<tensors.size();i++) same=offsets[i+1]-offsets[i]==tensors[i].size;
+    if(!same)
+    {
+        reset();
+        offsets=tensor_offsets(tensors);
+        if(external)
+        {
+            std::fill(m,m+offsets.back(),0.0);
+            std::fill(v,v+offsets.back(),0.0);
+        }
+    }
+    size_t total=offsets.back();
+    if(total==0) return;
+    if(!external)
+    {
+        size_t moments=method==SGD?0:method==Momentum?1:2;
+        if(own.size()!=moments*total) own.assign(moments*total,0.0);
+        m=own.data();
+        v=own.data()+(moments>1?total:0);
+    }
+    t++;
+
+    real lr=learning_rate,b1_=b1,b2_=b2,e_=e;
+    real c1=1.0/(1.0-std::pow(b1,t)),c2=1.0/(1.0-std::pow(b2,t));
+    real decay=method==AdamW?learning_rate*weight_decay:0.0;
+    long long slices=(total+SLICE-1)/SLICE;
+    #pragma omp parallel for schedule(static) if(slices>1)
+    for(long long s=0;s<slices;s++)
+    {
+        for_tensor_range(offsets,s*SLICE,std::min<size_t>(total,(s+1)*SLICE),[&](size_t i,size_t begin,size_t end)
+        {
+            real* w=tensors[i].value+begin;
+            const real* g=tensors[i].grad+begin;
+            size_t n=end-begin,at=offsets[i]+begin;
+            switch(method)
+            {
+                case SGD: sgd(w,g,n,lr); break;
+                case Momentum: momentum(w,g,m+at,n,lr,b1_); break;
+                case Adam:
+                case AdamW: adam(w,g,m+at,v+at,n,lr,b1_,b2_,e_,c1,c2,decay); break;
+            }
+        });
+    }
+}
+
+void Optimizer::reset()
+{
+    offsets.clear();
+    own.clear();
+    t=0;
+}
+
+void Optimizer::use_state(real* m,real* v)
+{
+    external=m!=nullptr;
+    this->m=m;
+    this->v=v;
+    if(!external) reset();
+}
@@ -0,0 +1,412 @@
+#include "../../include/core/pool.h"
+#include "../../include/core/conv.h"
+#include "../../include/core/gemm.h"
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define POOL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define POOL_TARGET(isa)
+#else
+#define POOL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace
+{
+    bool is_2x2(const PoolShape& s)
+    {
+        return s.size==2&&s.stride==2&&s.pad==0&&s.dilation==1;
+    }
+
+    //Taps [first,last) of window n that fall inside a side of length size
+    void window_taps(const PoolShape& s,int n,int size,int& first,int& last)
+    {
+        inside_columns(n*s.stride-s.pad,s.dilation,size,s.size,first,last);
+    }
+
+#ifdef POOL_X86
+    /*
+    AVX2 rows of the 2x2 max with its indices. The compiler turns the select of the index into a branch, which
+    mispredicts on half the windows of real activations, and leaves rows narrower than a vector to scalar code;
+    here every window takes the same selects and the end of a row is done with masked loads and stores.
+    Even and odd columns are split with shuffles, and the order they leave the outputs in is undone with one permute.
+    */
+#ifdef ML_FLOAT32
+    const int LANES=8;
+
+    //Lanes [0,n) of a vector of 32-bit elements
+    POOL_TARGET("avx2")
+    __m256i head(int n)
+    {
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(n),_mm256_setr_epi32(0,1,2,3,4,5,6,7));
+    }
+
+    POOL_TARGET("avx2")
+    __m256i index_bits(__m256 greater)
+    {
+        return _mm256_and_si256(_mm256_castps_si256(greater),_mm256_set1_epi32(1));
+    }
+
+    //n<=LANES windows from 2n values of rows a and b
+    POOL_TARGET("avx2")
+    void max_2x2_avx2(const float* a,const float* b,float* o,uint8_t* x,int n)
+    {
+        __m256 a0,a1,b0,b1;
+        if(n==LANES)
+        {
+            a0=_mm256_loadu_ps(a); a1=_mm256_loadu_ps(a+8);
+            b0=_mm256_loadu_ps(b); b1=_mm256_loadu_ps(b+8);
+        }
+        else
+        {
+            __m256i m0=head(2*n),m1=head(2*n-8);
+            a0=_mm256_maskload_ps(a,m0); a1=_mm256_maskload_ps(a+8,m1);
+            b0=_mm256_maskload_ps(b,m0); b1=_mm256_maskload_ps(b+8,m1);
+        }
+        //windows 0,1,4,5,2,3,6,7
+        __m256 ae=_mm256_shuffle_ps(a0,a1,0x88),ao=_mm256_shuffle_ps(a0,a1,0xDD);
+        __m256 be=_mm256_shuffle_ps(b0,b1,0x88),bo=_mm256_shuffle_ps(b0,b1,0xDD);
+        __m256 top=_mm256_max_ps(ae,ao),bottom=_mm256_max_ps(be,bo);
+        __m256i k_top=index_bits(_mm256_cmp_ps(ao,ae,_CMP_GT_OQ));
+        __m256i k_bottom=_mm256_add_epi32(_mm256_set1_epi32(2),index_bits(_mm256_cmp_ps(bo,be,_CMP_GT_OQ)));
+        __m256i k=_mm256_blendv_epi8(k_top,k_bottom,_mm256_castps_si256(_mm256_cmp_ps(bottom,top,_CMP_GT_OQ)));
+        __m256 m=_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_max_ps(top,bottom)),0xD8));
+        //low byte of every index, four to each 128-bit half
+        const __m256i low=_mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+        k=_mm256_shuffle_epi8(_mm256_permute4x64_epi64(k,0xD8),low);
+        uint64_t bytes=(uint32_t)_mm256_cvtsi256_si32(k)|(uint64_t)(uint32_t)_mm256_extract_epi32(k,4)<<32;
+        if(n==LANES)
+        {
+            _mm256_storeu_ps(o,m);
+            std::memcpy(x,&bytes,LANES);
+            return;
+        }
+        _mm256_maskstore_ps(o,head(n),m);
+        for(int j=0;j<n;j++) x[j]=(uint8_t)(bytes>>8*j);
+    }
+
+    POOL_TARGET("avx2")
+    void unmax_2x2_avx2(const float* g,const uint8_t* x,float* a,float* b,int n)
+    {
+        __m256 v;
+        uint64_t bytes=0;
+        if(n==LANES)
+        {
+            v=_mm256_loadu_ps(g);
+            std::memcpy(&bytes,x,LANES);
+        }
+        else
+        {
+            v=_mm256_maskload_ps(g,head(n));
+            for(int j=0;j<n;j++) bytes|=(uint64_t)x[j]<<8*j;
+        }
+        __m256i k=_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(bytes));
+        __m256 p[4];
+        for(int t=0;t<4;t++) p[t]=_mm256_and_ps(v,_mm256_castsi256_ps(_mm256_cmpeq_epi32(k,_mm256_set1_epi32(t))));
+        //columns 2j and 2j+1 back together: interleaved within each 128-bit half, then the halves put in order
+        __m256 a_lo=_mm256_unpacklo_ps(p[0],p[1]),a_hi=_mm256_unpackhi_ps(p[0],p[1]);
+        __m256 b_lo=_mm256_unpacklo_ps(p[2],p[3]),b_hi=_mm256_unpackhi_ps(p[2],p[3]);
+        __m256 a0=_mm256_permute2f128_ps(a_lo,a_hi,0x20),a1=_mm256_permute2f128_ps(a_lo,a_hi,0x31);
+        __m256 b0=_mm256_permute2f128_ps(b_lo,b_hi,0x20),b1=_mm256_permute2f128_ps(b_lo,b_hi,0x31);
+        if(n==LANES)
+        {
+            _mm256_storeu_ps(a,a0); _mm256_storeu_ps(a+8,a1);
+            _mm256_storeu_ps(b,b0); _mm256_storeu_ps(b+8,b1);
+            return;
+        }
+        __m256i m0=head(2*n),m1=head(2*n-8);
+        _mm256_maskstore_ps(a,m0,a0); _mm256_maskstore_ps(a+8,m1,a1);
+        _mm256_maskstore_ps(b,m0,b0); _mm256_maskstore_ps(b+8,m1,b1);
+    }
+#else
+    const int LANES=4;
+
+    //Lanes [0,n) of a vector of 64-bit elements
+    POOL_TARGET("avx2")
+    __m256i head(int n)
+    {
+        return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n),_mm256_setr_epi64x(0,1,2,3));
+    }
+
+    POOL_TARGET("avx2")
+    __m256i index_bits(__m256d greater)
+    {
+        return _mm256_and_si256(_mm256_castpd_si256(greater),_mm256_set1_epi64x(1));
+    }
+
+    //n<=LANES windows from 2n values of rows a and b
+    POOL_TARGET("avx2")
+    void max_2x2_avx2(const double* a,const double* b,double* o,uint8_t* x,int n)
+    {
+        __m256d a0,a1,b0,b1;
+        if(n==LANES)
+        {
+            a0=_mm256_loadu_pd(a); a1=_mm256_loadu_pd(a+4);
+            b0=_mm256_loadu_pd(b); b1=_mm256_loadu_pd(b+4);
+        }
+        else
+        {
+            __m256i m0=head(2*n),m1=head(2*n-4);
+            a0=_mm256_maskload_pd(a,m0); a1=_mm256_maskload_pd(a+4,m1);
+            b0=_mm256_maskload_pd(b,m0); b1=_mm256_maskload_pd(b+4,m1);
+        }
+        //windows 0,2,1,3
+        __m256d ae=_mm256_unpacklo_pd(a0,a1),ao=_mm256_unpackhi_pd(a0,a1);
+        __m256d be=_mm256_unpacklo_pd(b0,b1),bo=_mm256_unpackhi_pd(b0,b1);
+        __m256d top=_mm256_max_pd(ae,ao),bottom=_mm256_max_pd(be,bo);
+        __m256i k_top=index_bits(_mm256_cmp_pd(ao,ae,_CMP_GT_OQ));
+        __m256i k_bottom=_mm256_add_epi64(_mm256_set1_epi64x(2),index_bits(_mm256_cmp_pd(bo,be,_CMP_GT_OQ)));
+        __m256i k=_mm256_blendv_epi8(k_top,k_bottom,_mm256_castpd_si256(_mm256_cmp_pd(bottom,top,_CMP_GT_OQ)));
+        __m256d m=_mm256_permute4x64_pd(_mm256_max_pd(top,bottom),0xD8);
+        //low byte of every index, two to each 128-bit half
+        const __m256i low=_mm256_setr_epi8(0,8,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,0,8,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+        k=_mm256_shuffle_epi8(_mm256_permute4x64_epi64(k,0xD8),low);
+        uint32_t bytes=((uint32_t)_mm256_cvtsi256_si32(k)&0xFFFF)|((uint32_t)_mm256_extract_epi32(k,4)&0xFFFF)<<16;
+        if(n==LANES)
+        {
+            _mm256_storeu_pd(o,m);
+            std::memcpy(x,&bytes,LANES);
+            return;
+        }
+        _mm256_maskstore_pd(o,head(n),m);
+        for(int j=0;j<n;j++) x[j]=(uint8_t)(bytes>>8*j);
+    }
+
+    POOL_TARGET("avx2")
+    void unmax_2x2_avx2(const double* g,const uint8_t* x,double* a,double* b,int n)
+    {
+        __m256d v;
+        uint32_t bytes=0;
+        if(n==LANES)
+        {
+            v=_mm256_loadu_pd(g);
+            std::memcpy(&bytes,x,LANES);
+        }
+        else
+        {
+            v=_mm256_maskload_pd(g,head(n));
+            for(int j=0;j<n;j++) bytes|=(uint32_t)x[j]<<8*j;
+        }
+        __m256i k=_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+        __m256d p[4];
+        for(int t=0;t<4;t++) p[t]=_mm256_and_pd(v,_mm256_castsi256_pd(_mm256_cmpeq_epi64(k,_mm256_set1_epi64x(t))));
+        //columns 2j and 2j+1 back together: interleaved within each 128-bit half, then the halves put in order
+        __m256d a_lo=_mm256_unpacklo_pd(p[0],p[1]),a_hi=_mm256_unpackhi_pd(p[0],p[1]);
+        __m256d b_lo=_mm256_unpacklo_pd(p[2],p[3]),b_hi=_mm256_unpackhi_pd(p[2],p[3]);
+        __m256d a0=_mm256_permute2f128_pd(a_lo,a_hi,0x20),a1=_mm256_permute2f128_pd(a_lo,a_hi,0x31);
+        __m256d b0=_mm256_permute2f128_pd(b_lo,b_hi,0x20),b1=_mm256_permute2f128_pd(b_lo,b_hi,0x31);
+        if(n==LANES)
+        {
+            _mm256_storeu_pd(a,a0); _mm256_storeu_pd(a+4,a1);
+            _mm256_storeu_pd(b,b0); _mm256_storeu_pd(b+4,b1);
+            return;
+        }
+        __m256i m0=head(2*n),m1=head(2*n-4);
+        _mm256_maskstore_pd(a,m0,a0); _mm256_maskstore_pd(a+4,m1,a1);
+        _mm256_maskstore_pd(b,m0,b0); _mm256_maskstore_pd(b+4,m1,b1);
+    }
+#endif
+#endif
+
+    /*
+    The AVX2 rows run whenever gemm runs an AVX2 or AVX-512 micro kernel (gemm.h), GEMM_ISA=generic turns both off.
+    Read once per plane; gemm_isa() is safe to call from the pooling threads.
+    */
+    bool avx2()
+    {
+        return std::strcmp(gemm_isa(),"generic")!=0;
+    }
+
+    //A row of ow windows of the 2x2 max through AVX2, false if it does not apply: indices wider than a byte never
+    //come from a 2x2 window
+    bool max_row_fast(bool fast,const real* a,const real* b,real* o,uint8_t* x,int ow)
+    {
+#ifdef POOL_X86
+        if(!fast) return false;
+        for(int j=0;j<ow;j+=LANES) max_2x2_avx2(a+2*j,b+2*j,o+j,x+j,std::min(LANES,ow-j));
+        return true;
+#else
+        return false;
+#endif
+    }
+    bool max_row_fast(bool,const real*,const real*,real*,uint16_t*,int) {return false;}
+
+    bool unmax_row_fast(bool fast,const real* g,const uint8_t* x,real* a,real* b,int ow)
+    {
+#ifdef POOL_X86
+        if(!fast) return false;
+        for(int j=0;j<ow;j+=LANES) unmax_2x2_avx2(g+j,x+j,a+2*j,b+2*j,std::min(LANES,ow-j));
+        return true;
+#else
+        return false;
+#endif
+    }
+    bool unmax_row_fast(bool,const real*,const uint16_t*,real*,real*,int) {return false;}
+
+    //Every window reads rows 2i,2i+1 and columns 2j,2j+1, the loops over j vectorize with strided loads
+    template<class Index> void forward_2x2(const PoolShape& s,const real* in,real* out,Index* argmax)
+    {
+        int oh=s.oh(),ow=s.ow(),w=s.w;
+        bool fast=argmax&&avx2();
+        for(int i=0;i<oh;i++)
+        {
+            const real* a=in+(size_t)2*i*w;
+            const real* b=a+w;
+            real* o=out+(size_t)i*ow;
+            if(s.mode==PoolMode::Average)
+            {
+                #pragma omp simd
+                for(int j=0;j<ow;j++) o[j]=(a[2*j]+a[2*j+1]+b[2*j]+b[2*j+1])*(real)0.25;
+            }
+            else if(!argmax)
+            {
+                #pragma omp simd
+                for(int j=0;j<ow;j++) o[j]=std::max(std::max(a[2*j],a[2*j+1]),std::max(b[2*j],b[2*j+1]));
+            }
+            else if(!max_row_fast(fast,a,b,o,argmax+(size_t)i*ow,ow))
+            {
+                Index* x=argmax+(size_t)i*ow;
+                //ties keep the first in row-major order, as in the general kernel
+                #pragma omp simd
+                for(int j=0;j<ow;j++)
+                {
+                    real top=std::max(a[2*j],a[2*j+1]),bottom=std::max(b[2*j],b[2*j+1]);
+                    int k_top=a[2*j+1]>a[2*j],k_bottom=2+(b[2*j+1]>b[2*j]);
+                    o[j]=std::max(top,bottom);
+                    x[j]=(Index)(bottom>top?k_bottom:k_top);
+                }
+            }
+        }
+    }
+
+    //Windows tile the plane, so every element is written once and only the odd row and column left over are zeroed
+    template<class Index> void backward_2x2(const PoolShape& s,const real* delta,const Index* argmax,real* prev)
+    {
+        int oh=s.oh(),ow=s.ow(),h=s.h,w=s.w;
+        bool fast=s.mode==PoolMode::Max&&avx2();
+        for(int i=0;i<oh;i++)
+        {
+            real* a=prev+(size_t)2*i*w;
+            real* b=a+w;
+            const real* g=delta+(size_t)i*ow;
+            if(s.mode==PoolMode::Average)
+            {
+                #pragma omp simd
+                for(int j=0;j<ow;j++)
+                {
+                    real v=g[j]*(real)0.25;
+                    a[2*j]=v; a[2*j+1]=v; b[2*j]=v; b[2*j+1]=v;
+                }
+            }
+            else if(!unmax_row_fast(fast,g,argmax+(size_t)i*ow,a,b,ow))
+            {
+                const Index* x=argmax+(size_t)i*ow;
+                #pragma omp simd
+                for(int j=0;j<ow;j++)
+                {
+                    real v=g[j];
+                    int k=x[j];
+                    a[2*j]=k==0?v:0; a[2*j+1]=k==1?v:0; b[2*j]=k==2?v:0; b[2*j+1]=k==3?v:0;
+                }
+            }
+            if(w&1) a[w-1]=b[w-1]=0;
+        }
+        std::fill(prev+(size_t)2*oh*w,prev+(size_t)h*w,(real)0);
+    }
+
+    template<class Index> void forward_general(const PoolShape& s,const real* in,real* out,Index* argmax)
+    {
+        int oh=s.oh(),ow=s.ow(),w=s.w;
+        for(int i=0;i<oh;i++)
+        {
+            int row_first,row_last;
+            window_taps(s,i,s.h,row_first,row_last);
+            for(int j=0;j<ow;j++)
+            {
+                int col_first,col_last;
+                window_taps(s,j,w,col_first,col_last);
+                int x0=j*s.stride-s.pad;
+                real max_=-std::numeric_limits<real>::max(),sum=0;
+                //from the first tap inside the input, so a window of NaN or -inf still points at one of its taps
+                int index=row_first*s.size+col_first;
+                if(row_first<row_last&&col_first<col_last) max_=in[(size_t)(i*s.stride-s.pad+row_first*s.dilation)*w+x0+col_first*s.dilation];
+                for(int p_i=row_first;p_i<row_last;p_i++)
+                {
+                    const real* row=in+(size_t)(i*s.stride-s.pad+p_i*s.dilation)*w+x0;
+                    for(int p_j=col_first;p_j<col_last;p_j++)
+                    {
+                        real v=row[p_j*s.dilation];
+                        sum+=v;
+                        if(v>max_)
+                        {
+                            max_=v;
+                            index=p_i*s.size+p_j;
+                        }
+                    }
+                }
+                if(s.mode==PoolMode::Max)
+                {
+                    out[i*ow+j]=max_;
+                    if(argmax) argmax[i*ow+j]=(Index)index;
+                }
+                else
+                {
+                    int taps=(row_last-row_first)*(col_last-col_first);
+                    out[i*ow+j]=taps?sum/taps:0;
+                }
+            }
+        }
+    }
+
+    //Windows may overlap or leave gaps: the plane is zeroed right before the scatter, while it is in cache
+    template<class Index> void backward_general(const PoolShape& s,const real* delta,const Index* argmax,real* prev)
+    {
+        int oh=s.oh(),ow=s.ow(),w=s.w;
+        std::fill(prev,prev+(size_t)s.h*w,(real)0);
+        for(int i=0;i<oh;i++)
+        {
+            int row_first,row_last;
+            window_taps(s,i,s.h,row_first,row_last);
+            for(int j=0;j<ow;j++)
+            {
+                int col_first,col_last;
+                window_taps(s,j,w,col_first,col_last);
+                if(row_first>=row_last||col_first>=col_last) continue;
+                real g=delta[i*ow+j];
+                real* at=prev+(size_t)(i*s.stride-s.pad)*w+j*s.stride-s.pad;
+                if(s.mode==PoolMode::Max)
+                {
+                    int p_i=argmax[i*ow+j]/s.size,p_j=argmax[i*ow+j]%s.size;
+                    if(p_i>=row_first&&p_i<row_last&&p_j>=col_first&&p_j<col_last) at[p_i*s.dilation*w+p_j*s.dilation]+=g;
+                    continue;
+                }
+                g/=(row_last-row_first)*(col_last-col_first);
+                for(int p_i=row_first;p_i<row_last;p_i++)
+                {
+                    for(int p_j=col_first;p_j<col_last;p_j++) at[p_i*s.dilation*w+p_j*s.dilation]+=g;
+                }
+            }
+        }
+    }
+
+    template<class Index> void forward(const PoolShape& s,const real* in,real* out,Index* argmax)
+    {
+        if(is_2x2(s)) forward_2x2(s,in,out,argmax);
+        else forward_general(s,in,out,argmax);
+    }
+
+    template<class Index> void backward(const PoolShape& s,const real* delta,const Index* argmax,real* prev)
+    {
+        if(is_2x2(s)) backward_2x2(s,delta,argmax,prev);
+        else backward_general(s,delta,argmax,prev);
+    }
+}
+
+void pool_forward(const PoolShape& shape,const real* in,real* out,uint8_t* argmax) {forward(shape,in,out,argmax);}
+void pool_forward(const PoolShape& shape,const real* in,real* out,uint16_t* argmax) {forward(shape,in,out,argmax);}
+void pool_backward(const PoolShape& shape,const real* delta,const uint8_t* argmax,real* prev) {backward(shape,delta,argmax,prev);}
+void pool_backward(const PoolShape& shape,const real* delta,const uint16_t* argmax,real* prev) {backward(shape,delta,argmax,prev);}
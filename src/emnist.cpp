@@ -0,0 +1,37 @@
+#include "../include/emnist.h"
+#include "../include/layers/dense.h"
+#include "../include/layers/softmax.h"
+#include "../include/layers/conv2d.h"
+#include "../include/layers/pooling.h"
+#include "../include/layers/batchnorm.h"
+#include "../include/layers/dropout.h"
+#include "../include/activation.h"
+#include "../include/core/utils.h"
+
+void build_emnist(Network& nn,int classes)
+{
+    nn.add(new Conv2D(28,28,1,32,3));
+    nn.add(new BatchNorm(26*26*32));
+    nn.add(new Activation(leaky_relu,dleaky_relu));
+    nn.add(new Pooling(26,26,32,2,2));
+
+    nn.add(new Conv2D(13,13,32,64,3));
+    nn.add(new BatchNorm(11*11*64));
+    nn.add(new Activation(leaky_relu,dleaky_relu));
+    nn.add(new Pooling(11,11,64,2,2));
+
+    nn.add(new Dense(1600, 512));
+    nn.add(new BatchNorm(512));
+    nn.add(new Activation(leaky_relu, dleaky_relu));
+
+    nn.add(new Dropout(0.5));
+
+    nn.add(new Dense(512, 128));
+    nn.add(new BatchNorm(128));
+    nn.add(new Activation(leaky_relu, dleaky_relu));
+
+    nn.add(new Dropout(0.25));
+
+    nn.add(new Dense(128, classes));
+    nn.add(new Softmax());
+}
@@ -0,0 +1,129 @@
+#include "../../include/io/batch_loader.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+BatchLoader::BatchLoader(const MatrixView& X,const MatrixView& y,int batch_size,bool shuffle,unsigned seed):X(X),y(y),rows(X.rows),batch_size(batch_size),shuffle(shuffle),rng(seed)
+{
+    if(X.rows!=y.rows) throw std::invalid_argument("X and y must have the same number of rows");
+    setup(X.cols,y.cols);
+}
+
+BatchLoader::BatchLoader(const Dataset& data,int batch_size,bool shuffle,unsigned seed):data(&data),rows(data.rows()),batch_size(batch_size),shuffle(shuffle),rng(seed)
+{
+    setup(data.x_cols(),data.y_cols());
+}
+
+void BatchLoader::setup(int x_cols,int y_cols)
+{
+    if(batch_size<=0||batch_size>rows) batch_size=rows;
+    num_batches=batch_size>0?(rows+batch_size-1)/batch_size:0;
+    next_take=next_fill=num_batches;
+    //a single batch is the whole set whatever the order
+    if(num_batches<=1) shuffle=false;
+    views=!shuffle&&!data;
+    if(views||num_batches==0) return;
+
+    indices.resize(rows);
+    std::iota(indices.begin(),indices.end(),0);
+    for(int i=0;i<2;i++)
+    {
+        X_buf[i]=Matrix::uninitialized(batch_size,x_cols);
+        y_buf[i]=Matrix::uninitialized(batch_size,y_cols);
+    }
+    worker=std::thread(&BatchLoader::run,this);
+}
+
+BatchLoader::~BatchLoader()
+{
+    if(!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop=true;
+    }
+    changed.notify_all();
+    worker.join();
+}
+
+void BatchLoader::start_epoch()
+{
+    if(views||num_batches==0)
+    {
+        next_take=0;
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    //an abandoned epoch may still have a batch being gathered from the old order
+    changed.wait(guard,[&]{return !gathering;});
+    if(shuffle) std::shuffle(indices.begin(),indices.end(),rng);
+    filled[0]=filled[1]=false;
+    taken=-1;
+    next_take=next_fill=0;
+    changed.notify_all();
+}
+
+bool BatchLoader::next(MatrixView& X_batch,MatrixView& y_batch)
+{
+    if(views||num_batches==0)
+    {
+        if(next_take>=num_batches) return false;
+        int start=next_take*batch_size,end=std::min(start+batch_size,X.rows);
+        X_batch=X.slice(start,end);
+        y_batch=y.slice(start,end);
+        next_take++;
+        return true;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    if(taken>=0)
+    {
+        filled[taken]=false;
+        taken=-1;
+        changed.notify_all();
+    }
+    if(next_take>=num_batches) return false;
+    int slot=next_take%2;
+    changed.wait(guard,[&]{return filled[slot];});
+    taken=slot;
+    int count=std::min(batch_size,rows-next_take*batch_size);
+    X_batch=X_buf[slot].view(0,count);
+    y_batch=y_buf[slot].view(0,count);
+    next_take++;
+    return true;
+}
+
+void BatchLoader::gather(int batch,int slot)
+{
+    int start=batch*batch_size,count=std::min(batch_size,rows-start);
+    if(data)
+    {
+        data->gather(&indices[start],count,&X_buf[slot](0,0),&y_buf[slot](0,0));
+        return;
+    }
+    for(int r=0;r<count;r++)
+    {
+        int idx=indices[start+r];
+        std::memcpy(&X_buf[slot](r,0),X.row(idx),X.cols*sizeof(real));
+        std::memcpy(&y_buf[slot](r,0),y.row(idx),y.cols*sizeof(real));
+    }
+}
+
+void BatchLoader::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while(true)
+    {
+        changed.wait(guard,[&]{return stop||(next_fill<num_batches&&!filled[next_fill%2]);});
+        if(stop) return;
+        int batch=next_fill,slot=batch%2;
+        gathering=true;
+        guard.unlock();
+        gather(batch,slot);
+        guard.lock();
+        gathering=false;
+        filled[slot]=true;
+        next_fill++;
+        changed.notify_all();
+    }
+}
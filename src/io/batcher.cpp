@@ -0,0 +1,134 @@
+#include "../../include/io/batcher.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <stdexcept>
+
+const int HISTOGRAM_BUCKETS=65;
+
+struct Batcher::Request
+{
+    MatrixView input;
+    clock::time_point arrived;
+    std::promise<Matrix> result;
+};
+
+Batcher::Batcher(Predict predict,const BatcherOptions& options):predict(predict),options(options)
+{
+    if(this->options.max_batch<1) this->options.max_batch=1;
+    counters.batch_rows.assign(std::min(this->options.max_batch,HISTOGRAM_BUCKETS-1)+1,0);
+    counters.queue_depth.assign(HISTOGRAM_BUCKETS,0);
+    dispatcher=std::thread(&Batcher::run,this);
+}
+
+Batcher::~Batcher()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop=true;
+    }
+    changed.notify_all();
+    dispatcher.join();
+}
+
+Matrix Batcher::submit(const MatrixView& input)
+{
+    Request request;
+    request.input=input;
+    std::future<Matrix> result=request.result.get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(stop) throw std::runtime_error("Batcher is shutting down");
+        request.arrived=clock::now();
+        counters.queue_depth[std::min((int)queue.size(),HISTOGRAM_BUCKETS-1)]++;
+        queue.push_back(&request);
+        queued_rows+=input.rows;
+    }
+    changed.notify_all();
+    return result.get();
+}
+
+BatcherStats Batcher::stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
+
+void Batcher::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while(true)
+    {
+        changed.wait(guard,[&]{return stop||!queue.empty();});
+        if(queue.empty()) return;
+
+        long long wait_us=options.max_wait_us;
+        if(options.latency_target_us>0) wait_us=std::min(wait_us,(long long)(options.latency_target_us-expected_us));
+        auto deadline=queue.front()->arrived+std::chrono::microseconds(std::max(wait_us,0LL));
+        changed.wait_until(guard,deadline,[&]{return stop||queued_rows>=options.max_batch;});
+
+        //oldest first up to max_batch rows, a request larger than that goes alone
+        std::vector<Request*> batch;
+        int rows=0;
+        while(!queue.empty()&&(batch.empty()||rows+queue.front()->input.rows<=options.max_batch))
+        {
+            batch.push_back(queue.front());
+            rows+=queue.front()->input.rows;
+            queue.pop_front();
+        }
+        queued_rows-=rows;
+
+        auto started=clock::now();
+        for(Request* r:batch) counters.wait_ms+=std::chrono::duration<double,std::milli>(started-r->arrived).count();
+        guard.unlock();
+        execute(batch);
+        double elapsed_us=std::chrono::duration<double,std::micro>(clock::now()-started).count();
+        guard.lock();
+
+        expected_us=counters.batches==0?elapsed_us:0.9*expected_us+0.1*elapsed_us;
+        counters.requests+=batch.size();
+        counters.batches++;
+        counters.rows+=rows;
+        counters.predict_ms+=elapsed_us/1000.0;
+        counters.batch_rows[std::min(rows,(int)counters.batch_rows.size()-1)]++;
+    }
+}
+
+void Batcher::execute(std::vector<Request*>& batch)
+{
+    try
+    {
+        if(batch.size()==1)
+        {
+            batch[0]->result.set_value(predict(batch[0]->input));
+            return;
+        }
+        int rows=0,cols=batch[0]->input.cols;
+        for(Request* r:batch)
+        {
+            if(r->input.cols!=cols) throw std::invalid_argument("Requests in a batch must have the same number of columns");
+            rows+=r->input.rows;
+        }
+        Matrix input=Matrix::uninitialized(rows,cols);
+        int row=0;
+        for(Request* r:batch) for(int i=0;i<r->input.rows;i++,row++) std::memcpy(&input(row,0),r->input.row(i),cols*sizeof(real));
+
+        Matrix output=predict(input);
+        row=0;
+        for(Request* r:batch)
+        {
+            r->result.set_value(Matrix(output.view(row,row+r->input.rows)));
+            row+=r->input.rows;
+        }
+    }
+    catch(...)
+    {
+        //callers whose result is not set yet get the exception
+        for(Request* r:batch)
+        {
+            try {r->result.set_exception(std::current_exception());}
+            catch(const std::future_error&) {}
+        }
+    }
+}
@@ -1,8 +1,11 @@
 #include "../include/io/data.h"
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
 
 uint32_t swap_endian(uint32_t val)
 {
@@ -10,64 +13,111 @@ uint32_t swap_endian(uint32_t val)
     return (val<<16)|(val>>16);
 }
 
-Matrix DataLoader::load_images(const std::string& filepath)
+namespace
 {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open " << filepath << std::endl;
-        exit(1);
+    //count bytes into values in [0,1], vectorized
+    void scale_pixels(const uint8_t* src,real* dst,int count)
+    {
+        #pragma omp simd
+        for(int i=0;i<count;i++) dst[i]=(real)(src[i]/255.0);
+    }
+
+    int max_label(const IdxFile& labels)
+    {
+        const uint8_t* begin=labels.item(0);
+        const uint8_t* end=begin+(size_t)labels.count()*labels.item_size();
+        return begin==end?-1:*std::max_element(begin,end);
     }
 
-    uint32_t magic=0,n_images=0,rows=0,cols=0;
-    file.read((char*)&magic, sizeof(magic));
-    file.read((char*)&n_images, sizeof(n_images));
-    file.read((char*)&rows, sizeof(rows));
-    file.read((char*)&cols, sizeof(cols));
+    void check_label(int label,int classes)
+    {
+        if(label>=classes) throw std::out_of_range("Label "+std::to_string(label)+" is outside of the "+std::to_string(classes)+" classes");
+    }
 
-    magic=swap_endian(magic);
-    n_images=swap_endian(n_images);
-    rows=swap_endian(rows);
-    cols=swap_endian(cols);
-    std::cout << "Loading " << n_images << " images (" << rows << "x" << cols << ")" << std::endl;
+    void one_hot(const IdxFile& labels,int index,int classes,real* row)
+    {
+        int label=*labels.item(index);
+        check_label(label,classes);
+        std::fill(row,row+classes,0.0);
+        row[label]=1.0;
+    }
+}
 
-    Matrix X(n_images, rows*cols);
-    for(int i=0;i<n_images;i++)
+IdxFile::IdxFile(const std::string& path):file(path)
+{
+    const uint8_t* bytes=(const uint8_t*)file.data();
+    //magic: two zero bytes, the element type (0x08 is unsigned byte) and the number of dimensions
+    if(file.size()<4||bytes[0]!=0||bytes[1]!=0) throw std::runtime_error(path+" is not an IDX file");
+    if(bytes[2]!=0x08) throw std::runtime_error(path+" does not hold unsigned bytes");
+    int ndims=bytes[3];
+    size_t header=4+4*(size_t)ndims;
+    if(ndims==0||file.size()<header) throw std::runtime_error(path+" has a truncated IDX header");
+    for(int i=0;i<ndims;i++)
     {
-        for(int j=0;j<rows;j++)
-        {
-            for(int k=0;k<cols;k++)
-            {
-                unsigned char pixel=0;
-                file.read((char*)&pixel, sizeof(pixel));
-                X(i, j*cols + k) = (double)pixel / 255.0;
-            }
-        }
+        uint32_t dim;
+        std::memcpy(&dim,bytes+4+4*i,sizeof(dim));
+        dims.push_back((int)swap_endian(dim));
+        if(i>0) size*=dims.back();
     }
-    file.close();
-    return X;
+    if(file.size()-header<(size_t)dims[0]*size) throw std::runtime_error(path+" is shorter than its IDX header says");
+    data=bytes+header;
 }
 
-Matrix DataLoader::load_labels(const std::string& filepath)
+IdxDataset::IdxDataset(const std::string& images,const std::string& labels,int classes):images(images),labels(labels),classes(classes)
 {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open " << filepath << std::endl;
+    if(this->images.count()!=this->labels.count()) throw std::runtime_error(images+" and "+labels+" hold a different number of items");
+    if(this->labels.item_size()!=1) throw std::runtime_error(labels+" is not a label file");
+    //checked here on the caller's thread, gather may run on the loader's background thread
+    int largest=max_label(this->labels);
+    if(this->classes<=0) this->classes=largest+1;
+    else check_label(largest,this->classes);
+}
+
+void IdxDataset::gather(const int* indices,int count,real* X,real* y) const
+{
+    int cols=images.item_size();
+    for(int r=0;r<count;r++)
+    {
+        scale_pixels(images.item(indices[r]),X+(size_t)r*cols,cols);
+        one_hot(labels,indices[r],classes,y+(size_t)r*classes);
+    }
+}
+
+Matrix DataLoader::load_images(const std::string& filepath)
+{
+    try
+    {
+        IdxFile file(filepath);
+        int n_images=file.count(),cols=file.item_size();
+        if(file.shape().size()==3) std::cout << "Loading " << n_images << " images (" << file.shape()[1] << "x" << file.shape()[2] << ")" << std::endl;
+        else std::cout << "Loading " << n_images << " images" << std::endl;
+        Matrix X=Matrix::uninitialized(n_images,cols);
+        #pragma omp parallel for
+        for(int i=0;i<n_images;i++) scale_pixels(file.item(i),&X(i,0),cols);
+        return X;
+    }
+    catch(const std::runtime_error& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
         exit(1);
     }
-    uint32_t magic=0, n_labels=0;
-    file.read((char*)&magic, sizeof(magic));
-    file.read((char*)&n_labels, sizeof(n_labels));
-    magic = ((magic << 8) & 0xFF00FF00) | ((magic >> 8) & 0xFF00FF);
-    magic = (magic << 16) | (magic >> 16);
-    n_labels = ((n_labels << 8) & 0xFF00FF00) | ((n_labels >> 8) & 0xFF00FF);
-    n_labels = (n_labels << 16) | (n_labels >> 16);
-    std::cout << "Loading " << n_labels << " labels..." << std::endl;
-    Matrix Y = Matrix::zeros(n_labels, 47);
-    for(int i=0; i<n_labels; i++) 
+}
+
+Matrix DataLoader::load_labels(const std::string& filepath,int classes)
+{
+    try
     {
-        unsigned char label = 0;
-        file.read((char*)&label, sizeof(label));
-        if(label < 47) Y(i, (int)label) = 1.0;
+        IdxFile file(filepath);
+        int n_labels=file.count();
+        std::cout << "Loading " << n_labels << " labels..." << std::endl;
+        if(classes<=0) classes=max_label(file)+1;
+        Matrix Y=Matrix::uninitialized(n_labels,classes);
+        for(int i=0;i<n_labels;i++) one_hot(file,i,classes,&Y(i,0));
+        return Y;
     }
-    return Y;
-}
\ No newline at end of file
+    catch(const std::runtime_error& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        exit(1);
+    }
+}
@@ -1,52 +1,358 @@
 #include "../include/io/data_frame.h"
-#include <fstream>
-#include <sstream>
+#include "../include/io/mapped_file.h"
 #include <iostream>
 #include <algorithm>
-#include <map>
+#include <unordered_map>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <stdexcept>
+#include <omp.h>
+
+typedef DataFrame::Chunk Chunk;
+typedef DataFrame::ColumnType ColumnType;
+
+namespace
+{
+    const size_t MIN_CHUNK_BYTES=1<<20;
+
+    //Calls f(begin,end) for every non-blank line, without its \n or \r\n
+    template<class F> void for_each_line(const char* begin,const char* end,F f)
+    {
+        while(begin<end)
+        {
+            const char* stop=(const char*)std::memchr(begin,'\n',end-begin);
+            if(!stop) stop=end;
+            const char* line_end=stop;
+            if(line_end>begin&&line_end[-1]=='\r') line_end--;
+            if(line_end>begin) f(begin,line_end);
+            begin=stop+1;
+        }
+    }
+
+    //Calls f(column,begin,end) for the first cols cells of the line, missing cells are empty
+    template<class F> void for_each_cell(const char* begin,const char* end,char delimiter,int cols,F f)
+    {
+        for(int c=0;c<cols;c++)
+        {
+            if(begin>end)
+            {
+                f(c,end,end);
+                continue;
+            }
+            const char* stop=(const char*)std::memchr(begin,delimiter,end-begin);
+            if(!stop) stop=end;
+            f(c,begin,stop);
+            begin=stop+1;
+        }
+    }
+
+    void trim(const char*& begin,const char*& end)
+    {
+        while(begin<end&&(*begin==' '||*begin=='\t'||*begin=='\r')) begin++;
+        while(end>begin&&(end[-1]==' '||end[-1]=='\t'||end[-1]=='\r')) end--;
+        if(end-begin>=2&&*begin=='"'&&end[-1]=='"') {begin++; end--;}
+    }
+
+    //Whole cell as a number, an empty cell is 0
+    bool parse_number(const char* begin,const char* end,double& value)
+    {
+        trim(begin,end);
+        if(begin==end)
+        {
+            value=0.0;
+            return true;
+        }
+        if(*begin=='+') begin++;
+        std::from_chars_result result=std::from_chars(begin,end,value);
+        if(result.ptr!=end) return false;
+        //Beyond the range of a double, std::strtod rounds to 0 or infinity instead
+        if(result.ec==std::errc::result_out_of_range) value=std::strtod(std::string(begin,end).c_str(),nullptr);
+        return true;
+    }
+
+    //Whole cell as a 64-bit integer, an empty cell is 0
+    bool parse_integer(const char* begin,const char* end,int64_t& value)
+    {
+        trim(begin,end);
+        if(begin==end)
+        {
+            value=0;
+            return true;
+        }
+        if(*begin=='+') begin++;
+        std::from_chars_result result=std::from_chars(begin,end,value);
+        return result.ec==std::errc()&&result.ptr==end;
+    }
+
+    //Integer columns are parsed into the 8-byte slots of doubles until a cell turns out not to be one
+    int64_t slot_integer(double slot)
+    {
+        int64_t value;
+        std::memcpy(&value,&slot,sizeof(value));
+        return value;
+    }
+
+    double integer_slot(int64_t value)
+    {
+        double slot;
+        std::memcpy(&slot,&value,sizeof(slot));
+        return slot;
+    }
+
+    //Parsed doubles become the values of a Float64 column, without a copy when real is double
+    template<class T> void take_values(std::vector<double>& from,std::vector<T>& to)
+    {
+        if constexpr(std::is_same<T,double>::value) to.swap(from);
+        else
+        {
+            to.assign(from.begin(),from.end());
+            std::vector<double>().swap(from);
+        }
+    }
+
+    //Codes of the values in order of first appearance. NaN never compares equal to itself, so the map would give
+    //every one a code of its own; they share one instead
+    template<class T> void encode_first_seen(const T* values,int rows,Matrix& result)
+    {
+        std::unordered_map<T,int> codes;
+        int nan=-1;
+        for(int i=0;i<rows;i++)
+        {
+            int next=codes.size()+(nan>=0);
+            bool is_nan=false;
+            if constexpr(std::is_floating_point<T>::value) is_nan=std::isnan(values[i]);
+            if(!is_nan) result(i,0)=codes.emplace(values[i],next).first->second;
+            else
+            {
+                if(nan<0) nan=next;
+                result(i,0)=nan;
+            }
+        }
+    }
+
+    std::string cell_text(const char* begin,const char* end)
+    {
+        trim(begin,end);
+        std::string text(begin,end);
+        text.erase(std::remove(text.begin(),text.end(),'"'),text.end());
+        return text;
+    }
+
+    //Splits [begin,end) into pieces of at least MIN_CHUNK_BYTES, a few per thread, each ending after a newline
+    std::vector<Chunk> split_lines(const char* begin,const char* end)
+    {
+        size_t pieces=std::max<size_t>(1,std::min<size_t>(4*omp_get_max_threads(),(end-begin)/MIN_CHUNK_BYTES));
+        size_t step=(end-begin)/pieces+1;
+        std::vector<Chunk> chunks;
+        while(begin<end)
+        {
+            const char* stop=begin+std::min<size_t>(step,end-begin);
+            if(stop<end)
+            {
+                const char* newline=(const char*)std::memchr(stop,'\n',end-stop);
+                stop=newline?newline+1:end;
+            }
+            chunks.push_back({begin,stop});
+            begin=stop;
+        }
+        return chunks;
+    }
+}
 
 DataFrame::DataFrame() : rows(0), cols(0) {}
 
 void DataFrame::read_csv(const std::string& filename, bool has_header, char delimiter)
 {
-    std::ifstream file(filename);
-    if (!file.is_open())  throw std::runtime_error("Could not open file: " + filename);
-    
-    std::string line;
+    MappedFile file(filename);
+    const char* begin=file.data();
+    const char* end=begin+file.size();
+
     rows=0;
+    cols=0;
     data.clear();
     column_names.clear();
-    if(has_header && std::getline(file, line))
+
+    //The header, or the first line when there is none, fixes the number of columns
+    const char* first=begin;
+    while(first<end&&(*first=='\n'||*first=='\r')) first++;
+    const char* first_end=first<end?(const char*)std::memchr(first,'\n',end-first):end;
+    if(!first_end) first_end=end;
+    const char* line_end=first_end>first&&first_end[-1]=='\r'?first_end-1:first_end;
+    for(const char* cell=first;first<end&&cell<=line_end;)
+    {
+        const char* stop=(const char*)std::memchr(cell,delimiter,line_end-cell);
+        if(!stop) stop=line_end;
+        if(has_header) column_names.push_back(cell_text(cell,stop));
+        cols++;
+        cell=stop+1;
+    }
+    if(has_header) begin=first_end<end?first_end+1:end;
+
+    //Pass 1 counts the rows of every chunk, which gives each chunk the index of its first row
+    std::vector<Chunk> chunks=split_lines(begin,end);
+    int n_chunks=chunks.size();
+    #pragma omp parallel for schedule(dynamic)
+    for(int i=0;i<n_chunks;i++) for_each_line(chunks[i].begin,chunks[i].end,[&](const char*,const char*){chunks[i].rows++;});
+    for(int i=0;i<n_chunks;i++)
+    {
+        chunks[i].first_row=rows;
+        rows+=chunks[i].rows;
+    }
+
+    /*
+    Pass 2 parses every cell straight into its column, as an integer for as long as the column of the chunk holds
+    integers only, then as a double. Each chunk tracks the narrowest type of each column it has seen so far.
+    */
+    std::vector<std::vector<double>> slots(cols,std::vector<double>(rows));
+    std::vector<ColumnType> types((size_t)n_chunks*cols,ColumnType::Int64);
+    #pragma omp parallel for schedule(dynamic)
+    for(int i=0;i<n_chunks;i++)
     {
-        std::stringstream ss(line);
-        std::string col_name;
-        while (std::getline(ss, col_name, delimiter)) 
+        ColumnType* type=&types[(size_t)i*cols];
+        int row=chunks[i].first_row;
+        for_each_line(chunks[i].begin,chunks[i].end,[&](const char* line,const char* line_end)
         {
-            col_name.erase(std::remove(col_name.begin(), col_name.end(), '\r'), col_name.end());
-            col_name.erase(std::remove(col_name.begin(), col_name.end(), '\"'), col_name.end());
-            column_names.push_back(col_name);
-        }
-        cols=column_names.size();
+            for_each_cell(line,line_end,delimiter,cols,[&](int c,const char* cell,const char* cell_end)
+            {
+                if(type[c]==ColumnType::Categorical) return;
+                double& slot=slots[c][row];
+                if(type[c]==ColumnType::Int64)
+                {
+                    int64_t value;
+                    if(parse_integer(cell,cell_end,value))
+                    {
+                        slot=integer_slot(value);
+                        return;
+                    }
+                    for(int r=chunks[i].first_row;r<row;r++) slots[c][r]=(double)slot_integer(slots[c][r]);
+                    type[c]=ColumnType::Float64;
+                }
+                if(!parse_number(cell,cell_end,slot)) type[c]=ColumnType::Categorical;
+            });
+            row++;
+        });
     }
 
-    while(std::getline(file, line))
+    //A column takes the widest type any chunk found, Categorical over Float64 over Int64
+    data.resize(cols);
+    std::vector<int> text_columns;
+    for(int c=0;c<cols;c++)
     {
-        std::stringstream ss(line);
-        std::string cell;
-        std::vector<std::string> row;
-        while (std::getline(ss, cell, delimiter)) 
+        Column& column=data[c];
+        for(int i=0;i<n_chunks;i++) column.type=std::max(column.type,types[(size_t)i*cols+c]);
+        if(column.type==ColumnType::Int64)
+        {
+            column.integers.resize(rows);
+            if(rows>0) std::memcpy(column.integers.data(),slots[c].data(),rows*sizeof(int64_t));
+        }
+        else if(column.type==ColumnType::Float64)
         {
-            cell.erase(std::remove(cell.begin(), cell.end(), '\r'), cell.end());
-            cell.erase(std::remove(cell.begin(), cell.end(), '\"'), cell.end());
-            row.push_back(cell);
+            for(int i=0;i<n_chunks;i++)
+            {
+                if(types[(size_t)i*cols+c]!=ColumnType::Int64) continue;
+                for(int r=chunks[i].first_row;r<chunks[i].first_row+chunks[i].rows;r++) slots[c][r]=(double)slot_integer(slots[c][r]);
+            }
+            take_values(slots[c],column.values);
+        }
+        else
+        {
+            column.codes.resize(rows);
+            text_columns.push_back(c);
         }
-        if(cols==0) cols=row.size();
-        data.push_back(row);
-        rows++;
+        std::vector<double>().swap(slots[c]);
     }
+    if(!text_columns.empty()) encode_text(chunks,text_columns,delimiter);
     std::cout << "Loaded " << rows << " rows, " << cols << " columns." << std::endl;
 }
 
+void DataFrame::encode_text(const std::vector<Chunk>& chunks, const std::vector<int>& text_columns, char delimiter)
+{
+    //Pass 3 dictionary-encodes the text columns, each chunk against dictionaries of its own
+    int n_chunks=chunks.size();
+    int n_text=text_columns.size();
+    std::vector<int> slot(cols,-1);
+    for(int t=0;t<n_text;t++) slot[text_columns[t]]=t;
+    std::vector<std::vector<std::string_view>> local((size_t)n_chunks*n_text);
+    #pragma omp parallel for schedule(dynamic)
+    for(int i=0;i<n_chunks;i++)
+    {
+        std::vector<std::unordered_map<std::string_view,int32_t>> lookup(n_text);
+        int row=chunks[i].first_row;
+        for_each_line(chunks[i].begin,chunks[i].end,[&](const char* line,const char* line_end)
+        {
+            for_each_cell(line,line_end,delimiter,cols,[&](int c,const char* cell,const char* cell_end)
+            {
+                int t=slot[c];
+                if(t<0) return;
+                trim(cell,cell_end);
+                std::vector<std::string_view>& dictionary=local[(size_t)i*n_text+t];
+                auto it=lookup[t].emplace(std::string_view(cell,cell_end-cell),(int32_t)dictionary.size()).first;
+                if(it->second==(int32_t)dictionary.size()) dictionary.push_back(it->first);
+                data[c].codes[row]=it->second;
+            });
+            row++;
+        });
+    }
+
+    //Merging the chunk dictionaries in file order numbers the categories in order of first appearance
+    for(int t=0;t<n_text;t++)
+    {
+        Column& column=data[text_columns[t]];
+        std::unordered_map<std::string,int32_t> global;
+        std::vector<std::vector<int32_t>> remap(n_chunks);
+        for(int i=0;i<n_chunks;i++)
+        {
+            for(std::string_view raw:local[(size_t)i*n_text+t])
+            {
+                auto it=global.emplace(cell_text(raw.data(),raw.data()+raw.size()),(int32_t)column.categories.size()).first;
+                if(it->second==(int32_t)column.categories.size()) column.categories.push_back(it->first);
+                remap[i].push_back(it->second);
+            }
+        }
+        #pragma omp parallel for schedule(dynamic)
+        for(int i=0;i<n_chunks;i++)
+            for(int r=chunks[i].first_row;r<chunks[i].first_row+chunks[i].rows;r++) column.codes[r]=remap[i][column.codes[r]];
+        for(const std::string& category:column.categories)
+        {
+            double value;
+            column.category_values.push_back(parse_number(category.data(),category.data()+category.size(),value)?(real)value:0);
+        }
+    }
+}
+
+void DataFrame::project(int column, int begin, int end, real* dst, int stride) const
+{
+    const Column& c=data[column];
+    switch(c.type)
+    {
+        case ColumnType::Float64:
+            for(int i=begin;i<end;i++,dst+=stride) *dst=c.values[i];
+            break;
+        case ColumnType::Int64:
+            for(int i=begin;i<end;i++,dst+=stride) *dst=(real)c.integers[i];
+            break;
+        case ColumnType::Categorical:
+            for(int i=begin;i<end;i++,dst+=stride) *dst=c.category_values[c.codes[i]];
+            break;
+    }
+}
+
+Matrix DataFrame::gather(const std::vector<int>& indices) const
+{
+    int n=indices.size();
+    Matrix result=Matrix::uninitialized(rows, n);
+    //Blocks of rows keep the strided writes of every column in cache while the columns are read contiguously
+    const int BLOCK=64;
+    #pragma omp parallel for if(rows>4096)
+    for(int b=0;b<rows;b+=BLOCK)
+        for(int j=0;j<n;j++) project(indices[j], b, std::min(rows,b+BLOCK), &result(b,j), n);
+    return result;
+}
+
 void DataFrame::head(int n) const
 {
     n = std::min(n, rows);
@@ -57,7 +363,12 @@ void DataFrame::head(int n) const
     }
     for(int i=0;i<n;i++)
     {
-        for(int j=0;j<cols;j++) std::cout << data[i][j] << "\t";
+        for(const Column& column : data)
+        {
+            if(column.type==ColumnType::Float64) std::cout << column.values[i] << "\t";
+            else if(column.type==ColumnType::Int64) std::cout << column.integers[i] << "\t";
+            else std::cout << column.categories[column.codes[i]] << "\t";
+        }
         std::cout << std::endl;
     }
 }
@@ -69,87 +380,76 @@ int DataFrame::get_column_index(const std::string& column_name) const
     return std::distance(column_names.begin(), it);
 }
 
+DataFrame::ColumnType DataFrame::column_type(const std::string& column_name) const
+{
+    return data[get_column_index(column_name)].type;
+}
+
+const std::vector<std::string>& DataFrame::categories(const std::string& column_name) const
+{
+    return data[get_column_index(column_name)].categories;
+}
+
+MatrixView DataFrame::column_view(const std::string& column_name) const
+{
+    const Column& column=data[get_column_index(column_name)];
+    if(column.type!=ColumnType::Float64) throw std::invalid_argument("Column is not Float64: " + column_name);
+    return MatrixView(column.values.data(), rows, 1, 1);
+}
+
 Matrix DataFrame::select(const std::vector<std::string>& columns) const
 {
-    Matrix result(rows, columns.size());
-    for(size_t j=0;j<columns.size();j++)
-    {
-        int col_index = get_column_index(columns[j]);
-        for(int i=0;i<rows;i++) 
-        {
-            try {
-                if(data[i][col_index].empty()) result(i,j)=0.0;
-                else result(i,j)=std::stod(data[i][col_index]);
-            } catch (...) {
-                result(i,j)=0.0;
-            }
-        }
-    }
-    return result;
+    std::vector<int> indices;
+    for(const auto& name : columns) indices.push_back(get_column_index(name));
+    return gather(indices);
 }
 
 Matrix DataFrame::select(int column_index, int end_column_index) const
 {
     if(column_index<0||end_column_index>=cols||column_index>end_column_index) throw std::out_of_range("Column index out of range");
-    int selected_cols = end_column_index - column_index + 1;
-    Matrix result(rows, selected_cols);
-    for(int j=0;j<selected_cols;j++) 
-    {
-        for(int i=0;i<rows;i++) 
-        {
-            try {
-                if(data[i][column_index + j].empty()) result(i,j)=0.0;
-                else result(i,j)=std::stod(data[i][column_index + j]);
-            } catch (...) {
-                result(i,j)=0.0;
-            }
-        }
-    }
-    return result;
+    std::vector<int> indices;
+    for(int j=column_index;j<=end_column_index;j++) indices.push_back(j);
+    return gather(indices);
 }
 
 Matrix DataFrame::get_column(const std::string& column_name) const
 {
     int col_index = get_column_index(column_name);
-    Matrix result(rows, 1);
-    for(int i=0;i<rows;i++) 
-    {
-        try {
-            if(data[i][col_index].empty()) result(i,0)=0.0;
-            else result(i,0)=std::stod(data[i][col_index]);
-        } catch (...) {
-            result(i,0)=0.0;
-        }
-    }
+    if(data[col_index].type==ColumnType::Float64) return Matrix(column_view(column_name));
+    Matrix result=Matrix::uninitialized(rows, 1);
+    if(rows>0) project(col_index, 0, rows, &result(0,0), 1);
     return result;
 }
 
 Matrix DataFrame::get_column_encode(const std::string& column_name) const
 {
-    int col_index = get_column_index(column_name);
-    std::map<std::string, int> encoding_map;
-    int code = 0;
-    for(int i=0;i<rows;i++)
+    const Column& column=data[get_column_index(column_name)];
+    Matrix result=Matrix::uninitialized(rows, 1);
+    //Categorical columns were encoded in order of first appearance while parsing
+    if(column.type==ColumnType::Categorical)
     {
-        const std::string& value = data[i][col_index];
-        if(encoding_map.find(value) == encoding_map.end())
-        {
-            encoding_map[value] = code++;
-        }
+        for(int i=0;i<rows;i++) result(i,0)=column.codes[i];
+        return result;
     }
-    Matrix result(rows, 1);
-    for(int i=0;i<rows;i++) result(i,0)=encoding_map[data[i][col_index]];
+    if(column.type==ColumnType::Int64) encode_first_seen(column.integers.data(), rows, result);
+    else encode_first_seen(column.values.data(), rows, result);
     return result;
 }
 
 void DataFrame::info() const
 {
+    static const char* type_names[]={"int64","float64","categorical"};
     std::cout << "DataFrame Info:" << std::endl;
     std::cout << "Number of rows: " << rows << std::endl;
     std::cout << "Number of columns: " << cols << std::endl;
     if(!column_names.empty())
     {
         std::cout << "Columns:" << std::endl;
-        for(const auto& name : column_names) std::cout << "- " << name << std::endl;
+        for(int j=0;j<cols;j++)
+        {
+            std::cout << "- " << column_names[j] << " (" << type_names[(int)data[j].type];
+            if(data[j].type==ColumnType::Categorical) std::cout << ", " << data[j].categories.size() << " categories";
+            std::cout << ")" << std::endl;
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,72 @@
+#include "../../include/io/mapped_file.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+
+MappedFile::MappedFile(const std::string& path)
+{
+    HANDLE file=CreateFileA(path.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,nullptr);
+    if(file==INVALID_HANDLE_VALUE) throw std::runtime_error("Could not open "+path);
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file,&size))
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Could not read the size of "+path);
+    }
+    length=(size_t)size.QuadPart;
+    if(length==0)
+    {
+        CloseHandle(file);
+        return;
+    }
+    mapping=CreateFileMappingA(file,nullptr,PAGE_WRITECOPY,0,0,nullptr);
+    CloseHandle(file);
+    if(!mapping) throw std::runtime_error("Could not map "+path);
+    base=(char*)MapViewOfFile(mapping,FILE_MAP_COPY,0,0,0);
+    if(!base)
+    {
+        CloseHandle(mapping);
+        throw std::runtime_error("Could not map "+path);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if(base) UnmapViewOfFile(base);
+    if(mapping) CloseHandle(mapping);
+}
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd=::open(path.c_str(),O_RDONLY);
+    if(fd<0) throw std::runtime_error("Could not open "+path);
+    struct stat info;
+    if(::fstat(fd,&info)!=0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not read the size of "+path);
+    }
+    length=(size_t)info.st_size;
+    if(length==0)
+    {
+        ::close(fd);
+        return;
+    }
+    //the mapping keeps its own reference to the file
+    void* p=::mmap(nullptr,length,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if(p==MAP_FAILED) throw std::runtime_error("Could not map "+path);
+    base=(char*)p;
+}
+
+MappedFile::~MappedFile()
+{
+    if(base) ::munmap(base,length);
+}
+#endif
@@ -0,0 +1,264 @@
+#include "../../include/io/model_file.h"
+#include "../../include/layers/layer.h"
+#include "../../include/layers/dense.h"
+#include "../../include/layers/conv2d.h"
+#include "../../include/layers/batchnorm.h"
+#include "../../include/layers/pooling.h"
+#include "../../include/layers/dropout.h"
+#include "../../include/layers/softmax.h"
+#include "../../include/layers/zeropad.h"
+#include "../../include/activation.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace model_file;
+
+static_assert(sizeof(FileHeader)==64,"FileHeader must stay 64 bytes");
+static_assert(sizeof(LayerRecord)==96,"LayerRecord layout changed");
+static_assert(sizeof(TensorRecord)==16,"TensorRecord layout changed");
+
+namespace
+{
+    uint64_t align(uint64_t offset)
+    {
+        return (offset+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+    }
+
+    //Atomic on both systems, a reader sees the old file or the new one
+    bool replace_file(const std::string& from,const std::string& to)
+    {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(),to.c_str(),MOVEFILE_REPLACE_EXISTING)!=0;
+#else
+        return std::rename(from.c_str(),to.c_str())==0;
+#endif
+    }
+}
+
+uint64_t model_file::checksum(const char* data,size_t size)
+{
+    uint64_t hash=14695981039346656037ULL;
+    for(size_t i=0;i+8<=size;i+=8)
+    {
+        uint64_t word;
+        std::memcpy(&word,data+i,8);
+        hash^=word;
+        hash*=1099511628211ULL;
+    }
+    return hash;
+}
+
+bool model_file::is_model_file(const std::string& path)
+{
+    std::ifstream file(path,std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return file.read(magic,sizeof(magic))&&std::memcmp(magic,MAGIC,sizeof(MAGIC))==0;
+}
+
+Layer* model_file::create_layer(const std::string& type,const std::vector<double>& arguments)
+{
+    auto need=[&](size_t n)
+    {
+        if(arguments.size()!=n) throw std::runtime_error(type+" takes "+std::to_string(n)+" arguments in a model file");
+    };
+    auto arg=[&](int i){return (int)arguments[i];};
+    //stride, padding, dilation and the pooling mode came later, files from before have only the leading arguments
+    auto arg_or=[&](size_t i,int fallback){return i<arguments.size()?arg(i):fallback;};
+    if(type=="Dense") {need(2); return new Dense(arg(0),arg(1),false);}
+    if(type=="Conv2D") {need(arguments.size()==5?5:8); return new Conv2D(arg(0),arg(1),arg(2),arg(3),arg(4),arg_or(5,1),arg_or(6,0),arg_or(7,1));}
+    if(type=="BatchNorm") {need(1); return new BatchNorm(arg(0));}
+    if(type=="Pooling")
+    {
+        need(arguments.size()==5?5:arguments.size()==7?7:8);
+        if(arg_or(7,0)!=(int)PoolMode::Max&&arg_or(7,0)!=(int)PoolMode::Average) throw std::runtime_error("Unknown pooling mode in model file");
+        return new Pooling(arg(0),arg(1),arg(2),arg(3),arg(4),arg_or(5,0),arg_or(6,1),(PoolMode)arg_or(7,0));
+    }
+    if(type=="Dropout") {need(1); return new Dropout(arguments[0]);}
+    if(type=="Softmax") {need(0); return new Softmax();}
+    if(type=="ZeroPad") {need(4); return new ZeroPad(arg(0),arg(1),arg(2),arg(3));}
+    if(type=="Activation")
+    {
+        need(1);
+        const std::vector<ActivationFunction>& functions=activation_functions();
+        if(arg(0)<0||arg(0)>=(int)functions.size()) throw std::runtime_error("Unknown activation function in model file");
+        return new Activation(functions[arg(0)].f,functions[arg(0)].df);
+    }
+    throw std::runtime_error("Unknown layer type in model file: "+type);
+}
+
+void model_file::save(const std::string& path,const std::vector<Layer*>& layers)
+{
+    std::vector<LayerRecord> records;
+    std::vector<MatrixView> tensors;
+    for(const Layer* layer:layers)
+    {
+        LayerRecord record;
+        std::memset(&record,0,sizeof(record));
+        std::string type=layer->name();
+        std::vector<double> arguments=layer->arguments();
+        if(type.size()>=sizeof(record.type)) throw std::logic_error("Layer name too long for a model file: "+type);
+        if(arguments.size()>(size_t)MAX_ARGUMENTS) throw std::logic_error(type+" has too many arguments for a model file");
+        ModelWriter writer;
+        layer->write(writer);
+        std::memcpy(record.type,type.data(),type.size());
+        record.argument_count=arguments.size();
+        record.tensor_count=writer.tensors().size();
+        std::copy(arguments.begin(),arguments.end(),record.arguments);
+        records.push_back(record);
+        tensors.insert(tensors.end(),writer.tensors().begin(),writer.tensors().end());
+    }
+
+    FileHeader header;
+    std::memset(&header,0,sizeof(header));
+    std::memcpy(header.magic,MAGIC,sizeof(MAGIC));
+    header.version=VERSION;
+    header.scalar_bytes=sizeof(real);
+    header.layer_count=records.size();
+    header.tensor_count=tensors.size();
+    header.layers_offset=sizeof(FileHeader);
+    header.tensors_offset=header.layers_offset+records.size()*sizeof(LayerRecord);
+    header.data_offset=align(header.tensors_offset+tensors.size()*sizeof(TensorRecord));
+
+    std::vector<TensorRecord> table;
+    uint64_t offset=header.data_offset;
+    for(const MatrixView& t:tensors)
+    {
+        table.push_back({t.rows,t.cols,offset});
+        offset=align(offset+(uint64_t)t.rows*t.cols*sizeof(real));
+    }
+    header.file_size=offset;
+
+    std::vector<char> buffer(header.file_size,0);
+    if(!records.empty()) std::memcpy(&buffer[header.layers_offset],records.data(),records.size()*sizeof(LayerRecord));
+    if(!table.empty()) std::memcpy(&buffer[header.tensors_offset],table.data(),table.size()*sizeof(TensorRecord));
+    for(size_t i=0;i<tensors.size();i++)
+    {
+        char* dst=&buffer[table[i].offset];
+        for(int r=0;r<tensors[i].rows;r++) std::memcpy(dst+(size_t)r*tensors[i].cols*sizeof(real),tensors[i].row(r),tensors[i].cols*sizeof(real));
+    }
+    header.checksum=checksum(buffer.data()+sizeof(FileHeader),buffer.size()-sizeof(FileHeader));
+    std::memcpy(buffer.data(),&header,sizeof(header));
+
+    /*
+    Written beside path and renamed over it: load maps the file it opens, so rewriting that inode in place would change
+    the weights under a running server, or cut its pages off (SIGBUS) while the file is truncated.
+    */
+    std::string temporary=path+".tmp";
+    {
+        std::ofstream file(temporary,std::ios::binary|std::ios::trunc);
+        file.write(buffer.data(),buffer.size());
+        file.flush();
+        file.close();
+        if(!file)
+        {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Could not write "+temporary);
+        }
+    }
+    if(!replace_file(temporary,path))
+    {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not replace "+path+" with "+temporary);
+    }
+}
+
+std::vector<Layer*> model_file::load(const std::string& path,std::unique_ptr<MappedFile>& mapping,bool verify)
+{
+    std::unique_ptr<MappedFile> file(new MappedFile(path));
+    char* base=file->data();
+    size_t size=file->size();
+    FileHeader header;
+    if(size<sizeof(header)) throw std::runtime_error(path+" is not a model file");
+    std::memcpy(&header,base,sizeof(header));
+    if(std::memcmp(header.magic,MAGIC,sizeof(MAGIC))!=0) throw std::runtime_error(path+" is not a model file");
+    //a version below 256 read with its bytes reversed
+    if(header.version>VERSION&&(header.version&0xFFFFFF)==0) throw std::runtime_error(path+" was written on a host of the other byte order");
+    if(header.version>VERSION) throw std::runtime_error(path+" has model file version "+std::to_string(header.version)+", this build reads up to "+std::to_string(VERSION));
+    if(header.scalar_bytes!=sizeof(float)&&header.scalar_bytes!=sizeof(double)) throw std::runtime_error(path+" has an invalid scalar width");
+    if(header.file_size!=size) throw std::runtime_error(path+" is truncated");
+    if(header.layers_offset+(uint64_t)header.layer_count*sizeof(LayerRecord)>size||header.tensors_offset+(uint64_t)header.tensor_count*sizeof(TensorRecord)>size)
+        throw std::runtime_error(path+" has a corrupt layer table");
+    if(verify&&checksum(base+sizeof(FileHeader),size-sizeof(FileHeader))!=header.checksum) throw std::runtime_error(path+" failed its checksum");
+
+    const LayerRecord* records=(const LayerRecord*)(base+header.layers_offset);
+    const TensorRecord* tensors=(const TensorRecord*)(base+header.tensors_offset);
+    std::vector<Layer*> layers;
+    try
+    {
+        uint32_t next=0;
+        for(uint32_t i=0;i<header.layer_count;i++)
+        {
+            const LayerRecord& record=records[i];
+            std::string type(record.type,strnlen(record.type,sizeof(record.type)));
+            if(record.argument_count>(uint32_t)MAX_ARGUMENTS||record.tensor_count>header.tensor_count-next) throw std::runtime_error(path+" has a corrupt record for "+type);
+            layers.push_back(create_layer(type,std::vector<double>(record.arguments,record.arguments+record.argument_count)));
+            ModelReader reader(base,size,header.scalar_bytes,tensors+next,record.tensor_count);
+            layers.back()->read(reader);
+            if(reader.remaining()!=0) throw std::runtime_error(path+" has more tensors for "+type+" than it uses");
+            next+=record.tensor_count;
+        }
+    }
+    catch(...)
+    {
+        for(Layer* layer:layers) delete layer;
+        throw;
+    }
+    mapping=std::move(file);
+    return layers;
+}
+
+void ModelWriter::write(const MatrixView& tensor)
+{
+    written.push_back(tensor);
+}
+
+void ModelWriter::write(const real* data,int count)
+{
+    written.push_back(MatrixView(data,1,count,count));
+}
+
+ModelReader::ModelReader(char* base,size_t size,size_t scalar_bytes,const TensorRecord* tensors,uint32_t count):base(base),size(size),scalar_bytes(scalar_bytes),tensors(tensors),count(count){}
+
+char* ModelReader::take(int rows,int cols)
+{
+    if(next>=count) throw std::runtime_error("Model file has fewer tensors than the layer needs");
+    TensorRecord t;
+    std::memcpy(&t,tensors+next,sizeof(t));
+    next++;
+    if(t.rows!=rows||t.cols!=cols) throw std::runtime_error("Tensor of "+std::to_string(t.rows)+"x"+std::to_string(t.cols)+" in the model file where the layer has "+std::to_string(rows)+"x"+std::to_string(cols));
+    if(t.offset%ALIGNMENT!=0||t.offset>size||(uint64_t)rows*cols*scalar_bytes>size-t.offset) throw std::runtime_error("Tensor outside of the model file");
+    return base+t.offset;
+}
+
+void ModelReader::convert(const char* src,real* dst,size_t n) const
+{
+    if(scalar_bytes==sizeof(float)) for(size_t i=0;i<n;i++) dst[i]=((const float*)src)[i];
+    else for(size_t i=0;i<n;i++) dst[i]=((const double*)src)[i];
+}
+
+void ModelReader::read(Matrix& matrix)
+{
+    char* src=take(matrix.rows,matrix.cols);
+    if(scalar_bytes==sizeof(real))
+    {
+        matrix=Matrix::borrow((real*)src,matrix.rows,matrix.cols);
+        return;
+    }
+    matrix=Matrix::uninitialized(matrix.rows,matrix.cols);
+    if(matrix.rows>0&&matrix.cols>0) convert(src,&matrix(0,0),(size_t)matrix.rows*matrix.cols);
+}
+
+void ModelReader::read(real* data,int count)
+{
+    read(data,1,count);
+}
+
+void ModelReader::read(real* data,int rows,int cols)
+{
+    convert(take(rows,cols),data,(size_t)rows*cols);
+}
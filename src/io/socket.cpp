@@ -0,0 +1,224 @@
+#include "../../include/io/socket.h"
+#include <stdexcept>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib,"ws2_32.lib")
+#endif
+namespace
+{
+    const socket_handle INVALID=(socket_handle)INVALID_SOCKET;
+    void close_handle(socket_handle h) {closesocket((SOCKET)h);}
+    bool interrupted() {return false;}
+    //accept failed because the listener was closed or shut down, every other error is about one client
+    bool listener_gone() {int e=WSAGetLastError(); return e==WSAENOTSOCK||e==WSAEINVAL||e==WSAEINTR;}
+    bool out_of_resources() {int e=WSAGetLastError(); return e==WSAEMFILE||e==WSAENOBUFS;}
+    //Winsock has to be started once per process before any other call
+    void startup()
+    {
+        static bool started=[]{WSADATA data; return WSAStartup(MAKEWORD(2,2),&data)==0;}();
+        if(!started) throw std::runtime_error("WSAStartup failed");
+    }
+}
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+namespace
+{
+    const socket_handle INVALID=-1;
+    void close_handle(socket_handle h) {::close(h);}
+    bool interrupted() {return errno==EINTR;}
+    //accept failed because the listener was closed or shut down, every other error is about one client
+    bool listener_gone() {return errno==EBADF||errno==EINVAL||errno==ENOTSOCK||errno==EOPNOTSUPP;}
+    bool out_of_resources() {return errno==EMFILE||errno==ENFILE||errno==ENOBUFS||errno==ENOMEM;}
+    void startup() {}
+}
+#endif
+
+namespace
+{
+    const int ACCEPT_BACKOFF_MS=100;
+
+    socket_handle open_tcp(const std::string& host,int port,sockaddr_in& addr)
+    {
+        startup();
+        std::memset(&addr,0,sizeof(addr));
+        addr.sin_family=AF_INET;
+        addr.sin_port=htons((unsigned short)port);
+        if(inet_pton(AF_INET,host.c_str(),&addr.sin_addr)!=1) throw std::runtime_error("Invalid IPv4 address: "+host);
+        socket_handle h=(socket_handle)::socket(AF_INET,SOCK_STREAM,0);
+        if(h==INVALID) throw std::runtime_error("Could not create socket");
+        //requests are small, do not hold them back waiting for more data
+        int on=1;
+        setsockopt(h,IPPROTO_TCP,TCP_NODELAY,(const char*)&on,sizeof(on));
+        return h;
+    }
+}
+
+Socket::Socket():handle(INVALID){}
+
+Socket::Socket(socket_handle handle):handle(handle){}
+
+Socket::Socket(Socket&& other) noexcept:handle(other.handle)
+{
+    other.handle=INVALID;
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+    if(this!=&other)
+    {
+        close();
+        handle=other.handle;
+        other.handle=INVALID;
+    }
+    return *this;
+}
+
+Socket::~Socket()
+{
+    close();
+}
+
+Socket Socket::listen_tcp(int port,const std::string& host,int backlog)
+{
+    sockaddr_in addr;
+    Socket s(open_tcp(host,port,addr));
+    int on=1;
+    setsockopt(s.handle,SOL_SOCKET,SO_REUSEADDR,(const char*)&on,sizeof(on));
+    if(::bind(s.handle,(sockaddr*)&addr,sizeof(addr))!=0) throw std::runtime_error("Could not bind to "+host+":"+std::to_string(port));
+    if(::listen(s.handle,backlog)!=0) throw std::runtime_error("Could not listen on "+host+":"+std::to_string(port));
+    return s;
+}
+
+Socket Socket::connect_tcp(int port,const std::string& host)
+{
+    sockaddr_in addr;
+    Socket s(open_tcp(host,port,addr));
+    if(::connect(s.handle,(sockaddr*)&addr,sizeof(addr))!=0) throw std::runtime_error("Could not connect to "+host+":"+std::to_string(port));
+    return s;
+}
+
+#ifdef _WIN32
+Socket Socket::listen_unix(const std::string& path,int backlog)
+{
+    throw std::runtime_error("Unix domain sockets are not supported on this platform");
+}
+
+Socket Socket::connect_unix(const std::string& path)
+{
+    throw std::runtime_error("Unix domain sockets are not supported on this platform");
+}
+#else
+Socket Socket::listen_unix(const std::string& path,int backlog)
+{
+    sockaddr_un addr;
+    std::memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(path.size()>=sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: "+path);
+    std::strcpy(addr.sun_path,path.c_str());
+    Socket s((socket_handle)::socket(AF_UNIX,SOCK_STREAM,0));
+    if(!s.valid()) throw std::runtime_error("Could not create socket");
+    //a stale socket file from a previous run would make bind fail
+    ::unlink(path.c_str());
+    if(::bind(s.handle,(sockaddr*)&addr,sizeof(addr))!=0) throw std::runtime_error("Could not bind to "+path);
+    if(::listen(s.handle,backlog)!=0) throw std::runtime_error("Could not listen on "+path);
+    return s;
+}
+
+Socket Socket::connect_unix(const std::string& path)
+{
+    sockaddr_un addr;
+    std::memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(path.size()>=sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: "+path);
+    std::strcpy(addr.sun_path,path.c_str());
+    Socket s((socket_handle)::socket(AF_UNIX,SOCK_STREAM,0));
+    if(!s.valid()) throw std::runtime_error("Could not create socket");
+    if(::connect(s.handle,(sockaddr*)&addr,sizeof(addr))!=0) throw std::runtime_error("Could not connect to "+path);
+    return s;
+}
+#endif
+
+Socket Socket::accept() const
+{
+    while(true)
+    {
+        socket_handle client=(socket_handle)::accept(handle,nullptr,nullptr);
+        if(client!=INVALID) return Socket(client);
+        if(listener_gone()) return Socket();
+        //a client that reset before it was accepted is skipped, running out of descriptors waits for some to close
+        if(out_of_resources()) std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_BACKOFF_MS));
+    }
+}
+
+bool Socket::read_exact(void* buffer,size_t bytes) const
+{
+    char* p=(char*)buffer;
+    while(bytes>0)
+    {
+        int chunk=bytes>(1<<30)?(1<<30):(int)bytes;
+        long n=::recv(handle,p,chunk,0);
+        if(n==0) return false;
+        if(n<0)
+        {
+            if(interrupted()) continue;
+            return false;
+        }
+        p+=n;
+        bytes-=n;
+    }
+    return true;
+}
+
+bool Socket::write_all(const void* buffer,size_t bytes) const
+{
+    const char* p=(const char*)buffer;
+    while(bytes>0)
+    {
+        int chunk=bytes>(1<<30)?(1<<30):(int)bytes;
+#ifdef MSG_NOSIGNAL
+        long n=::send(handle,p,chunk,MSG_NOSIGNAL);
+#else
+        long n=::send(handle,p,chunk,0);
+#endif
+        if(n<0)
+        {
+            if(interrupted()) continue;
+            return false;
+        }
+        p+=n;
+        bytes-=n;
+    }
+    return true;
+}
+
+bool Socket::valid() const
+{
+    return handle!=INVALID;
+}
+
+void Socket::shutdown() const
+{
+#ifdef _WIN32
+    if(valid()) ::shutdown((SOCKET)handle,SD_BOTH);
+#else
+    if(valid()) ::shutdown(handle,SHUT_RDWR);
+#endif
+}
+
+void Socket::close()
+{
+    if(valid()) close_handle(handle);
+    handle=INVALID;
+}
@@ -1,6 +1,8 @@
 #include "../../include/layers/batchnorm.h"
+#include "../../include/io/model_file.h"
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 BatchNorm::BatchNorm(int features):features(features)
 {
@@ -9,17 +11,13 @@ BatchNorm::BatchNorm(int features):features(features)
     b=Matrix::zeros(1,features);
     mean = Matrix::zeros(1,features);
     var = Matrix::zeros(1,features);
-    mg = Matrix::zeros(1,features);
-    vg = Matrix::zeros(1,features);
-    mb = Matrix::zeros(1,features);
-    vb = Matrix::zeros(1,features);
 }
 
-Matrix BatchNorm::forward_pass(const Matrix& input)
+Matrix BatchNorm::forward_pass(const MatrixView& input)
 {
-    Matrix output(input.rows,features);
-    x_=Matrix(input.rows,features);
-    std_inv=Matrix(1,features);
+    Matrix output=Matrix::uninitialized(input.rows,features);
+    if(x_.rows!=input.rows||x_.cols!=features) x_=Matrix::uninitialized(input.rows,features);
+    if(std_inv.cols!=features) std_inv=Matrix::uninitialized(1,features);
     if(this->is_training)
     {
          Matrix mean_=Matrix::zeros(1,features),var_=Matrix::zeros(1,features);
@@ -51,10 +49,37 @@ Matrix BatchNorm::forward_pass(const Matrix& input)
     return output;
 }
 
+Matrix BatchNorm::infer(const MatrixView& input,Scratch& scratch) const
+{
+    Matrix output=Matrix::uninitialized(input.rows,features);
+    real* std_inv=scratch.get(features);
+    for(int i=0; i<features; i++) std_inv[i] = 1.0 / std::sqrt(var(0, i) + e);
+    #pragma omp parallel for
+    for(int i=0;i<input.rows;i++)
+    {
+        for(int j=0;j<features;j++)
+        {
+            real x=input(i,j)-mean(0,j);
+            output(i,j)=g(0,j)*x*std_inv[j]+b(0,j);
+        }
+    }
+    return output;
+}
+
 Matrix BatchNorm::backward_pass(const Matrix& delta,double learning_rate)
 {
-    Matrix prev_delta(delta.rows,features);
-    Matrix dg=Matrix::zeros(1,features),db=Matrix::zeros(1,features);
+    Matrix prev_delta=gradient(delta);
+    update(learning_rate);
+    return prev_delta;
+}
+
+Matrix BatchNorm::gradient(const Matrix& delta)
+{
+    Matrix prev_delta=Matrix::uninitialized(delta.rows,features);
+    //zeroed in place, they may be views into the Network's arena
+    parameters();
+    std::fill(&dg(0,0),&dg(0,0)+features,0.0);
+    std::fill(&db(0,0),&db(0,0)+features,0.0);
     
     for(int i=0;i<delta.rows;i++)
     {
@@ -67,20 +92,24 @@ Matrix BatchNorm::backward_pass(const Matrix& delta,double learning_rate)
 
     #pragma omp parallel for
     for(int i=0;i<delta.rows;i++)for(int j=0;j<features;j++)prev_delta(i,j)=(g(0,j)*std_inv(0,j)/delta.rows)*(delta.rows*delta(i,j)-db(0,j)-x_(i,j)*std_inv(0,j)*dg(0,j));
-    t++;
-    m=1.0-std::pow(b1,t);v=1.0-std::pow(b2,t);
-    for(int i=0;i<features;i++)
-    {
-        mb(0,i)=b1*mb(0,i)+(1.0-b1)*db(0,i);
-        vb(0,i)=b2*vb(0,i)+(1.0-b2)*db(0,i)*db(0,i);
-        b(0,i)-=learning_rate*(mb(0,i)/m)/(std::sqrt(vb(0,i)/v)+e);
-        mg(0,i)=b1*mg(0,i)+(1.0-b1)*dg(0,i);
-        vg(0,i)=b2*vg(0,i)+(1.0-b2)*dg(0,i)*dg(0,i);
-        g(0,i)-=learning_rate*(mg(0,i)/m)/(std::sqrt(vg(0,i)/v)+e);
-    }
     return prev_delta;
 }
 
+std::vector<Parameter> BatchNorm::parameters()
+{
+    if(dg.cols!=features) {dg=Matrix::zeros(1,features); db=Matrix::zeros(1,features);}
+    return {{&g(0,0),&dg(0,0),(size_t)features},{&b(0,0),&db(0,0),(size_t)features}};
+}
+
+void BatchNorm::bind(real*& values,real*& grads)
+{
+    parameters();
+    place(g,values);
+    place(b,values);
+    place(dg,grads);
+    place(db,grads);
+}
+
 void BatchNorm::save(std::ofstream& file) 
 {
     g.save(file);
@@ -89,10 +118,31 @@ void BatchNorm::save(std::ofstream& file)
     var.save(file);
 }
 
-void BatchNorm::load(std::ifstream& file) 
+void BatchNorm::load(std::ifstream& file,size_t scalar_bytes) 
+{
+    g.load(file,scalar_bytes);
+    b.load(file,scalar_bytes);
+    mean.load(file,scalar_bytes);
+    var.load(file,scalar_bytes);
+}
+
+std::vector<double> BatchNorm::arguments() const
+{
+    return {(double)features};
+}
+
+void BatchNorm::write(ModelWriter& file) const
+{
+    file.write(g);
+    file.write(b);
+    file.write(mean);
+    file.write(var);
+}
+
+void BatchNorm::read(ModelReader& file)
 {
-    g.load(file);
-    b.load(file);
-    mean.load(file);
-    var.load(file);
+    file.read(g);
+    file.read(b);
+    file.read(mean);
+    file.read(var);
 }
\ No newline at end of file
@@ -1,13 +1,17 @@
 #include "../../include/layers/conv2d.h"
+#include "../../include/core/conv_engine.h"
+#include "../../include/io/model_file.h"
 #include <iostream>
 #include <random>
 #include <fstream>
-#include <omp.h>
+#include <stdexcept>
+#include <algorithm>
 
-Conv2D::Conv2D(int h,int w,int d,int f,int k):h(h),w(w),d(d),f(f),k(k)
+Conv2D::Conv2D(int h,int w,int d,int f,int k,int stride,int pad,int dilation):h(h),w(w),d(d),f(f),k(k),stride(stride),pad(pad),dilation(dilation)
 {
-    oh = h-k+1;
-    ow = w-k+1;
+    oh = (h+2*pad-dilation*(k-1)-1)/stride+1;
+    ow = (w+2*pad-dilation*(k-1)-1)/stride+1;
+    if(k<1||stride<1||dilation<1||pad<0||h+2*pad<dilation*(k-1)+1||w+2*pad<dilation*(k-1)+1) throw std::invalid_argument("Conv2D kernel does not fit the padded input");
     init();
 }
 
@@ -18,108 +22,117 @@ void Conv2D::init()
     double std = std::sqrt(2.0/(k*k*d));
     std::normal_distribution<double> dist(0.0,std);
 
-    mk.resize(f);vk.resize(f);
-    mb.resize(f,0.0);vb.resize(f,0.0);
-    kernels.resize(f);
-    b.resize(f);
-    for(int i=0;i<f;i++)
-    {
-        kernels[i].resize(d);
-        mk[i].resize(d);vk[i].resize(d);
-        b[i]=0.0;
-        for(int j=0;j<d;j++)
-        {
-            kernels[i][j]=Matrix(k,k);
-            mk[i][j]=Matrix::zeros(k,k);
-            vk[i][j]=Matrix::zeros(k,k);
-            for(int k_=0;k_<k;k_++) for(int k__=0;k__<k;k__++) kernels[i][j](k_,k__)=dist(re);
-        }
-    }
+    kernels=Matrix::uninitialized(f,d*k*k);
+    b=Matrix::zeros(1,f);
+    for(int i=0;i<f;i++) for(int j=0;j<d*k*k;j++) kernels(i,j)=dist(re);
 }
 
-Matrix Conv2D::forward_pass(const Matrix& input)
+Matrix Conv2D::forward_pass(const MatrixView& input)
 {
     this->input=input;
     allocate_gpu_memory(input.rows);
-    Matrix output(input.rows,f*oh*ow);
-    std::vector<double> flat_kernels;
-    flat_kernels.reserve(f*d*k*k);
-    for(int i = 0; i < f; i++) 
-    {          
-        for(int j = 0; j < d; j++) 
-        {      
-            Matrix& mat = kernels[i][j];
-            int size = k * k;
-            for(int m = 0; m < size; m++) flat_kernels.push_back(mat.data[m]);
-        }
+    Matrix output=Matrix::uninitialized(input.rows,f*oh*ow);
+    gpu_memcpy_h2d(d_kernels, kernels.data, f * d * k * k * sizeof(real));
+    if(input.contiguous()) gpu_memcpy_h2d(d_input, input.data, input.rows * input.cols * sizeof(real));
+    else for(int i = 0; i < input.rows; i++) gpu_memcpy_h2d(d_input + (size_t)i * input.cols, input.row(i), input.cols * sizeof(real));
+    launch_conv2d_lean(d_input, d_kernels, d_output, input.rows, h, w, d, oh, ow, f, k, stride, pad, dilation);
+    gpu_memcpy_d2h(output.data, d_output, output.rows * output.cols * sizeof(real));
+    #pragma omp parallel for
+    for(int i = 0; i < input.rows; i++) for(int j = 0; j < f; j++) for(int pixel=0;pixel<oh*ow;pixel++) output(i,j*oh*ow+pixel)+=b(0,j);
+    return output;
+}
+
+/*
+The CPU convolution engine on either backend: the device buffers above belong to the layer and would be shared by
+every caller. The engine reads the batch sample after sample, a strided view is copied into scratch first.
+*/
+Matrix Conv2D::infer(const MatrixView& input,Scratch& scratch) const
+{
+    Matrix output=Matrix::uninitialized(input.rows,f*oh*ow);
+    const real* samples=input.data;
+    if(!input.contiguous())
+    {
+        real* copy=scratch.get((size_t)input.rows*input.cols);
+        for(int r=0;r<input.rows;r++) std::copy(input.row(r),input.row(r)+input.cols,copy+(size_t)r*input.cols);
+        samples=copy;
     }
-    gpu_memcpy_h2d(d_kernels, flat_kernels.data(), flat_kernels.size() * sizeof(double));
-    gpu_memcpy_h2d(d_input, input.data, input.rows * input.cols * sizeof(double));
-    launch_conv2d_lean(d_input, d_kernels, d_output, input.rows, h, w, d, oh, ow, f, k);
-    gpu_memcpy_d2h(output.data, d_output, output.rows * output.cols * sizeof(double));
+    conv_forward({input.rows,h,w,d,f,k,stride,pad,dilation},samples,kernels.data,&output(0,0));
     #pragma omp parallel for
-    for(int i = 0; i < input.rows; i++) for(int j = 0; j < f; j++) for(int pixel=0;pixel<oh*ow;pixel++) output(i,j*oh*ow+pixel)+=b[j];
+    for(int i = 0; i < input.rows; i++) for(int j = 0; j < f; j++) for(int pixel=0;pixel<oh*ow;pixel++) output(i,j*oh*ow+pixel)+=b(0,j);
     return output;
 }
 
 Matrix Conv2D::backward_pass(const Matrix& delta, double learning_rate)
 {
-    Matrix prev_delta(input.rows, h*w*d); 
-    
-    std::vector<double> flat_kernels;
-    flat_kernels.reserve(f*d*k*k);
-    for(int i=0; i<f; i++) for(int j=0; j<d; j++) for(int m=0; m<k*k; m++) flat_kernels.push_back(kernels[i][j].data[m]);
-    std::vector<double> flat_dk(f*d*k*k, 0.0);
-    std::vector<double> flat_db(f, 0.0);
+    Matrix prev_delta=gradient(delta);
+    update(learning_rate);
+    return prev_delta;
+}
+
+Matrix Conv2D::gradient(const Matrix& delta)
+{
+    Matrix prev_delta=Matrix::uninitialized(input.rows, h*w*d);
+    if(dk.rows!=f) {dk=Matrix::uninitialized(f,d*k*k); db=Matrix::uninitialized(1,f);}
+
+    gpu_memcpy_h2d(d_delta, delta.data, delta.rows * delta.cols * sizeof(real));
+
+    launch_conv2d_backward_lean(d_input, d_delta, d_kernels, d_dk, d_db, d_prev_delta, input.rows, h, w, d, oh, ow, f, k, stride, pad, dilation);
 
-    gpu_memcpy_h2d(d_delta, delta.data, delta.rows * delta.cols * sizeof(double));
+    gpu_memcpy_d2h(dk.data, d_dk, f * d * k * k * sizeof(real));
+    gpu_memcpy_d2h(db.data, d_db, f * sizeof(real));
+    gpu_memcpy_d2h(prev_delta.data, d_prev_delta, prev_delta.rows * prev_delta.cols * sizeof(real));
+    return prev_delta;
+}
 
-    launch_conv2d_backward_lean(d_input, d_delta, d_kernels, d_dk, d_db, d_prev_delta, input.rows, h, w, d, oh, ow, f, k);
+std::vector<Parameter> Conv2D::parameters()
+{
+    if(dk.rows!=f) {dk=Matrix::zeros(f,d*k*k); db=Matrix::zeros(1,f);}
+    return {{kernels.data,dk.data,(size_t)f*d*k*k},{b.data,db.data,(size_t)f}};
+}
 
-    gpu_memcpy_d2h(flat_dk.data(), d_dk, flat_dk.size() * sizeof(double));
-    gpu_memcpy_d2h(flat_db.data(), d_db, flat_db.size() * sizeof(double));
-    gpu_memcpy_d2h(prev_delta.data, d_prev_delta, prev_delta.rows * prev_delta.cols * sizeof(double));
+void Conv2D::bind(real*& values,real*& grads)
+{
+    parameters();
+    place(kernels,values);
+    place(b,values);
+    place(dk,grads);
+    place(db,grads);
+}
 
-    t++;
-    m = 1.0 - std::pow(b1, t);
-    v = 1.0 - std::pow(b2, t);
+//Files keep one k x k matrix per filter and channel, as when the kernels were stored that way
+void Conv2D::save(std::ofstream& file) 
+{
+    for(int i=0; i<f; i++)for(int j=0; j<d; j++)Matrix(MatrixView(&kernels(i,j*k*k),k,k,k)).save(file);
+    file.write((char*)b.data,f*sizeof(real));
+}
 
-    int dk_idx = 0;
-    for(int j = 0; j < f; j++) 
+void Conv2D::load(std::ifstream& file,size_t scalar_bytes) 
+{
+    Matrix kernel;
+    for(int i=0; i<f; i++)for(int j=0; j<d; j++)
     {
-        mb[j] = b1 * mb[j] + (1 - b1) * flat_db[j];
-        vb[j] = 0.999 * vb[j] + (0.001) * flat_db[j] * flat_db[j];
-        b[j] -= learning_rate * (mb[j] / m) / ((std::sqrt(vb[j] / v) + e));
-
-        for(int depth = 0; depth < d; depth++) 
-        {
-            for(int r = 0; r < k; r++) 
-            {
-                for(int c = 0; c < k; c++) 
-                {
-                    double grad = flat_dk[dk_idx++];
-                    
-                    mk[j][depth](r,c) = b1 * mk[j][depth](r,c) + (1.0 - b1) * grad;
-                    vk[j][depth](r,c) = b2 * vk[j][depth](r,c) + (1.0 - b2) * grad * grad;
-                    kernels[j][depth](r, c) -= learning_rate * (mk[j][depth](r,c) / m) / (std::sqrt(vk[j][depth](r,c) / v) + e);
-                }
-            }
-        }
+        kernel.load(file,scalar_bytes);
+        if(kernel.rows!=k||kernel.cols!=k) throw std::runtime_error("Conv2D kernel of the wrong size in weight file");
+        std::copy(kernel.data,kernel.data+k*k,&kernels(i,j*k*k));
     }
+    Matrix::read_scalars(file,b.data,f,scalar_bytes);
+}
 
-    return prev_delta;
+std::vector<double> Conv2D::arguments() const
+{
+    return {(double)h,(double)w,(double)d,(double)f,(double)k,(double)stride,(double)pad,(double)dilation};
 }
 
-void Conv2D::save(std::ofstream& file) 
+void Conv2D::write(ModelWriter& file) const
 {
-    for(int i=0; i<f; i++)for(int j=0; j<d; j++)kernels[i][j].save(file);
-    file.write((char*)b.data(),f*sizeof(double));
+    for(int i=0; i<f; i++)for(int j=0; j<d; j++)file.write(MatrixView(MatrixView(kernels).row(i)+j*k*k,k,k,k));
+    file.write(b);
 }
 
-void Conv2D::load(std::ifstream& file) 
+void Conv2D::read(ModelReader& file)
 {
-    for(int i=0; i<f; i++)for(int j=0; j<d; j++)kernels[i][j].load(file);
-    file.read((char*)b.data(),f*sizeof(double));
+    for(int i=0; i<f; i++)for(int j=0; j<d; j++)file.read(&kernels(i,j*k*k),k,k);
+    file.read(b);
 }
 
 void Conv2D::allocate_gpu_memory(int batch_size) 
@@ -134,14 +147,14 @@ void Conv2D::allocate_gpu_memory(int batch_size)
     }
     if (!d_kernels) 
     {
-        gpu_alloc(&d_kernels, f * d * k * k * sizeof(double));
-        gpu_alloc(&d_db, f * sizeof(double));
-        gpu_alloc(&d_dk, f * d * k * k * sizeof(double));
+        gpu_alloc(&d_kernels, f * d * k * k * sizeof(real));
+        gpu_alloc(&d_db, f * sizeof(real));
+        gpu_alloc(&d_dk, f * d * k * k * sizeof(real));
     }
-    gpu_alloc(&d_input, batch_size * d * h * w * sizeof(double));
-    gpu_alloc(&d_output, batch_size * f * oh * ow * sizeof(double));
-    gpu_alloc(&d_delta, batch_size * f * oh * ow * sizeof(double));
-    gpu_alloc(&d_prev_delta, batch_size * d * h * w * sizeof(double));
+    gpu_alloc(&d_input, batch_size * d * h * w * sizeof(real));
+    gpu_alloc(&d_output, batch_size * f * oh * ow * sizeof(real));
+    gpu_alloc(&d_delta, batch_size * f * oh * ow * sizeof(real));
+    gpu_alloc(&d_prev_delta, batch_size * d * h * w * sizeof(real));
     this->allocated_batch_size = batch_size;
 }
 
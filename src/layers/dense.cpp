@@ -1,11 +1,20 @@
 #include "../include/layers/dense.h"
+#include "../include/io/model_file.h"
+#include "../include/core/gemm.h"
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <stdexcept>
 
-    Dense::Dense(int input_size,int output_size):mw(input_size,output_size),vw(input_size,output_size),mb(1,output_size),vb(1,output_size),t(0)
+    Dense::Dense(int input_size,int output_size,bool randomize)
     {
-        w = Matrix(input_size, output_size);
         b = Matrix(1, output_size);
+        if (!randomize)
+        {
+            w = Matrix::uninitialized(input_size, output_size);
+            return;
+        }
+        w = Matrix(input_size, output_size);
         double scale = std::sqrt(2.0 / input_size);
         for (int i = 0; i < input_size; i++) 
         {
@@ -17,22 +26,21 @@
         }
 
         for (int j = 0; j < output_size; j++) b(0, j) = 0.0;
-        init();
     }
 
-    void Dense::init()
+    Matrix Dense::forward_pass(const MatrixView& input)
     {
-        mw = Matrix::zeros(mw.rows,mw.cols);
-        vw = Matrix::zeros(vw.rows,vw.cols);
-        mb = Matrix::zeros(mb.rows,mb.cols);
-        vb = Matrix::zeros(vb.rows,vb.cols);
-        t=0;
+        this->input=input;
+        Scratch none;
+        return infer(input,none);
     }
 
-    Matrix Dense::forward_pass(const Matrix& input)
+    //CPU gemm on either backend, as Conv2D::infer: launch_gemm shares one set of device buffers between all callers
+    Matrix Dense::infer(const MatrixView& input,Scratch& scratch) const
     {
-        this->input=input;
-        Matrix output = input*w;
+        if(input.cols != w.rows) throw std::invalid_argument("Dimension mismatch");
+        Matrix output = Matrix::uninitialized(input.rows, w.cols);
+        gemm(false, false, input.rows, w.cols, w.rows, 1.0, input.data, input.stride, w.view().data, w.cols, 0.0, &output(0,0), w.cols);
         #pragma omp parallel for
         for(int i=0; i < output.rows; i++) for(int j=0; j < output.cols; j++) output(i,j) += b(0,j);
         return output;
@@ -40,30 +48,40 @@
 
     Matrix Dense::backward_pass(const Matrix& delta,double learning_rate)
     {
-        Matrix dw = input.transpose()*delta;
-        Matrix db = delta.sum_rows();
-        Matrix delta_prev = delta*w.transpose();
-        //Adam optimizer
-        t++;
-        m=1.0-std::pow(b1,t);v=1.0-std::pow(b2,t);
-        #pragma omp parallel for
-        for(int i=0;i<w.rows;i++)
-        {
-            for(int j=0;j<w.cols;j++)
-            {
-                mw(i,j)=b1*mw(i,j)+(1-b1)*dw(i,j);
-                vw(i,j)=b2*vw(i,j)+(1-b2)*dw(i,j)*dw(i,j);
-                w(i,j)-=learning_rate*(mw(i,j)/m)/(std::sqrt(vw(i,j)/v)+e);
-            }
-        }
+        Matrix delta_prev = gradient(delta);
+        update(learning_rate);
+        return delta_prev;
+    }
 
-        for(int i=0;i<b.cols;i++)
+    //Written in place, the gradients may be views into the Network's arena
+    Matrix Dense::gradient(const Matrix& delta)
+    {
+        parameters();
+        std::fill(&dw(0,0), &dw(0,0) + (size_t)w.rows * w.cols, 0.0);
+        dw.add_matmul(input,delta,true,false);
+        real* sum = &db(0,0);
+        std::fill(sum, sum + b.cols, 0.0);
+        for(int i=0; i < delta.rows; i++)
         {
-            mb(0,i)=b1*mb(0,i)+(1-b1)*db(0,i);
-            vb(0,i)=b2*vb(0,i)+(1-b2)*db(0,i)*db(0,i);
-            b(0,i)-=learning_rate*(mb(0,i)/m)/(std::sqrt(vb(0,i)/v)+e);
+            const real* row = delta.view().row(i);
+            for(int j=0; j < b.cols; j++) sum[j] += row[j];
         }
-        return delta_prev;
+        return Matrix::matmul(delta,w,false,true);
+    }
+
+    std::vector<Parameter> Dense::parameters()
+    {
+        if(dw.rows!=w.rows||dw.cols!=w.cols) {dw=Matrix::zeros(w.rows,w.cols); db=Matrix::zeros(1,b.cols);}
+        return {{&w(0,0),&dw(0,0),(size_t)w.rows*w.cols},{&b(0,0),&db(0,0),(size_t)b.cols}};
+    }
+
+    void Dense::bind(real*& values,real*& grads)
+    {
+        parameters();
+        place(w,values);
+        place(b,values);
+        place(dw,grads);
+        place(db,grads);
     }
 
     void Dense::save(std::ofstream& file) 
@@ -72,9 +90,26 @@
         b.save(file);
     }
 
-    void Dense::load(std::ifstream& file) 
+    void Dense::load(std::ifstream& file,size_t scalar_bytes) 
+    {
+        w.load(file,scalar_bytes);
+        b.load(file,scalar_bytes);
+    }
+
+    std::vector<double> Dense::arguments() const
+    {
+        return {(double)w.rows,(double)w.cols};
+    }
+
+    void Dense::write(ModelWriter& file) const
+    {
+        file.write(w);
+        file.write(b);
+    }
+
+    void Dense::read(ModelReader& file)
     {
-        w.load(file);
-        b.load(file);
+        file.read(w);
+        file.read(b);
     }
 
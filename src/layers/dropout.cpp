@@ -4,11 +4,11 @@
 
 Dropout::Dropout(double x) : x(x) {}
 
-Matrix Dropout::forward_pass(const Matrix& input)
+Matrix Dropout::forward_pass(const MatrixView& input)
 {
-    if (!this->is_training) return input * (1.0 - x);
-    mask = Matrix(input.rows, input.cols);
-    Matrix output(input.rows, input.cols);
+    if (!this->is_training) return Matrix(input) * (1.0 - x);
+    if (mask.rows != input.rows || mask.cols != input.cols) mask = Matrix::uninitialized(input.rows, input.cols);
+    Matrix output = Matrix::uninitialized(input.rows, input.cols);
 
     #pragma omp parallel 
     {
@@ -27,6 +27,16 @@ Matrix Dropout::forward_pass(const Matrix& input)
     return output;
 }
 
+Matrix Dropout::infer(const MatrixView& input, Scratch& scratch) const
+{
+    return Matrix(input) * (1.0 - x);
+}
+
+std::vector<double> Dropout::arguments() const
+{
+    return {x};
+}
+
 Matrix Dropout::backward_pass(const Matrix& delta, double learning_rate)
 {
     
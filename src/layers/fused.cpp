@@ -0,0 +1,151 @@
+#include "../../include/layers/fused.h"
+#include "../../include/layers/dense.h"
+#include "../../include/layers/conv2d.h"
+#include "../../include/layers/batchnorm.h"
+#include "../../include/layers/pooling.h"
+#include "../../include/core/gemm.h"
+#include "../../include/core/conv_engine.h"
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+FusedDense::FusedDense(const Dense& dense,const BatchNorm* bn,Activate act,double scale):w(dense.w),b(dense.b),act(act),scale(scale)
+{
+    if(!bn) return;
+    if(bn->features!=w.cols) throw std::invalid_argument("BatchNorm size does not match the Dense output");
+    for(int j=0;j<w.cols;j++)
+    {
+        double s=bn->g(0,j)/std::sqrt(bn->var(0,j)+bn->e);
+        for(int i=0;i<w.rows;i++) w(i,j)*=s;
+        b(0,j)=(b(0,j)-bn->mean(0,j))*s+bn->b(0,j);
+    }
+}
+
+Matrix FusedDense::forward_pass(const MatrixView& input)
+{
+    Scratch none;
+    return infer(input,none);
+}
+
+//The CPU gemm, like FusedConv2D and Dense::infer
+Matrix FusedDense::infer(const MatrixView& input,Scratch& scratch) const
+{
+    if(input.cols!=w.rows) throw std::invalid_argument("Dimension mismatch");
+    Matrix output=Matrix::uninitialized(input.rows,w.cols);
+    gemm(false,false,input.rows,w.cols,w.rows,1.0,input.data,input.stride,w.view().data,w.cols,0.0,&output(0,0),w.cols);
+    #pragma omp parallel for
+    for(int i=0;i<output.rows;i++)
+    {
+        for(int j=0;j<output.cols;j++)
+        {
+            real x=output(i,j)+b(0,j);
+            if(act) x=act(x);
+            output(i,j)=x*scale;
+        }
+    }
+    return output;
+}
+
+Matrix FusedDense::backward_pass(const Matrix& delta,double learning_rate)
+{
+    throw std::logic_error("FusedDense is inference only");
+}
+
+FusedConv2D::FusedConv2D(const Conv2D& conv,const BatchNorm* bn,Activate act,const Pooling* pool,double scale):h(conv.h),w(conv.w),d(conv.d),f(conv.f),k(conv.k),stride(conv.stride),pad(conv.pad),dilation(conv.dilation),oh(conv.oh),ow(conv.ow),act(act),scale(scale)
+{
+    int pixels=oh*ow;
+    kernels=conv.kernels;
+
+    a=Matrix::uninitialized(1,f*pixels);
+    c=Matrix::uninitialized(1,f*pixels);
+    if(bn&&bn->features!=f*pixels) throw std::invalid_argument("BatchNorm size does not match the Conv2D output");
+    for(int i=0;i<f;i++)
+    {
+        for(int p=0;p<pixels;p++)
+        {
+            int j=i*pixels+p;
+            if(!bn)
+            {
+                a(0,j)=1.0;
+                c(0,j)=conv.b(0,i);
+                continue;
+            }
+            double s=bn->g(0,j)/std::sqrt(bn->var(0,j)+bn->e);
+            a(0,j)=s;
+            c(0,j)=(conv.b(0,i)-bn->mean(0,j))*s+bn->b(0,j);
+        }
+    }
+
+    if(pool)
+    {
+        if(pool->h!=oh||pool->w!=ow||pool->d!=f) throw std::invalid_argument("Pooling size does not match the Conv2D output");
+        pooled=true;
+        pool_shape=pool->shape;
+        ph=pool->oh;
+        pw=pool->ow;
+    }
+}
+
+Matrix FusedConv2D::forward_pass(const MatrixView& input)
+{
+    Scratch scratch;
+    return infer(input,scratch);
+}
+
+/*
+The convolution of the whole batch goes through the autotuned engine (im2col, direct or Winograd), straight into the
+output when nothing is pooled; the epilogue then runs over every sample in one pass.
+*/
+Matrix FusedConv2D::infer(const MatrixView& input,Scratch& scratch) const
+{
+    int pixels=oh*ow;
+    Matrix output=Matrix::uninitialized(input.rows,pooled?f*ph*pw:f*pixels);
+    const real* A=a.view().data;
+    const real* C=c.view().data;
+
+    //the engine reads the batch sample after sample, a strided view is copied into scratch first
+    size_t copied=input.contiguous()?0:(size_t)input.rows*input.cols;
+    real* buffer=scratch.get(copied+(pooled?(size_t)input.rows*f*pixels:0));
+    const real* samples=input.data;
+    if(copied)
+    {
+        for(int r=0;r<input.rows;r++) std::copy(input.row(r),input.row(r)+input.cols,buffer+(size_t)r*input.cols);
+        samples=buffer;
+    }
+    real* conv=pooled?buffer+copied:&output(0,0);
+    conv_forward({input.rows,h,w,d,f,k,stride,pad,dilation},samples,kernels.view().data,conv);
+
+    #pragma omp parallel for
+    for(int r=0;r<input.rows;r++)
+    {
+        real* z=conv+(size_t)r*f*pixels;
+        if(!pooled)
+        {
+            for(int j=0;j<f*pixels;j++)
+            {
+                real x=A[j]*z[j]+C[j];
+                if(act) x=act(x);
+                z[j]=x*scale;
+            }
+            continue;
+        }
+        real* out=&output(r,0);
+        for(int j=0;j<f*pixels;j++)
+        {
+            real x=A[j]*z[j]+C[j];
+            z[j]=act?act(x):x;
+        }
+        for(int depth=0;depth<f;depth++) pool_forward(pool_shape,z+(size_t)depth*pixels,out+(size_t)depth*ph*pw,(uint8_t*)nullptr);
+        if(scale!=1.0)
+        {
+            for(int j=0;j<f*ph*pw;j++) out[j]*=scale;
+        }
+    }
+    return output;
+}
+
+Matrix FusedConv2D::backward_pass(const Matrix& delta,double learning_rate)
+{
+    throw std::logic_error("FusedConv2D is inference only");
+}
@@ -1,2 +1,15 @@
 #include "../include/layers/layer.h"
+#include <algorithm>
 
+void Layer::update(double learning_rate)
+{
+    optimizer.step(parameters(),learning_rate);
+}
+
+void Layer::place(Matrix& tensor,real*& at)
+{
+    size_t n=(size_t)tensor.rows*tensor.cols;
+    if(n>0) std::copy(&tensor(0,0),&tensor(0,0)+n,at);
+    tensor=Matrix::borrow(at,tensor.rows,tensor.cols);
+    at+=n;
+}
@@ -1,155 +1,262 @@
 #include "../include/layers/lstm.h"
 #include "../include/core/utils.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    /*
+    Bias, gate activations and cell update of one sequence, z holds the four gate pre-activations and is
+    overwritten with the activated gates
+    */
+    void cell_forward(real* z,const real* b,const real* c_prev,real* c,real* h,int H)
+    {
+        real* f=z;
+        real* u=z+H;
+        real* g=z+2*H;
+        real* o=z+3*H;
+        #pragma omp simd
+        for(int j=0;j<H;j++)
+        {
+            f[j]=sigmoid(f[j]+b[j]);
+            u[j]=sigmoid(u[j]+b[H+j]);
+            g[j]=tanh_(g[j]+b[2*H+j]);
+            o[j]=sigmoid(o[j]+b[3*H+j]);
+            c[j]=f[j]*c_prev[j]+u[j]*g[j];
+            h[j]=o[j]*std::tanh(c[j]);
+        }
+    }
+
+    //Gradient of the four gate pre-activations of one sequence, dc carries the cell gradient to the step before
+    void cell_backward(const real* gates,const real* c_prev,const real* c,const real* dh,const real* dh_next,real* dc,real* dz,int H)
+    {
+        const real* f=gates;
+        const real* u=gates+H;
+        const real* g=gates+2*H;
+        const real* o=gates+3*H;
+        #pragma omp simd
+        for(int j=0;j<H;j++)
+        {
+            real tanh_c=std::tanh(c[j]);
+            real da=dh[j]+dh_next[j];
+            real dcell=da*o[j]*dtanh(tanh_c)+dc[j];
+            dz[j]=dcell*c_prev[j]*dsigmoid(f[j]);
+            dz[H+j]=dcell*g[j]*dsigmoid(u[j]);
+            dz[2*H+j]=dcell*u[j]*dtanh(g[j]);
+            dz[3*H+j]=da*tanh_c*dsigmoid(o[j]);
+            dc[j]=dcell*f[j];
+        }
+    }
+}
 
 LSTM::LSTM(int input_size,int hidden_size):input_size(input_size),hidden_size(hidden_size)
 {
     //Xavier init
     double s=std::sqrt(1.0/hidden_size);
+    W=Matrix::random(input_size+hidden_size,4*hidden_size,-s,s);
+    //Forget gate bias of 1 so the cell state is kept early in training
+    b=Matrix::zeros(1,4*hidden_size);
+    for(int j=0;j<hidden_size;j++) b(0,j)=1.0;
 
-    Wfx=Matrix::random(hidden_size,input_size,-s,s);
-    Wfa=Matrix::random(hidden_size,hidden_size,-s,s);
-    bf=Matrix::ones(hidden_size,1);
-
-    Wux=Matrix::random(hidden_size,input_size,-s,s);
-    Wua=Matrix::random(hidden_size,hidden_size,-s,s);
-    bu=Matrix::zeros(hidden_size,1);
-
-    Wcx=Matrix::random(hidden_size,input_size,-s,s);
-    Wca=Matrix::random(hidden_size,hidden_size,-s,s);
-    bc=Matrix::zeros(hidden_size,1);
-
-    Wox=Matrix::random(hidden_size,input_size,-s,s);
-    Woa=Matrix::random(hidden_size,hidden_size,-s,s);
-    bo=Matrix::zeros(hidden_size,1);
-
-    dWfx=Matrix::zeros(hidden_size,input_size); dWfa=Matrix::zeros(hidden_size,hidden_size); dbf=Matrix::zeros(hidden_size,1);
-    dWux=Matrix::zeros(hidden_size,input_size); dWua=Matrix::zeros(hidden_size,hidden_size); dbu=Matrix::zeros(hidden_size,1);
-    dWcx=Matrix::zeros(hidden_size,input_size); dWca=Matrix::zeros(hidden_size,hidden_size); dbc=Matrix::zeros(hidden_size,1);
-    dWox=Matrix::zeros(hidden_size,input_size); dWoa=Matrix::zeros(hidden_size,hidden_size); dbo=Matrix::zeros(hidden_size,1);
-
-    mWfx=Matrix::zeros(hidden_size,input_size); vWfx=Matrix::zeros(hidden_size,input_size);
-    mWfh=Matrix::zeros(hidden_size,hidden_size); vWfh=Matrix::zeros(hidden_size,hidden_size);
-    mbf=Matrix::zeros(hidden_size,1); vbf=Matrix::zeros(hidden_size,1);
-
-    mWix=Matrix::zeros(hidden_size,input_size); vWix=Matrix::zeros(hidden_size,input_size);
-    mWih=Matrix::zeros(hidden_size,hidden_size); vWih=Matrix::zeros(hidden_size,hidden_size);
-    mbi=Matrix::zeros(hidden_size,1); vbi=Matrix::zeros(hidden_size,1);
-
-    mWcx=Matrix::zeros(hidden_size,input_size); vWcx=Matrix::zeros(hidden_size,input_size);
-    mWch=Matrix::zeros(hidden_size,hidden_size); vWch=Matrix::zeros(hidden_size,hidden_size);
-    mbc=Matrix::zeros(hidden_size,1); vbc=Matrix::zeros(hidden_size,1);
-
-    mWox=Matrix::zeros(hidden_size,input_size); vWox=Matrix::zeros(hidden_size,input_size);
-    mWoh=Matrix::zeros(hidden_size,hidden_size); vWoh=Matrix::zeros(hidden_size,hidden_size);
-    mbo=Matrix::zeros(hidden_size,1); vbo=Matrix::zeros(hidden_size,1);
-
-    t=0;
+    dW=Matrix::zeros(W.rows,W.cols); db=Matrix::zeros(1,b.cols);
 }
 
 std::vector<Matrix> LSTM::forward_pass(const std::vector<Matrix>& input)
 {
-    x_cache=input;
-    cache.clear();
-    std::vector<Matrix> outputs;
+    State state=start(input.empty()?0:input[0].rows);
+    return forward_pass(input,state);
+}
 
-    Matrix a_prev=Matrix::zeros(hidden_size,1);
-    Matrix c_prev=Matrix::zeros(hidden_size,1);
+std::vector<Matrix> LSTM::forward_pass(const std::vector<Matrix>& input,State& state)
+{
+    int steps=input.size();
+    int batch=state.streams();
+    int k=std::max(1,checkpoint_every);
+    if(zero_state.rows!=batch) zero_state=Matrix::zeros(batch,hidden_size);
+    cached_steps=steps;
+    cached_every=k;
+    checkpoints.assign(1,state);
+    inputs.clear();
+    cache.clear();
+    cache.resize(k>1?std::min(k,steps):steps);
+    std::vector<Matrix> outputs(steps);
 
-    for(const auto& x:input)
+    for(int s=0;s<steps;s++)
     {
-        Cache s;
-        s.f=((Wfx*x)+(Wfa*a_prev)+bf).apply(sigmoid);
-        s.u=((Wux*x)+(Wua*a_prev)+bu).apply(sigmoid);
-        s.c_=((Wcx*x)+(Wca*a_prev)+bc).apply(tanh_);
-        s.o=((Wox*x)+(Woa*a_prev)+bo).apply(sigmoid);
-
-        s.c=s.f.Hadamard(c_prev)+s.u.Hadamard(s.c_);
-        
-        Matrix tanh_c=s.c.apply(std::tanh);
-        s.a=s.o.Hadamard(tanh_c);
-
-        outputs.push_back(s.a);
-        cache.push_back(s);
-
-        a_prev=s.a;
-        c_prev=s.c;
+        const Matrix& x=input[s];
+        if(x.rows!=batch||x.cols!=input_size) throw std::invalid_argument("LSTM input steps must all be streams x input_size");
+        if(batch==0) continue;
+        MatrixView h_prev=s>0?outputs[s-1]:state.h;
+        if(k==1)
+        {
+            run_step(x,h_prev,s>0?cache[s-1].c:state.c,cache[s],outputs[s]);
+            continue;
+        }
+        //Checkpointing cycles through the cache of one segment, keeping only the state where each segment starts
+        if(s%k==0&&s>0)
+        {
+            State checkpoint;
+            checkpoint.h=outputs[s-1];
+            checkpoint.c=cache[(s-1)%k].c;
+            checkpoints.push_back(std::move(checkpoint));
+        }
+        inputs.push_back(x);
+        run_step(x,h_prev,s%k==0?checkpoints.back().c:cache[(s-1)%k].c,cache[s%k],outputs[s]);
+    }
+    if(steps>0&&batch>0)
+    {
+        state.h=outputs.back();
+        state.c=cache[(steps-1)%cache.size()].c;
     }
     return outputs;
 }
 
+void LSTM::run_step(const MatrixView& x,const MatrixView& h_prev,const MatrixView& c_prev,Cache& step,Matrix& h) const
+{
+    int batch=x.rows,I=input_size,H=hidden_size;
+    step.xh=Matrix::uninitialized(batch,I+H);
+    for(int r=0;r<batch;r++)
+    {
+        std::copy(x.row(r),x.row(r)+I,&step.xh(r,0));
+        std::copy(h_prev.row(r),h_prev.row(r)+H,&step.xh(r,I));
+    }
+    step.gates=Matrix::matmul(step.xh,W);
+    step.c=Matrix::uninitialized(batch,H);
+    h=Matrix::uninitialized(batch,H);
+    const real* bias=MatrixView(b).data;
+    for(int r=0;r<batch;r++) cell_forward(&step.gates(r,0),bias,c_prev.row(r),&step.c(r,0),&h(r,0),H);
+}
+
+void LSTM::recompute(int begin,int end)
+{
+    const State& from=checkpoints[begin/cached_every];
+    Matrix h[2];
+    for(int s=begin;s<end;s++)
+    {
+        int i=s-begin;
+        run_step(inputs[s],i>0?MatrixView(h[(i-1)%2]):MatrixView(from.h),i>0?MatrixView(cache[i-1].c):MatrixView(from.c),cache[i],h[i%2]);
+    }
+}
+
 std::vector<Matrix> LSTM::backward_pass(const std::vector<Matrix>& delta)
 {
     int steps=delta.size();
+    int batch=zero_state.rows;
+    int I=input_size,H=hidden_size;
+    if(steps!=cached_steps) throw std::invalid_argument("LSTM backward_pass needs a gradient slot for every step of the forward pass");
 
-    dWfx=Matrix::zeros(hidden_size,input_size); dWfa=Matrix::zeros(hidden_size,hidden_size); dbf=Matrix::zeros(hidden_size,1);
-    dWux=Matrix::zeros(hidden_size,input_size); dWua=Matrix::zeros(hidden_size,hidden_size); dbu=Matrix::zeros(hidden_size,1);
-    dWcx=Matrix::zeros(hidden_size,input_size); dWca=Matrix::zeros(hidden_size,hidden_size); dbc=Matrix::zeros(hidden_size,1);
-    dWox=Matrix::zeros(hidden_size,input_size); dWoa=Matrix::zeros(hidden_size,hidden_size); dbo=Matrix::zeros(hidden_size,1);
-
-    Matrix da_next=Matrix::zeros(hidden_size,1);
-    Matrix dc_next=Matrix::zeros(hidden_size,1);
+    dW=Matrix::zeros(W.rows,W.cols);
+    db=Matrix::zeros(1,b.cols);
     std::vector<Matrix> dx(steps);
+    if(batch==0) return dx;
+
+    Matrix dh_next=Matrix::zeros(batch,H);
+    Matrix dc=Matrix::zeros(batch,H);
+    Matrix dz=Matrix::uninitialized(batch,4*H);
+    //False while no gradient flows yet (or again, after a truncation), those steps are skipped
+    bool live=false;
 
-    for(int i=steps-1;i>=0;--i)
+    for(int end=steps;end>0;)
     {
-        Cache s=cache[i];
-        Matrix c_prev=(i>0)?cache[i-1].c:Matrix::zeros(hidden_size,1);
-        Matrix x=x_cache[i];
-
-        Matrix da=delta[i]+da_next;
-        Matrix tanh_c=s.c.apply(std::tanh);
-
-        Matrix do_=da.Hadamard(tanh_c).Hadamard(s.o.apply(dsigmoid));
-        
-        Matrix dc=da.Hadamard(s.o).Hadamard(tanh_c.apply(dtanh))+dc_next;
-        
-        Matrix dc_=dc.Hadamard(s.u).Hadamard(s.c_.apply(dtanh));
-        Matrix du=dc.Hadamard(s.c_).Hadamard(s.u.apply(dsigmoid));
-        Matrix df=dc.Hadamard(c_prev).Hadamard(s.f.apply(dsigmoid));
-
-        dWfx=dWfx+(df*x.transpose());
-        dWux=dWux+(du*x.transpose());
-        dWcx=dWcx+(dc_*x.transpose());
-        dWox=dWox+(do_*x.transpose());
-        
-        dbf=dbf+df; dbu=dbu+du; dbc=dbc+dc_; dbo=dbo+do_;
-
-        if(i>0)
+        int begin=cached_every>1?(end-1)/cached_every*cached_every:0;
+        if(cached_every>1) recompute(begin,end);
+        int offset=cached_every>1?begin:0;
+        MatrixView c_begin=checkpoints[begin/cached_every].c;
+
+        for(int s=end-1;s>=begin;--s)
         {
-            Matrix a_prev_T=cache[i-1].a.transpose();
-            dWfa=dWfa+(df*a_prev_T);
-            dWua=dWua+(du*a_prev_T);
-            dWca=dWca+(dc_*a_prev_T);
-            dWoa=dWoa+(do_*a_prev_T);
-        }
+            if(bptt_steps>0&&live&&(s+1)%bptt_steps==0)
+            {
+                std::fill(&dh_next(0,0),&dh_next(0,0)+batch*H,0.0);
+                std::fill(&dc(0,0),&dc(0,0)+batch*H,0.0);
+                live=false;
+            }
+            if(delta[s].rows>0) live=true;
+            if(!live)
+            {
+                dx[s]=Matrix::zeros(batch,I);
+                continue;
+            }
+            const Cache& step=cache[s-offset];
+            MatrixView gates=step.gates,c=step.c;
+            MatrixView c_prev=s>begin?cache[s-1-offset].c:c_begin;
+            //Steps without a gradient of their own only pass on the one from the step after
+            MatrixView dh=delta[s].rows>0?delta[s]:zero_state;
+            if(dh.rows!=batch||dh.cols!=H) throw std::invalid_argument("LSTM gradients must be streams x hidden_size");
+            for(int r=0;r<batch;r++) cell_backward(gates.row(r),c_prev.row(r),c.row(r),dh.row(r),&dh_next(r,0),&dc(r,0),&dz(r,0),H);
 
-        dc_next=dc.Hadamard(s.f);
-        da_next=(Wfa.transpose()*df)+(Wua.transpose()*du)+(Wca.transpose()*dc_)+(Woa.transpose()*do_);
-        
-        dx[i]=(Wfx.transpose()*df)+(Wux.transpose()*du)+(Wcx.transpose()*dc_)+(Wox.transpose()*do_);
+            dW.add_matmul(step.xh,dz,true,false);
+            db+=dz.sum_rows();
+            Matrix dxh=Matrix::matmul(dz,W,false,true);
+            dx[s]=Matrix(dxh.view().columns(0,I));
+            for(int r=0;r<batch;r++) std::copy(&dxh(r,I),&dxh(r,I)+H,&dh_next(r,0));
+        }
+        end=begin;
     }
     return dx;
 }
 
+size_t LSTM::cache_bytes() const
+{
+    size_t count=0;
+    for(const Cache& step:cache) count+=(size_t)step.xh.rows*step.xh.cols+(size_t)step.gates.rows*step.gates.cols+(size_t)step.c.rows*step.c.cols;
+    for(const Matrix& x:inputs) count+=(size_t)x.rows*x.cols;
+    for(const State& state:checkpoints) count+=(size_t)state.h.rows*state.h.cols*2;
+    return count*sizeof(real);
+}
+
 void LSTM::update(double learning_rate)
 {
-    t++;
-    auto adam=[&](Matrix& w,Matrix& dw,Matrix& m,Matrix& v)
-    {
-        double b1=0.9,b2=0.999,e=1e-8;
-        m=(m*b1)+(dw*(1.0-b1));
-        v=(v*b2)+(dw.Hadamard(dw*(1-b2)));
+    optimizer.step(parameters(),learning_rate);
+}
+
+std::vector<Parameter> LSTM::parameters()
+{
+    return {{&W(0,0),&dW(0,0),(size_t)W.rows*W.cols},{&b(0,0),&db(0,0),(size_t)b.cols}};
+}
 
-        double m_=1/(1.0-std::pow(b1,t)),v_=1/(1.0-std::pow(b2,t));
-        Matrix m_hat=m*m_;
-        Matrix v_hat=v*v_;
+LSTM::State LSTM::start(int streams) const
+{
+    State state;
+    state.h=Matrix::zeros(streams,hidden_size);
+    state.c=Matrix::zeros(streams,hidden_size);
+    return state;
+}
 
-        for(int i=0;i<w.rows;i++)for(int j=0;j<w.cols;j++)w(i,j)-=learning_rate*m_hat(i,j)/(std::sqrt(v_hat(i,j))+e);
+Matrix LSTM::step(const MatrixView& x,State& state) const
+{
+    std::vector<State*> states(1,&state);
+    return step(x,states);
+}
 
-    };
+Matrix LSTM::step(const MatrixView& x,const std::vector<State*>& states) const
+{
+    int I=input_size,H=hidden_size;
+    int batch=0;
+    for(const State* state:states) batch+=state->streams();
+    if(x.rows!=batch||x.cols!=I) throw std::invalid_argument("LSTM step needs one row of input_size values per stream");
+    if(batch==0) return Matrix();
 
-    adam(Wfx,dWfx,mWfx,vWfx); adam(Wfa,dWfa,mWfh,vWfh); adam(bf,dbf,mbf,vbf);
-    adam(Wux,dWux,mWix,vWix); adam(Wua,dWua,mWih,vWih); adam(bu,dbu,mbi,vbi);
-    adam(Wcx,dWcx,mWcx,vWcx); adam(Wca,dWca,mWch,vWch); adam(bc,dbc,mbc,vbc);
-    adam(Wox,dWox,mWox,vWox); adam(Woa,dWoa,mWoh,vWoh); adam(bo,dbo,mbo,vbo);
+    //Rows of the states side by side with the frames, so all streams go through one GEMM
+    std::vector<real*> h(batch),c(batch);
+    Matrix xh=Matrix::uninitialized(batch,I+H);
+    for(int i=0,r=0;i<(int)states.size();i++)
+    {
+        for(int k=0;k<states[i]->streams();k++,r++)
+        {
+            h[r]=&states[i]->h(k,0);
+            c[r]=&states[i]->c(k,0);
+            std::copy(x.row(r),x.row(r)+I,&xh(r,0));
+            std::copy(h[r],h[r]+H,&xh(r,I));
+        }
+    }
+    Matrix gates=Matrix::matmul(xh,W);
+    Matrix output=Matrix::uninitialized(batch,H);
+    const real* bias=MatrixView(b).data;
+    for(int r=0;r<batch;r++)
+    {
+        cell_forward(&gates(r,0),bias,c[r],c[r],&output(r,0),H);
+        std::copy(&output(r,0),&output(r,0)+H,h[r]);
+    }
+    return output;
 }
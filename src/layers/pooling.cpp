@@ -1,57 +1,76 @@
 #include "../../include/layers/pooling.h"
 #include <iostream>
 #include <algorithm>
+#include <stdexcept>
 
-Pooling::Pooling(int h,int w,int d,int pool_size,int stride):h(h),w(w),d(d),pool_size(pool_size),stride(stride)
+Pooling::Pooling(int h,int w,int d,int pool_size,int stride,int pad,int dilation,PoolMode mode):h(h),w(w),d(d),pool_size(pool_size),stride(stride),pad(pad),dilation(dilation)
 {
-    oh=(h-pool_size)/stride+1;
-    ow=(w-pool_size)/stride+1;
+    int extent=dilation*(pool_size-1)+1;
+    if(pool_size<1||stride<1||dilation<1||pad<0||2*pad>extent) throw std::invalid_argument("Pooling needs positive sizes and at most half a window of padding");
+    if(pool_size>256) throw std::invalid_argument("Pooling windows are at most 256 wide");
+    shape={h,w,pool_size,stride,pad,dilation,mode};
+    oh=shape.oh();
+    ow=shape.ow();
 }
 
-Matrix Pooling::forward_pass(const Matrix& input)
-{   
-    this->input = input;
-    Matrix output(input.rows,oh*ow*d);
-    max_cache.assign(input.rows,std::vector<int>(oh*ow*d));
-    
-    #pragma omp parallel for
+void Pooling::pool(const MatrixView& input,Matrix& output,uint8_t* argmax) const
+{
+    size_t index_bytes=shape.wide_index()?sizeof(uint16_t):sizeof(uint8_t);
+    #pragma omp parallel for collapse(2)
     for(int r=0;r<input.rows;r++)
     {
         for(int depth=0;depth<d;depth++)
         {
-            for(int i=0;i<oh;i++)
-            {
-                for(int j=0;j<ow;j++)
-                {
-                    double max_=-DBL_MAX;
-                    int index=-1;
-                    for(int p_i=0;p_i<pool_size;p_i++)
-                    {
-                        for(int p_j=0;p_j<pool_size;p_j++)
-                        {
-                            if(i*stride+p_i<h && j*stride+p_j<w)
-                            {
-                                if(input(r,depth*h*w+(i*stride+p_i)*w+(j*stride+p_j))>max_)
-                                {
-                                    max_=input(r,depth*h*w+(i*stride+p_i)*w+(j*stride+p_j));
-                                    index=depth*h*w+(i*stride+p_i)*w+(j*stride+p_j);
-                                }
-                            }
-                        }
-                    }
-                    output(r,depth*oh*ow+i*ow+j)=max_;
-                    max_cache[r][depth*oh*ow+i*ow+j]=index;
-                }
-            }
+            const real* in=input.row(r)+(size_t)depth*h*w;
+            real* out=&output(r,0)+(size_t)depth*oh*ow;
+            uint8_t* at=argmax?argmax+((size_t)r*d+depth)*oh*ow*index_bytes:nullptr;
+            if(shape.wide_index()) pool_forward(shape,in,out,(uint16_t*)at);
+            else pool_forward(shape,in,out,at);
         }
     }
+}
+
+Matrix Pooling::forward_pass(const MatrixView& input)
+{   
+    this->input = input;
+    Matrix output=Matrix::uninitialized(input.rows,oh*ow*d);
+    bool keep=is_training&&shape.mode==PoolMode::Max;
+    indexed=keep;
+    if(keep) argmax.resize((size_t)input.rows*d*oh*ow*(shape.wide_index()?sizeof(uint16_t):sizeof(uint8_t)));
+    pool(input,output,keep?argmax.data():nullptr);
     return output;
 }
 
+Matrix Pooling::infer(const MatrixView& input,Scratch& scratch) const
+{
+    Matrix output=Matrix::uninitialized(input.rows,oh*ow*d);
+    pool(input,output,nullptr);
+    return output;
+}
+
+std::vector<double> Pooling::arguments() const
+{
+    return {(double)h,(double)w,(double)d,(double)pool_size,(double)stride,(double)pad,(double)dilation,(double)shape.mode};
+}
+
 Matrix Pooling::backward_pass(const Matrix& delta,double learning_rate)
 {
-    Matrix prev_delta=Matrix::zeros(input.rows,d*h*w);
-    #pragma omp parallel for
-    for(int i=0;i<input.rows;i++)for(int j=0;j<delta.cols;j++)prev_delta(i,max_cache[i][j])+=delta(i,j);
+    if(shape.mode==PoolMode::Max&&(!indexed||argmax.size()<(size_t)delta.rows*d*oh*ow)) throw std::logic_error("Pooling::backward_pass needs a forward_pass in training first");
+    Matrix prev_delta=Matrix::uninitialized(delta.rows,d*h*w);
+    MatrixView gradient=delta.view();
+    size_t index_bytes=shape.wide_index()?sizeof(uint16_t):sizeof(uint8_t);
+    bool max=shape.mode==PoolMode::Max;
+    #pragma omp parallel for collapse(2)
+    for(int r=0;r<delta.rows;r++)
+    {
+        for(int depth=0;depth<d;depth++)
+        {
+            const real* g=gradient.row(r)+(size_t)depth*oh*ow;
+            real* prev=&prev_delta(r,0)+(size_t)depth*h*w;
+            const uint8_t* at=max?argmax.data()+((size_t)r*d+depth)*oh*ow*index_bytes:nullptr;
+            if(shape.wide_index()) pool_backward(shape,g,(const uint16_t*)at,prev);
+            else pool_backward(shape,g,at,prev);
+        }
+    }
     return prev_delta;
 }
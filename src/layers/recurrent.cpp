@@ -1,6 +1,8 @@
 #include "../include/layers/recurrent.h"
 #include "../include/core/utils.h"
-#include <iostream>>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 Recurrent::Recurrent(int input_size,int hidden_size):input_size(input_size), hidden_size(hidden_size)
 {
@@ -13,34 +15,50 @@ Recurrent::Recurrent(int input_size,int hidden_size):input_size(input_size), hid
     dWax=Matrix::zeros(hidden_size,input_size);
     dWaa=Matrix::zeros(hidden_size,hidden_size);
     dba =Matrix::zeros(hidden_size,1);
-
-    mWax = Matrix::zeros(hidden_size,input_size);vWax = Matrix::zeros(hidden_size,input_size);
-    mWaa = Matrix::zeros(hidden_size,hidden_size);vWaa = Matrix::zeros(hidden_size,hidden_size);
-    mba  = Matrix::zeros(hidden_size,1);vba  = Matrix::zeros(hidden_size,1);
-    t = 0;
 }
 
 std::vector<Matrix> Recurrent::forward_pass(const std::vector<Matrix>& input)
 {
+    State state=start();
+    return forward_pass(input,state);
+}
+
+std::vector<Matrix> Recurrent::forward_pass(const std::vector<Matrix>& input,State& state)
+{
+    if(state.streams()!=1) throw std::invalid_argument("Recurrent forward_pass runs one sequence, the state must hold one stream");
+    int k=std::max(1,checkpoint_every);
+    cached_every=k;
     x_cache=input;
     a_cache.clear();
+    checkpoints.assign(1,state.h.transpose());
     std::vector<Matrix> output;
 
-    Matrix a_t_1=Matrix::zeros(hidden_size,1);
-    for(const auto& x_t:input)
+    Matrix a_t_1=checkpoints[0];
+    for(int t=0;t<(int)input.size();t++)
     {
-        Matrix z_t=(Wax*x_t)+(Waa*a_t_1)+ba;
-        Matrix a_t=z_t.apply(tanh_);
-        output.push_back(a_t);
-        a_cache.push_back(a_t);
+        if(k>1&&t%k==0&&t>0) checkpoints.push_back(a_t_1);
+        Matrix a_t=cell(input[t],a_t_1);
         a_t_1=a_t;
+        output.push_back(a_t);
+        if(k==1) a_cache.push_back(std::move(a_t));
     }
+    if(!input.empty()) state.h=a_t_1.transpose();
     return output;
 }
 
+Matrix Recurrent::cell(const Matrix& x,const Matrix& a_prev) const
+{
+    Matrix a=Wax*x;
+    a.add_matmul(Waa,a_prev);
+    a+=ba;
+    a.apply_inplace(tanh_);
+    return a;
+}
+
 std::vector<Matrix> Recurrent::backward_pass(const std::vector<Matrix>& delta)
 {
     int time=delta.size();
+    if(time!=(int)x_cache.size()) throw std::invalid_argument("Recurrent backward_pass needs a gradient for every step of the forward pass");
     dWax=Matrix::zeros(hidden_size,input_size);
     dWaa=Matrix::zeros(hidden_size,hidden_size);
     dba=Matrix::zeros(hidden_size,1);
@@ -48,36 +66,92 @@ std::vector<Matrix> Recurrent::backward_pass(const std::vector<Matrix>& delta)
     Matrix delta_t=Matrix::zeros(hidden_size,1);
     std::vector<Matrix> prev_delta(time);
 
-    for(int t=time-1;t>=0;t--)
-    {  
-        Matrix da=delta[t]+delta_t;
-        Matrix dz=da.Hadamard(a_cache[t].apply(dtanh));
-        dWax=dWax+(dz*x_cache[t].transpose());
-        if(t!=0) dWaa=dWaa+(dz*a_cache[t-1].transpose());
-        dba=dba+dz;
-        delta_t=Waa.transpose()*dz;
-        prev_delta[t]=Wax.transpose()*dz;
+    for(int end=time;end>0;)
+    {
+        //Checkpointed segments are recomputed into a_cache from the state where they start
+        int begin=cached_every>1?(end-1)/cached_every*cached_every:0;
+        const Matrix& a_begin=checkpoints[begin/cached_every];
+        if(cached_every>1)
+        {
+            a_cache.clear();
+            for(int t=begin;t<end;t++) a_cache.push_back(cell(x_cache[t],t>begin?a_cache.back():a_begin));
+        }
+        int offset=cached_every>1?begin:0;
+
+        for(int t=end-1;t>=begin;t--)
+        {
+            if(bptt_steps>0&&(t+1)%bptt_steps==0) delta_t=Matrix::zeros(hidden_size,1);
+            Matrix da=delta[t]+delta_t;
+            Matrix dz=da.Hadamard(a_cache[t-offset].apply(dtanh));
+            dWax.add_matmul(dz,x_cache[t],false,true);
+            dWaa.add_matmul(dz,t>begin?a_cache[t-1-offset]:a_begin,false,true);
+            dba+=dz;
+            delta_t=Matrix::matmul(Waa,dz,true,false);
+            prev_delta[t]=Matrix::matmul(Wax,dz,true,false);
+        }
+        end=begin;
     }
     return prev_delta;
 }
 
 void Recurrent::update(double learning_rate)
 {
-    t++;
-    auto adam=[&](Matrix& w,Matrix& dw,Matrix& m,Matrix& v)
-    {
-        double b1=0.9,b2=0.999,e=1e-8;
-        m=(m*b1)+(dw*(1.0-b1));
-        v=(v*b2)+(dw.Hadamard(dw*(1-b2)));
+    optimizer.step(parameters(),learning_rate);
+}
 
-        double m_=1/(1.0-std::pow(b1,t)),v_=1/(1.0-std::pow(b2,t));
-        Matrix m_hat=m*m_;
-        Matrix v_hat=v*v_;
+std::vector<Parameter> Recurrent::parameters()
+{
+    return {{&Wax(0,0),&dWax(0,0),(size_t)Wax.rows*Wax.cols},{&Waa(0,0),&dWaa(0,0),(size_t)Waa.rows*Waa.cols},{&ba(0,0),&dba(0,0),(size_t)ba.rows}};
+}
 
-        for(int i=0;i<w.rows;i++)for(int j=0;j<w.cols;j++)w(i,j)-=learning_rate*m_hat(i,j)/(std::sqrt(v_hat(i,j))+e);
+size_t Recurrent::cache_bytes() const
+{
+    size_t count=0;
+    for(const Matrix& a:a_cache) count+=(size_t)a.rows*a.cols;
+    for(const Matrix& x:x_cache) count+=(size_t)x.rows*x.cols;
+    for(const Matrix& a:checkpoints) count+=(size_t)a.rows*a.cols;
+    return count*sizeof(real);
+}
+
+Recurrent::State Recurrent::start(int streams) const
+{
+    State state;
+    state.h=Matrix::zeros(streams,hidden_size);
+    return state;
+}
+
+Matrix Recurrent::step(const MatrixView& x,State& state) const
+{
+    std::vector<State*> states(1,&state);
+    return step(x,states);
+}
+
+Matrix Recurrent::step(const MatrixView& x,const std::vector<State*>& states) const
+{
+    int batch=0;
+    for(const State* state:states) batch+=state->streams();
+    if(x.rows!=batch||x.cols!=input_size) throw std::invalid_argument("Recurrent step needs one row of input_size values per stream");
+    if(batch==0) return Matrix();
 
-    };
-    adam(Wax,dWax,mWax,vWax);
-    adam(Waa,dWaa,mWaa,vWaa);
-    adam(ba,dba,mba,vba);
+    std::vector<real*> h(batch);
+    Matrix h_prev=Matrix::uninitialized(batch,hidden_size);
+    for(int i=0,r=0;i<(int)states.size();i++)
+    {
+        for(int k=0;k<states[i]->streams();k++,r++)
+        {
+            h[r]=&states[i]->h(k,0);
+            std::copy(h[r],h[r]+hidden_size,&h_prev(r,0));
+        }
+    }
+    //Rows of frames, so the weights of the column layout are applied transposed
+    Matrix a=Matrix::matmul(x,Wax,false,true);
+    a.add_matmul(h_prev,Waa,false,true);
+    const real* bias=MatrixView(ba).data;
+    for(int r=0;r<batch;r++)
+    {
+        real* row=&a(r,0);
+        for(int j=0;j<hidden_size;j++) row[j]=tanh_(row[j]+bias[j]);
+        std::copy(row,row+hidden_size,h[r]);
+    }
+    return a;
 }
@@ -3,10 +3,16 @@
 
 Softmax::Softmax(){}
 
-Matrix Softmax::forward_pass(const Matrix& input)
+Matrix Softmax::forward_pass(const MatrixView& input)
 {
     this->input=input;
-    Matrix output(input.rows,input.cols);
+    Scratch none;
+    return infer(input,none);
+}
+
+Matrix Softmax::infer(const MatrixView& input,Scratch& scratch) const
+{
+    Matrix output=Matrix::uninitialized(input.rows,input.cols);
     for(int i=0;i<input.rows;i++)
     {
         double max_=-1e9;
@@ -6,7 +6,13 @@ ZeroPad::ZeroPad(int h,int w,int d,int pad):h(h),w(w),d(d),pad(pad)
     ow=w+2*pad;
 }
 
-Matrix ZeroPad::forward_pass(const Matrix& input)
+Matrix ZeroPad::forward_pass(const MatrixView& input)
+{
+    Scratch none;
+    return infer(input,none);
+}
+
+Matrix ZeroPad::infer(const MatrixView& input, Scratch& scratch) const
 {
     Matrix output=Matrix::zeros(input.rows,d*oh*ow);
 
@@ -15,11 +21,17 @@ Matrix ZeroPad::forward_pass(const Matrix& input)
     return output;
 }
 
+std::vector<double> ZeroPad::arguments() const
+{
+    return {(double)h,(double)w,(double)d,(double)pad};
+}
+
 Matrix ZeroPad::backward_pass(const Matrix& delta,double learning_rate)
 {
-    Matrix prev_delta(input.rows,d*h*w);
+    Matrix prev_delta=Matrix::uninitialized(delta.rows,d*h*w);
     
+    //the gradient of the padding is dropped, the rest is cropped back out
     #pragma omp parallel for
-    for(int r=0;r<delta.rows;r++)for(int depth=0;depth<d;depth++)for(int i=0;i<h;i++)for(int j=0;j<w;j++)prev_delta(r,depth*oh*ow + (i+pad)*ow+j+pad)=input(r,depth*h*w+i*w+j);
+    for(int r=0;r<delta.rows;r++)for(int depth=0;depth<d;depth++)for(int i=0;i<h;i++)for(int j=0;j<w;j++)prev_delta(r,depth*h*w+i*w+j)=delta(r,depth*oh*ow + (i+pad)*ow+j+pad);
     return prev_delta;
 }
@@ -1,37 +1,380 @@
 #include "../include/network.h"
 #include "../include/core/utils.h"
+#include "../include/core/allocator.h"
+#include "../include/io/batch_loader.h"
+#include "../include/io/model_file.h"
+#include "../include/layers/fused.h"
+#include "../include/layers/dense.h"
+#include "../include/layers/conv2d.h"
+#include "../include/layers/batchnorm.h"
+#include "../include/layers/pooling.h"
+#include "../include/layers/dropout.h"
+#include "../include/activation.h"
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <exception>
+#include <omp.h>
+
+namespace
+{
+    double cross_entropy(const Matrix& output,const MatrixView& y)
+    {
+        double loss=0.0;
+        for(int r=0;r<output.rows;r++) for(int c=0;c<output.cols;c++) if(y(r,c)>0.0) loss-=y(r,c)*std::log(std::max<double>(output(r,c),1e-12));
+        return loss;
+    }
+
+    //Layers of the data-parallel workers after the first, whose layers are the network's own, with their arenas
+    struct Replicas
+    {
+        std::vector<std::vector<Layer*>> workers;
+        std::vector<Matrix> arenas;
+        ~Replicas() {for(auto& layers:workers) for(Layer* layer:layers) delete layer;}
+    };
+
+    std::vector<Parameter> parameters_of(const std::vector<Layer*>& layers)
+    {
+        std::vector<Parameter> tensors;
+        for(Layer* layer:layers)
+        {
+            std::vector<Parameter> own=layer->parameters();
+            tensors.insert(tensors.end(),own.begin(),own.end());
+        }
+        return tensors;
+    }
+
+    //True if the tensors lie end to end from the start of row 0 of arena, and their gradients the same way in row 1
+    bool in_arena(const std::vector<Parameter>& tensors,const Matrix& arena)
+    {
+        if(arena.rows<2) return false;
+        MatrixView rows(arena);
+        size_t at=0;
+        for(const Parameter& tensor:tensors)
+        {
+            if(tensor.value!=rows.row(0)+at||tensor.grad!=rows.row(1)+at) return false;
+            at+=tensor.size;
+        }
+        return at<=(size_t)arena.cols;
+    }
+
+    /*
+    Moves the parameters of layers to row 0 of arena, end to end in parameters() order, and their gradients to the
+    same places in row 1; the rows after those are the caller's and come back zeroed whenever the arena is rebuilt,
+    since a new layout or new tensors of the same total size would leave them matched to the wrong elements.
+    Nothing moves if they are there already, otherwise rebuilt is set. Returns both rows as one tensor, or the
+    tensors of the layers as they are when one of them does not support Layer::bind.
+    */
+    std::vector<Parameter> bind_arena(const std::vector<Layer*>& layers,Matrix& arena,int rows,bool& rebuilt)
+    {
+        std::vector<Parameter> tensors=parameters_of(layers);
+        rebuilt=!in_arena(tensors,arena);
+        if(rebuilt)
+        {
+            size_t total=tensor_offsets(tensors).back(),align=64/sizeof(real);
+            Matrix fresh=Matrix::zeros(rows,std::max(align,(total+align-1)/align*align));
+            real* values=&fresh(0,0);
+            real* grads=&fresh(1,0);
+            for(Layer* layer:layers) layer->bind(values,grads);
+            arena=std::move(fresh);
+            tensors=parameters_of(layers);
+            if(!in_arena(tensors,arena)) return tensors;
+        }
+        return {{&arena(0,0),&arena(1,0),tensor_offsets(tensors).back()}};
+    }
+
+    //Gradients and parameters are summed and copied in slices of this many elements, each owned by one thread
+    const size_t SLICE=16384;
+
+    //Parameters of the first worker copied to all the others
+    void broadcast(const std::vector<std::vector<Parameter>>& tensors)
+    {
+        int n=tensors.size();
+        if(n<2) return;
+        std::vector<size_t> offsets=tensor_offsets(tensors[0]);
+        long long slices=(offsets.back()+SLICE-1)/SLICE;
+        #pragma omp parallel for num_threads(n)
+        for(long long s=0;s<slices;s++)
+        {
+            for_tensor_range(offsets,s*SLICE,std::min<size_t>(offsets.back(),(s+1)*SLICE),[&](size_t i,size_t begin,size_t end)
+            {
+                const real* from=tensors[0][i].value;
+                for(int k=1;k<n;k++) std::copy(from+begin,from+end,tensors[k][i].value+begin);
+            });
+        }
+    }
+
+    /*
+    One data-parallel step: the rows of the batch are split over the workers, every one runs forward_pass and
+    gradient() on its share with its own layers. The gradients are then summed into the first worker's layers slice
+    by slice, every slice by one thread so nothing is locked, optimizer steps those layers and the new parameters are
+    copied back out to the others. tensors are those of every worker, one flat tensor each when they are in arenas.
+    Returns the summed loss, layer_seconds times the first worker.
+    */
+    double data_parallel_step(const std::vector<std::vector<Layer*>>& workers,const std::vector<std::vector<Parameter>>& tensors,const MatrixView& X,const MatrixView& y,Optimizer& optimizer,double learning_rate,std::vector<double>& layer_seconds)
+    {
+        typedef std::chrono::steady_clock clock;
+        int m=workers[0].size();
+        int n=std::min<int>(workers.size(),X.rows);
+        std::vector<double> loss(n,0.0);
+        std::exception_ptr error;
+        #pragma omp parallel for num_threads(n) schedule(static,1)
+        for(int k=0;k<n;k++)
+        {
+            try
+            {
+                const std::vector<Layer*>& layers=workers[k];
+                int begin=(long long)X.rows*k/n,end=(long long)X.rows*(k+1)/n;
+                MatrixView y_part=y.slice(begin,end);
+                std::vector<Matrix> activations(m);
+                auto t=clock::now();
+                auto lap=[&](int layer)
+                {
+                    if(k>0) return;
+                    auto now=clock::now();
+                    layer_seconds[layer]+=std::chrono::duration<double>(now-t).count();
+                    t=now;
+                };
+                activations[0]=layers[0]->forward_pass(X.slice(begin,end));
+                lap(0);
+                for(int j=1;j<m;j++)
+                {
+                    activations[j]=layers[j]->forward_pass(activations[j-1]);
+                    lap(j);
+                }
+                loss[k]=cross_entropy(activations[m-1],y_part);
+                Matrix delta=std::move(activations[m-1]);
+                delta-=y_part;
+                t=clock::now();
+                for(int j=m-1;j>=0;j--)
+                {
+                    delta=layers[j]->gradient(delta);
+                    lap(j);
+                }
+            }
+            catch(...)
+            {
+                #pragma omp critical
+                error=std::current_exception();
+            }
+        }
+        if(error) std::rethrow_exception(error);
+
+        std::vector<size_t> offsets=tensor_offsets(tensors[0]);
+        long long slices=(offsets.back()+SLICE-1)/SLICE;
+        #pragma omp parallel for num_threads(n)
+        for(long long s=0;s<slices;s++)
+        {
+            for_tensor_range(offsets,s*SLICE,std::min<size_t>(offsets.back(),(s+1)*SLICE),[&](size_t i,size_t begin,size_t end)
+            {
+                real* sum=tensors[0][i].grad;
+                for(int k=1;k<n;k++)
+                {
+                    const real* grad=tensors[k][i].grad;
+                    #pragma omp simd
+                    for(size_t e=begin;e<end;e++) sum[e]+=grad[e];
+                }
+            });
+        }
+
+        optimizer.step(tensors[0],learning_rate);
+        broadcast(tensors);
+
+        double total=0.0;
+        for(double part:loss) total+=part;
+        return total;
+    }
+}
 
 Network::~Network()
 {
+    clear_compiled();
     for(auto layer:layers) delete layer;
 }
 
 void Network::add(Layer* layer)
 {
+    clear_compiled();
     layers.push_back(layer);
 }
 
-Matrix Network::predict(const Matrix& input)
+Matrix Network::predict(const MatrixView& input)
+{
+    return infer(input);
+}
+
+Matrix Network::infer(const MatrixView& input,Scratch& scratch) const
 {
-    for (auto layer : layers) layer->is_training = false;
-    Matrix output=input;
-    for(auto layer:layers) output=layer->forward_pass(output);
+    const std::vector<Layer*>& run=compiled.empty()?layers:compiled;
+    if(run.empty()) return Matrix(input);
+    Matrix output=run[0]->infer(input,scratch);
+    for(size_t i=1;i<run.size();i++) output=run[i]->infer(output,scratch);
     return output;
 }
 
-void Network::fit(const Matrix& X,const Matrix& y, int epochs,double learning_rate)
+Matrix Network::infer(const MatrixView& input) const
+{
+    thread_local Scratch scratch;
+    return infer(input,scratch);
+}
+
+void Network::compile()
 {
+    clear_compiled();
+    size_t n=layers.size();
+    for(size_t i=0;i<n;)
+    {
+        Dense* dense=dynamic_cast<Dense*>(layers[i]);
+        Conv2D* conv=dynamic_cast<Conv2D*>(layers[i]);
+        if(!dense&&!conv)
+        {
+            compiled.push_back(layers[i++]);
+            continue;
+        }
+        size_t j=i+1;
+        BatchNorm* bn=j<n?dynamic_cast<BatchNorm*>(layers[j]):nullptr;
+        if(bn) j++;
+        Activation* act=j<n?dynamic_cast<Activation*>(layers[j]):nullptr;
+        if(act) j++;
+        Pooling* pool=conv&&j<n?dynamic_cast<Pooling*>(layers[j]):nullptr;
+        if(pool) j++;
+        //inference Dropout only scales, which commutes with both max and average pooling
+        double scale=1.0;
+        for(Dropout* drop;j<n&&(drop=dynamic_cast<Dropout*>(layers[j]));j++) scale*=1.0-drop->x;
+
+        Activate f=act?act->f:nullptr;
+        Layer* layer=dense?(Layer*)new FusedDense(*dense,bn,f,scale):(Layer*)new FusedConv2D(*conv,bn,f,pool,scale);
+        fused.push_back(layer);
+        compiled.push_back(layer);
+        i=j;
+    }
+}
+
+void Network::clear_compiled()
+{
+    for(auto layer:fused) delete layer;
+    fused.clear();
+    compiled.clear();
+}
+
+FitStats Network::fit(const MatrixView& X,const MatrixView& y, int epochs,double learning_rate,const FitOptions& options)
+{
+    if(layers.empty()) return FitStats();
+    BatchLoader loader(X,y,options.batch_size,options.shuffle,std::random_device{}());
+    return fit(loader,epochs,learning_rate,options);
+}
+
+FitStats Network::fit(const Dataset& data,int epochs,double learning_rate,const FitOptions& options)
+{
+    if(layers.empty()) return FitStats();
+    BatchLoader loader(data,options.batch_size,options.shuffle,std::random_device{}());
+    return fit(loader,epochs,learning_rate,options);
+}
+
+FitStats Network::fit(BatchLoader& loader,int epochs,double learning_rate,const FitOptions& options)
+{
+    typedef std::chrono::steady_clock clock;
     int m=layers.size();
+    FitStats stats;
+    //the fused copies would go stale as the weights change
+    clear_compiled();
+    //every activation stays alive until backprop is done, layers only keep views of their inputs
+    std::vector<Matrix> activations(m);
+    for(auto layer : layers) layer->is_training = true;
+
+    bool rebuilt;
+    std::vector<Parameter> tensors=bind_arena(layers,arena,4,rebuilt);
+    //the moments in rows 2 and 3 were zeroed with the new arena, so the step count starts over with them
+    if(rebuilt) optimizer.reset();
+    optimizer.use_state(&arena(2,0),&arena(3,0));
+
+    int workers=options.workers>0?options.workers:omp_get_max_threads();
+    Replicas replicas;
+    std::vector<std::vector<Layer*>> parallel;
+    std::vector<std::vector<Parameter>> worker_tensors;
+    if(workers>1)
+    {
+        parallel.push_back(layers);
+        worker_tensors.push_back(tensors);
+        replicas.arenas.resize(workers-1);
+        for(int k=1;k<workers;k++)
+        {
+            replicas.workers.emplace_back();
+            for(Layer* layer:layers) replicas.workers.back().push_back(model_file::create_layer(layer->name(),layer->arguments()));
+            parallel.push_back(replicas.workers.back());
+            bool fresh;
+            worker_tensors.push_back(bind_arena(parallel.back(),replicas.arenas[k-1],2,fresh));
+        }
+        broadcast(worker_tensors);
+    }
+
     for(int i=0;i<epochs;i++)
     {
-        for (auto layer : layers) layer->is_training = true;
-        Matrix output=X;
-        for(auto layer : layers) output = layer->forward_pass(output);
-        Matrix delta=output-y;
-        for(int j=m-1;j>=0;j--) delta=layers[j]->backward_pass(delta,learning_rate);
+        stats=FitStats();
+        stats.layer_seconds.assign(m,0.0);
+        auto epoch_start=clock::now();
+        loader.start_epoch();
+        MatrixView X_batch,y_batch;
+        int batch=0,samples=0;
+        while(loader.next(X_batch,y_batch))
+        {
+            samples+=X_batch.rows;
+            if(workers>1)
+            {
+                stats.loss+=data_parallel_step(parallel,worker_tensors,X_batch,y_batch,optimizer,learning_rate,stats.layer_seconds);
+                matrix_allocator().reset();
+                if(options.on_batch) options.on_batch(batch,loader.batches(),stats.loss/samples);
+                batch++;
+                continue;
+            }
+            auto t=clock::now();
+            auto lap=[&](int layer)
+            {
+                auto now=clock::now();
+                stats.layer_seconds[layer]+=std::chrono::duration<double>(now-t).count();
+                t=now;
+            };
+            activations[0]=layers[0]->forward_pass(X_batch);
+            lap(0);
+            for(int j=1;j<m;j++)
+            {
+                activations[j]=layers[j]->forward_pass(activations[j-1]);
+                lap(j);
+            }
+
+            stats.loss+=cross_entropy(activations[m-1],y_batch);
+
+            Matrix delta=std::move(activations[m-1]);
+            delta-=y_batch;
+            t=clock::now();
+            for(int j=m-1;j>=0;j--)
+            {
+                delta=layers[j]->gradient(delta);
+                lap(j);
+            }
+            optimizer.step(tensors,learning_rate);
+            matrix_allocator().reset();
+            if(options.on_batch) options.on_batch(batch,loader.batches(),stats.loss/samples);
+            batch++;
+        }
+
+        stats.loss/=std::max(samples,1);
+        stats.seconds=std::chrono::duration<double>(clock::now()-epoch_start).count();
+        stats.samples_per_sec=samples/std::max(stats.seconds,1e-9);
+        if(options.verbose)
+        {
+            std::cout << std::fixed << std::setprecision(1) << "Epoch " << i+1 << "/" << epochs << ": " << stats.samples_per_sec << " samples/s, loss " << std::setprecision(4) << stats.loss << std::endl;
+            for(int j=0;j<m;j++)
+            {
+                std::cout << "  " << std::left << std::setw(3) << j << std::setw(12) << layers[j]->name() << std::right << std::setprecision(3) << std::setw(9) << stats.layer_seconds[j] << " s" << std::setprecision(1) << std::setw(7) << 100.0*stats.layer_seconds[j]/stats.seconds << "%" << std::endl;
+            }
+        }
     }
+    return stats;
 }
 
 void Network::save(const std::string& filename) 
@@ -46,15 +389,35 @@ void Network::save(const std::string& filename)
     std::cout << "Model successfully saved to " << filename << std::endl;
 }
 
-void Network::load(const std::string& filename) 
+void Network::load(const std::string& filename,size_t scalar_bytes) 
 {
     std::ifstream file(filename,std::ios::binary);
     if(!file.is_open()) {
         std::cerr << "Error: Could not open " << filename << " for loading." << std::endl;
         return;
     }
-    for(Layer* layer : layers)layer->load(file);
+    if(scalar_bytes!=sizeof(float)&&scalar_bytes!=sizeof(double)) throw std::invalid_argument("Scalar size must be 4 or 8 bytes");
+    clear_compiled();
+    for(Layer* layer : layers)layer->load(file,scalar_bytes);
+    optimizer.reset();
     file.close();
     std::cout << "Model successfully loaded from " << filename << std::endl;
 }
 
+void Network::save_model(const std::string& filename) const
+{
+    model_file::save(filename,layers);
+    std::cout << "Model successfully saved to " << filename << std::endl;
+}
+
+void Network::load_model(const std::string& filename,bool verify)
+{
+    std::unique_ptr<MappedFile> file;
+    std::vector<Layer*> loaded=model_file::load(filename,file,verify);
+    clear_compiled();
+    for(auto layer:layers) delete layer;
+    layers=loaded;
+    optimizer.reset();
+    mapping=std::move(file);
+    std::cout << "Model successfully loaded from " << filename << std::endl;
+}
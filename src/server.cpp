@@ -1,99 +1,345 @@
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <fstream>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <omp.h>
 #include "../include/network.h"
 #include "../include/core/matrix.h"
-#include "../include/layers/dense.h"
-#include "../include/layers/conv2d.h"
-#include "../include/layers/pooling.h"
-#include "../include/layers/batchnorm.h"
-#include "../include/layers/dropout.h"
-#include "../include/layers/softmax.h"
-#include "../include/activation.h"
+#include "../include/emnist.h"
 #include "../include/core/utils.h"
+#include "../include/io/socket.h"
+#include "../include/io/protocol.h"
+#include "../include/io/batcher.h"
+#include "../include/io/model_file.h"
 
-char get_emnist_char(int index) 
+const int FEATURES = 784;
+
+char get_emnist_char(int index)
 {
     const std::string mapping = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabdefghnqrt";
     if (index >= 0 && index < 47) return mapping[index];
     return '?';
 }
 
-int argmax(const Matrix& m) 
+int argmax(const Matrix& m, int row)
 {
-    double max_val = -1e9; 
+    double max_val = -1e9;
     int max_idx = 0;
-    for(int i=0; i < m.cols; i++) 
+    for(int i=0; i < m.cols; i++)
     {
-        if(m(0, i) > max_val) 
+        if(m(row, i) > max_val)
         {
-            max_val = m(0, i);
+            max_val = m(row, i);
             max_idx = i;
         }
     }
     return max_idx;
 }
 
-int main()
+struct ServerOptions
 {
-    Network nn;
-    nn.add(new Conv2D(28,28,1,32,3)); 
-    nn.add(new BatchNorm(26*26*32));
-    nn.add(new Activation(leaky_relu,dleaky_relu));
-    nn.add(new Pooling(26,26,32,2,2));
+    std::string mode = "stdin";     //stdin (one text line per request), tcp or unix
+    int port = 5555;
+    std::string path = "/tmp/emnist.sock";
+    int workers = 4;                //connections served at the same time
+    bool debug = false;             //ASCII preview of every input on stderr
+    std::string model = "emnist_model.nnm";     //a model file, or weights saved by Network::save for the EMNIST layout
+    bool model_given = false;
+    BatcherOptions batching;        //requests from all connections are predicted together
+    int stats_interval = 0;         //seconds between batching statistics on stderr, 0 for none
+};
 
-    nn.add(new Conv2D(13,13,32,64,3)); 
-    nn.add(new BatchNorm(11*11*64));
-    nn.add(new Activation(leaky_relu,dleaky_relu));
-    nn.add(new Pooling(11,11,64,2,2));
+void usage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [--tcp [port] | --unix [path]] [--workers n] [--model file] [--debug]" << std::endl;
+    std::cerr << "       [--max-batch rows] [--max-wait-us us] [--latency-target-us us] [--stats seconds]" << std::endl;
+    std::cerr << "Without --tcp/--unix one line of 784 pixels is read from stdin per request." << std::endl;
+    std::cerr << "--max-batch 1 turns request batching off, every worker then runs its own requests in parallel." << std::endl;
+    std::cerr << "--model defaults to emnist_model.nnm, or emnist_model.bin when that does not exist." << std::endl;
+}
 
-    nn.add(new Dense(1600, 512));
-    nn.add(new BatchNorm(512));
-    nn.add(new Activation(leaky_relu, dleaky_relu));
+bool parse_args(int argc, char** argv, ServerOptions& options)
+{
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i+1 < argc && argv[i+1][0] != '-';
+        if(arg == "--tcp")
+        {
+            options.mode = "tcp";
+            if(has_value) options.port = std::atoi(argv[++i]);
+        }
+        else if(arg == "--unix")
+        {
+            options.mode = "unix";
+            if(has_value) options.path = argv[++i];
+        }
+        else if(arg == "--workers" && has_value) options.workers = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--model" && has_value)
+        {
+            options.model = argv[++i];
+            options.model_given = true;
+        }
+        else if(arg == "--debug") options.debug = true;
+        else if(arg == "--max-batch" && has_value) options.batching.max_batch = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--max-wait-us" && has_value) options.batching.max_wait_us = std::max(0, std::atoi(argv[++i]));
+        else if(arg == "--latency-target-us" && has_value) options.batching.latency_target_us = std::max(0, std::atoi(argv[++i]));
+        else if(arg == "--stats" && has_value) options.stats_interval = std::max(0, std::atoi(argv[++i]));
+        else return false;
+    }
+    return true;
+}
 
-    nn.add(new Dropout(0.5));
+void render(const Matrix& input, int row)
+{
+    std::ostringstream out;
+    out << "\n[C++] Model Input View:" << std::endl;
+    for(int r = 0; r < 28; r++) {
+        for(int c = 0; c < 28; c++) {
+            double pixel = input(row, r * 28 + c);
+            if(pixel > 0.5) out << "# ";
+            else if(pixel > 0.2) out << ". ";
+            else out << "  ";
+        }
+        out << "\n";
+    }
+    out << "------------------------" << std::endl;
+    std::cerr << out.str();
+}
 
-    nn.add(new Dense(512, 128));
-    nn.add(new BatchNorm(128));
-    nn.add(new Activation(leaky_relu, dleaky_relu));
+//Accepted connections waiting for a free worker
+class ConnectionQueue
+{
+    public:
+        void push(Socket&& connection)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending.push_back(std::move(connection));
+            }
+            ready.notify_one();
+        }
 
-    nn.add(new Dropout(0.25));
+        Socket pop()
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [&]{return !pending.empty();});
+            Socket connection = std::move(pending.front());
+            pending.pop_front();
+            return connection;
+        }
+    private:
+        std::deque<Socket> pending;
+        std::mutex lock;
+        std::condition_variable ready;
+};
 
-    nn.add(new Dense(128, 47));
-    nn.add(new Softmax());
+//Request/response pairs until the client disconnects or sends something malformed
+//Without a batcher every worker runs its requests itself, Network::infer is safe to call from all of them at once
+void serve_connection(const Socket& connection, const Network& nn, Batcher* batcher, const ServerOptions& options)
+{
+    std::vector<float> pixels;
+    std::vector<protocol::Prediction> predictions;
+    while(true)
+    {
+        protocol::RequestHeader request;
+        if(!connection.read_exact(&request, sizeof(request))) return;
 
-    std::cerr << " [C++] Loading Model Weights" << std::endl;
-    nn.load("emnist_model.bin");
-    std::cerr << " [C++] Model Ready! Listening for input" << std::endl;
+        protocol::ResponseHeader response = {protocol::OK, 0};
+        if(request.magic != protocol::MAGIC) response.status = protocol::BAD_MAGIC;
+        else if(request.features != FEATURES || request.count == 0 || request.count > protocol::MAX_COUNT) response.status = protocol::BAD_SHAPE;
+        if(response.status != protocol::OK)
+        {
+            connection.write_all(&response, sizeof(response));
+            return;
+        }
+
+        int count = request.count;
+        pixels.resize((size_t)count * FEATURES);
+        if(!connection.read_exact(pixels.data(), pixels.size() * sizeof(float))) return;
+        Matrix input = Matrix::uninitialized(count, FEATURES);
+        for(int r = 0; r < count; r++) for(int c = 0; c < FEATURES; c++) input(r, c) = pixels[(size_t)r * FEATURES + c];
+        if(options.debug) for(int r = 0; r < count; r++) render(input, r);
+
+        predictions.resize(count);
+        try
+        {
+            Matrix output = batcher ? batcher->submit(input.view()) : nn.infer(input.view());
+            for(int r = 0; r < count; r++)
+            {
+                int label = argmax(output, r);
+                predictions[r] = {label, (float)output(r, label)};
+            }
+            response.count = count;
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << " [C++] Prediction failed: " << e.what() << std::endl;
+            response.status = protocol::SERVER_ERROR;
+        }
+        if(!connection.write_all(&response, sizeof(response))) return;
+        if(response.status != protocol::OK) return;
+        if(!connection.write_all(predictions.data(), count * sizeof(protocol::Prediction))) return;
+    }
+}
+
+void print_stats(const BatcherStats& stats)
+{
+    std::ostringstream out;
+    out << " [C++] " << stats.requests << " requests in " << stats.batches << " batches";
+    if(stats.batches > 0)
+    {
+        out << ", " << (double)stats.rows / stats.batches << " rows per batch";
+        out << ", " << stats.wait_ms / stats.requests << " ms queued and " << stats.predict_ms / stats.batches << " ms predicting on average";
+    }
+    out << "\n       batch rows:";
+    for(size_t n = 1; n < stats.batch_rows.size(); n++) if(stats.batch_rows[n] > 0)
+        out << " " << n << (n + 1 == stats.batch_rows.size() ? "+" : "") << ":" << stats.batch_rows[n];
+    out << "\n       queue depth:";
+    for(size_t n = 0; n < stats.queue_depth.size(); n++) if(stats.queue_depth[n] > 0)
+        out << " " << n << (n + 1 == stats.queue_depth.size() ? "+" : "") << ":" << stats.queue_depth[n];
+    std::cerr << out.str() << std::endl;
+}
+
+int serve_socket(const Network& nn, const ServerOptions& options)
+{
+    Socket listener;
+    try
+    {
+        if(options.mode == "tcp") listener = Socket::listen_tcp(options.port);
+        else listener = Socket::listen_unix(options.path);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << " [C++] " << e.what() << std::endl;
+        return 1;
+    }
+    std::string address = options.mode == "tcp" ? "127.0.0.1:" + std::to_string(options.port) : options.path;
+    std::cerr << " [C++] Model Ready! Listening on " << address << " with " << options.workers << " workers" << std::endl;
+
+    //one copy of the weights for every worker
+    std::unique_ptr<Batcher> batcher;
+    if(options.batching.max_batch > 1) batcher.reset(new Batcher([&](const MatrixView& input){return nn.infer(input);}, options.batching));
+    std::mutex stats_lock;
+    std::condition_variable stats_stop;
+    bool stopping = false;
+    std::thread reporter;
+    if(batcher && options.stats_interval > 0)
+    {
+        reporter = std::thread([&]
+        {
+            std::unique_lock<std::mutex> guard(stats_lock);
+            while(!stats_stop.wait_for(guard, std::chrono::seconds(options.stats_interval), [&]{return stopping;}))
+                print_stats(batcher->stats());
+        });
+    }
 
+    ConnectionQueue queue;
+    std::vector<std::thread> workers;
+    /*
+    Every worker that runs its requests itself opens its own OpenMP teams inside the layers, and a new thread starts
+    from the default team size (all cores): split the cores between the workers instead of oversubscribing them.
+    With a batcher the workers only wait on it, its single thread keeps every core.
+    */
+    int threads_per_worker = std::max(1, omp_get_max_threads() / options.workers);
+    for(int i = 0; i < options.workers; i++)
+    {
+        workers.emplace_back([&]
+        {
+            if(!batcher) omp_set_num_threads(threads_per_worker);
+            while(true)
+            {
+                Socket connection = queue.pop();
+                if(!connection.valid()) return;
+                serve_connection(connection, nn, batcher.get(), options);
+            }
+        });
+    }
+
+    while(true)
+    {
+        //accept retries the errors of single clients itself, an invalid socket means the listener is gone
+        Socket connection = listener.accept();
+        if(!connection.valid()) break;
+        queue.push(std::move(connection));
+    }
+    //an invalid socket per worker tells it to stop
+    for(int i = 0; i < options.workers; i++) queue.push(Socket());
+    for(auto& worker : workers) worker.join();
+    if(reporter.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(stats_lock);
+            stopping = true;
+        }
+        stats_stop.notify_one();
+        reporter.join();
+    }
+    if(batcher) print_stats(batcher->stats());
+    return 0;
+}
+
+int serve_stdin(const Network& nn, const ServerOptions& options)
+{
+    std::cerr << " [C++] Model Ready! Listening for input" << std::endl;
     std::string line;
     while(std::getline(std::cin,line))
     {
         if(line=="exit") break;
         if(line.empty()) continue;
 
-        Matrix input(1,784);
+        Matrix input(1,FEATURES);
         std::stringstream ss(line);
-        for(int i=0;i<784;i++) ss >> input(0,i);
-        
-        std::cerr << "\n[C++] Model Input View:" << std::endl;
-        for(int r = 0; r < 28; r++) {
-            for(int c = 0; c < 28; c++) {
-                double pixel = input(0, r * 28 + c);
-                if(pixel > 0.5) std::cerr << "# ";
-                else if(pixel > 0.2) std::cerr << ". ";
-                else std::cerr << "  ";
-            }
-            std::cerr << "\n";
-        }
-        std::cerr << "------------------------" << std::endl;
+        for(int i=0;i<FEATURES;i++) ss >> input(0,i);
+        if(options.debug) render(input, 0);
 
-        Matrix output=nn.predict(input);
-        int prediction=argmax(output);
+        Matrix output=nn.infer(input.view());
+        int prediction=argmax(output, 0);
 
         std::cout<<get_emnist_char(prediction)<<std::endl;
     }
     return 0;
 }
 
+int main(int argc, char** argv)
+{
+    ServerOptions options;
+    if(!parse_args(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Network nn;
+    //without --model a model file is preferred, a tree that only has the weights of an older main still starts
+    if(!options.model_given && !std::ifstream(options.model).good()) options.model = "emnist_model.bin";
+    std::cerr << " [C++] Loading Model Weights" << std::endl;
+    try
+    {
+        if(model_file::is_model_file(options.model)) nn.load_model(options.model);
+        else
+        {
+            build_emnist(nn);
+            nn.load(options.model);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << " [C++] " << e.what() << std::endl;
+        return 1;
+    }
+    //BatchNorm, activations, pooling and dropout folded into the Conv2D/Dense layers for inference
+    nn.compile();
+
+    if(options.mode == "stdin") return serve_stdin(nn, options);
+    return serve_socket(nn, options);
+}
@@ -3,12 +3,12 @@
 #include "../include/layers/lstm.h"
 #include "../include/layers/dense.h"
 #include "../include/layers/softmax.h"
+#include "../include/io/data_frame.h"
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <vector>
-#include <map>
 #include <algorithm>
+#include <numeric>
+#include <random>
 #include <string>
 
 // --- Config ---
@@ -16,195 +16,161 @@ const int JOINTS = 21;
 const int COORDS = 3; // x, y, z
 const int EPOCHS = 50;
 const int HIDDEN_SIZE = 64;
+const int BATCH_SIZE = 32;
 
-struct ASLSample {
-    std::vector<Matrix> sequence; // 21 steps of (3x1)
-    int label;
+struct ASLData {
+    Matrix X;                   // one sample per row: x0,y0,z0 ... x20,y20,z20
+    std::vector<int> labels;
+    int num_classes = 0;
 };
 
 // --- Normalization Logic ---
 // CRITICAL: Makes the model invariant to where your hand is on the screen
-void normalize_hand(std::vector<Matrix>& seq) {
-    if (seq.empty()) return;
-    
+void normalize_hand(real* joints) {
     // 1. Shift to Origin: Wrist (Index 0) becomes (0,0,0)
-    Matrix wrist = seq[0]; 
+    real wrist[COORDS] = {joints[0], joints[1], joints[2]};
     double max_dist = 0.0;
 
-    for (auto& joint : seq) {
-        joint = joint - wrist; // Relative position
-        
+    for (int i = 0; i < JOINTS; i++) {
+        real* joint = joints + i * COORDS;
+        for (int k = 0; k < COORDS; k++) joint[k] -= wrist[k]; // Relative position
+
         // Calculate distance from wrist to find Scale Factor
-        double dist = std::sqrt(joint(0,0)*joint(0,0) + joint(1,0)*joint(1,0) + joint(2,0)*joint(2,0));
+        double dist = std::sqrt(joint[0]*joint[0] + joint[1]*joint[1] + joint[2]*joint[2]);
         if (dist > max_dist) max_dist = dist;
     }
 
     // 2. Scale to Unit Size (0.0 to 1.0 range)
     if (max_dist > 0) {
-        for (auto& joint : seq) {
-            joint = joint * (1.0 / max_dist);
-        }
+        for (int i = 0; i < JOINTS * COORDS; i++) joints[i] *= 1.0 / max_dist;
     }
 }
 
-// --- Robust CSV Loader ---
-std::vector<ASLSample> load_data(const std::string& filename, int& num_classes) {
-    std::vector<ASLSample> dataset;
-    std::ifstream file(filename);
-    std::string line;
-    
-    // Auto-Map: Converts "A" -> 0, "B" -> 1, "Space" -> 2
-    std::map<std::string, int> label_map;
-    int next_label_id = 0;
-
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open " << filename << std::endl;
-        return dataset;
-    }
-
-    // 1. Skip Header
-    std::getline(file, line);
+// --- CSV Loader ---
+// Parsed in parallel by DataFrame: 63 coordinate columns (x0,y0,z0 ... z20), then the label
+ASLData load_data(const std::string& filename) {
+    ASLData data;
+    DataFrame df;
 
     std::cout << "Loading " << filename << "..." << std::endl;
-    
-    while (std::getline(file, line)) {
-        std::stringstream ss(line);
-        std::string segment;
-        std::vector<std::string> raw_row;
-
-        // Split line by comma
-        while (std::getline(ss, segment, ',')) {
-            raw_row.push_back(segment);
-        }
-
-        // Validation: Expect 63 coords + 1 label = 64 columns
-        if (raw_row.size() < 64) continue;
-
-        ASLSample s;
-        
-        // 2. Parse Coordinates (First 63 columns)
-        try {
-            for (int i = 0; i < JOINTS; i++) {
-                Matrix joint(3, 1);
-                // raw_row index: i*3 + 0 (x), +1 (y), +2 (z)
-                joint(0, 0) = std::stod(raw_row[i * 3 + 0]);
-                joint(1, 0) = std::stod(raw_row[i * 3 + 1]);
-                joint(2, 0) = std::stod(raw_row[i * 3 + 2]);
-                s.sequence.push_back(joint);
-            }
-        } catch (...) {
-            continue; // Skip rows with bad numbers
-        }
+    try {
+        df.read_csv(filename);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return data;
+    }
+    if (df.get_cols() < JOINTS * COORDS + 1) {
+        std::cerr << "Error: Expected " << JOINTS * COORDS << " coordinates and a label per row" << std::endl;
+        return data;
+    }
 
-        // 3. Parse Label (The LAST column)
-        std::string label_str = raw_row.back();
-        
-        // Clean whitespace
-        label_str.erase(std::remove(label_str.begin(), label_str.end(), '\r'), label_str.end());
-        label_str.erase(std::remove(label_str.begin(), label_str.end(), '\n'), label_str.end());
-
-        // Assign ID
-        if (label_map.find(label_str) == label_map.end()) {
-            label_map[label_str] = next_label_id++;
-            std::cout << "Found New Class: " << label_str << " -> ID " << label_map[label_str] << "\n";
-        }
-        s.label = label_map[label_str];
+    data.X = df.select(0, JOINTS * COORDS - 1);
+    // Auto-Map: Converts "A" -> 0, "B" -> 1, "Space" -> 2 in order of appearance
+    Matrix labels = df.get_column_encode("label");
+    const std::vector<std::string>& names = df.categories("label");
+    for (size_t k = 0; k < names.size(); k++) std::cout << "Found New Class: " << names[k] << " -> ID " << k << "\n";
 
-        // 4. Normalize
-        normalize_hand(s.sequence);
-        
-        dataset.push_back(s);
+    for (int r = 0; r < data.X.rows; r++) {
+        normalize_hand(&data.X(r, 0));
+        data.labels.push_back((int)labels(r, 0));
+        data.num_classes = std::max(data.num_classes, data.labels.back() + 1);
     }
-    
-    num_classes = next_label_id;
-    std::cout << "Loaded " << dataset.size() << " samples. Total Classes: " << num_classes << std::endl;
-    return dataset;
+
+    std::cout << "Loaded " << data.X.rows << " samples. Total Classes: " << data.num_classes << std::endl;
+    return data;
 }
 
 int main() {
     srand(42);
-    int num_classes = 0;
-    
+
     // 1. Load Data
-    std::vector<ASLSample> data = load_data("asl_landmarks_final.csv", num_classes);
-    
-    if (data.empty()) {
+    ASLData data = load_data("asl_landmarks_final.csv");
+    int num_classes = data.num_classes;
+    int n = data.X.rows;
+
+    if (n == 0) {
         std::cerr << "CRITICAL ERROR: Data loaded is empty. Check if file exists." << std::endl;
         return 1;
     }
 
     // 2. Architecture
     // Input: 3 (x,y,z) | Time Steps: 21 (joints) | Hidden: 64
-    LSTM lstm(3, HIDDEN_SIZE);
-    
-    // Dense expects 1x64 Input (Row Vector), Output: num_classes
+    LSTM lstm(COORDS, HIDDEN_SIZE);
+
+    // Dense takes the last hidden state of every sequence in the batch, Output: num_classes
     Dense dense(HIDDEN_SIZE, num_classes);
     Softmax softmax;
-    
-    double lr = 0.001;
+
+    double lr = 0.005;
 
     std::cout << "Starting Training on ASL Data..." << std::endl;
 
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 rng(42);
+
     for (int epoch = 0; epoch < EPOCHS; epoch++) {
         double total_loss = 0;
         int correct = 0;
-        
+
         // Simple Shuffle
-        std::random_shuffle(data.begin(), data.end());
+        std::shuffle(order.begin(), order.end(), rng);
 
-        for (const auto& sample : data) {
+        for (int start = 0; start < n; start += BATCH_SIZE) {
+            int batch = std::min(BATCH_SIZE, n - start);
+
+            // Step j of the batch holds joint j of every sample, batch x 3
+            std::vector<Matrix> sequence(JOINTS, Matrix::uninitialized(batch, COORDS));
             // Target One-Hot
-            Matrix y_true = Matrix::zeros(1, num_classes);
-            y_true(0, sample.label) = 1.0;
+            Matrix y_true = Matrix::zeros(batch, num_classes);
+            for (int r = 0; r < batch; r++) {
+                int sample = order[start + r];
+                for (int j = 0; j < JOINTS; j++)
+                    for (int k = 0; k < COORDS; k++) sequence[j](r, k) = data.X(sample, j * COORDS + k);
+                y_true(r, data.labels[sample]) = 1.0;
+            }
 
             // --- Forward ---
-            // 1. LSTM (Sequence of 21) -> Returns Vector of (Hidden x 1)
-            std::vector<Matrix> lstm_out = lstm.forward_pass(sample.sequence);
-            Matrix h_last = lstm_out.back(); // Shape (64, 1)
-
-            // 2. Transpose for Dense (64, 1) -> (1, 64)
-            Matrix dense_in = h_last.transpose();
+            // 1. LSTM (Sequence of 21) -> hidden state after every joint, (batch x 64)
+            std::vector<Matrix> lstm_out = lstm.forward_pass(sequence);
 
-            // 3. Dense -> Softmax
-            Matrix logits = dense.forward_pass(dense_in);
+            // 2. Dense -> Softmax on the last one
+            Matrix logits = dense.forward_pass(lstm_out.back());
             Matrix probs = softmax.forward_pass(logits);
 
             // --- Backward ---
             // 1. Loss Gradient (P - Y)
             Matrix d_logits = probs - y_true;
 
-            // 2. Dense Backward (Updates itself)
-            // Returns (1, 64)
-            Matrix d_h_T = dense.backward_pass(d_logits, lr);
-            
-            // 3. Transpose back for LSTM (64, 1)
-            Matrix d_h = d_h_T.transpose();
-
-            // 4. LSTM Backward
-            std::vector<Matrix> d_seq(JOINTS, Matrix::zeros(HIDDEN_SIZE, 1));
-            d_seq.back() = d_h; // Gradient only at last step
+            // 2. Dense Backward (Updates itself), returns (batch x 64)
+            Matrix d_h = dense.backward_pass(d_logits, lr);
 
+            // 3. LSTM Backward, gradient only at the last step
+            std::vector<Matrix> d_seq(JOINTS);
+            d_seq.back() = std::move(d_h);
             lstm.backward_pass(d_seq);
-            
-            // 5. Update LSTM
+
+            // 4. Update LSTM
             lstm.update(lr);
 
             // --- Stats ---
-            total_loss += -std::log(probs(0, sample.label) + 1e-9);
-            
-            // Argmax
-            int pred = 0;
-            double max_p = -1.0;
-            for(int k=0; k<num_classes; k++) {
-                if(probs(0,k) > max_p) { max_p = probs(0,k); pred = k; }
+            for (int r = 0; r < batch; r++) {
+                int label = data.labels[order[start + r]];
+                total_loss += -std::log(probs(r, label) + 1e-9);
+
+                // Argmax
+                int pred = 0;
+                for (int k = 1; k < num_classes; k++) {
+                    if (probs(r, k) > probs(r, pred)) pred = k;
+                }
+                if (pred == label) correct++;
             }
-            if(pred == sample.label) correct++;
         }
 
-        std::cout << "Epoch " << epoch 
-                  << " | Loss: " << total_loss / data.size() 
-                  << " | Acc: " << (double)correct / data.size() * 100.0 << "%" << std::endl;
+        std::cout << "Epoch " << epoch
+                  << " | Loss: " << total_loss / n
+                  << " | Acc: " << (double)correct / n * 100.0 << "%" << std::endl;
     }
 
     return 0;
-}
\ No newline at end of file
+}